@@ -0,0 +1,82 @@
+namespace AllocationCounter
+{
+  /*
+   * Number of heap allocations made by the program, for the allocation
+   * check of the time loop of Heat_Pipe::run(). The counter is only
+   * incremented by the replacements of the global operator new in
+   * composite_region.cc, which are compiled in when TRL_COUNT_ALLOCATIONS
+   * is defined (cmake -DCOUNT_ALLOCATIONS=ON). In other builds, or in
+   * programs that do not replace operator new, it stays at zero and the
+   * check never fires.
+   * */
+#ifdef TRL_COUNT_ALLOCATIONS
+  const bool enabled=true;
+#else
+  const bool enabled=false;
+#endif
+
+  inline
+  std::atomic<unsigned long> &counter ()
+  {
+    static std::atomic<unsigned long> allocations(0);
+    return allocations;
+  }
+
+  inline
+  void increment ()
+  {
+    counter().fetch_add(1,std::memory_order_relaxed);
+  }
+
+  inline
+  unsigned long count ()
+  {
+    return counter().load(std::memory_order_relaxed);
+  }
+
+  /*
+   * Allocations made between start() and stop(), summed over several
+   * start()/stop() pairs until take() returns and resets the sum. Used to
+   * leave the logging and the vtu output of a time step out of the count.
+   */
+  class Section
+  {
+  public:
+    Section ();
+
+    void start ();
+    void stop ();
+    unsigned long take ();
+
+  private:
+    unsigned long start_count;
+    unsigned long allocations;
+  };
+
+  inline
+  Section::Section ()
+    :
+    start_count(0),
+    allocations(0)
+  {}
+
+  inline
+  void Section::start ()
+  {
+    start_count=count();
+  }
+
+  inline
+  void Section::stop ()
+  {
+    allocations+=count()-start_count;
+  }
+
+  inline
+  unsigned long Section::take ()
+  {
+    const unsigned long n=allocations;
+    allocations=0;
+    return n;
+  }
+}
@@ -0,0 +1,210 @@
+  /*
+   * Lagged material coefficients. For every quadrature point the thermal
+   * conductivity and heat capacity are stored together with the temperature
+   * at which they were evaluated. They are reused until the temperature at
+   * the point moves by more than 'tolerance' from that temperature, unless
+   * either temperature is within 'freezing_band' of the freezing point,
+   * where the heat capacity changes quickly (latent heat) and the
+   * coefficients are always evaluated.
+   *
+   * Cell matrices can also be stored so that a cell whose quadrature points
+   * are all current skips the quadrature loop.
+   *
+   * A tolerance of zero disables the cache.
+   * */
+  class CoefficientCache
+  {
+  public:
+    CoefficientCache ();
+
+    void reinit (const unsigned int n_cells,
+		 const unsigned int n_q_points,
+		 const unsigned int dofs_per_cell,
+		 const double       tolerance,
+		 const double       freezing_point,
+		 const double       freezing_band);
+    void invalidate ();
+    bool enabled () const;
+
+    bool is_current (const unsigned int cell,
+		     const unsigned int q_point,
+		     const double       temperature) const;
+    bool cell_is_current (const unsigned int cell,
+			  const std::vector<double> &temperatures) const;
+
+    void store (const unsigned int cell,
+		const unsigned int q_point,
+		const double       temperature,
+		const double       thermal_conductivity,
+		const double       heat_capacity);
+    void store_cell_matrices (const unsigned int cell,
+			      const FullMatrix<double> &mass_matrix,
+			      const FullMatrix<double> &laplace_matrix);
+    void get_cell_matrices (const unsigned int cell,
+			    FullMatrix<double> &mass_matrix,
+			    FullMatrix<double> &laplace_matrix) const;
+
+    double thermal_conductivity (const unsigned int cell,
+				 const unsigned int q_point) const;
+    double heat_capacity (const unsigned int cell,
+			  const unsigned int q_point) const;
+
+  private:
+    bool near_freezing_point (const double temperature) const;
+
+    unsigned int n_q_points;
+    unsigned int dofs_per_cell;
+    double       tolerance;
+    double       freezing_point;
+    double       freezing_band;
+
+    std::vector<double> temperatures;
+    std::vector<double> thermal_conductivities;
+    std::vector<double> heat_capacities;
+    std::vector<double> mass_matrices;
+    std::vector<double> laplace_matrices;
+    std::vector<bool>   cell_matrices_stored;
+  };
+
+  inline
+  CoefficientCache::CoefficientCache ()
+    :
+    n_q_points(0),
+    dofs_per_cell(0),
+    tolerance(0.),
+    freezing_point(0.),
+    freezing_band(0.)
+  {}
+
+  inline
+  void CoefficientCache::reinit (const unsigned int n_cells,
+				 const unsigned int n_q_points_,
+				 const unsigned int dofs_per_cell_,
+				 const double       tolerance_,
+				 const double       freezing_point_,
+				 const double       freezing_band_)
+  {
+    n_q_points    =n_q_points_;
+    dofs_per_cell =dofs_per_cell_;
+    tolerance     =tolerance_;
+    freezing_point=freezing_point_;
+    freezing_band =freezing_band_;
+
+    if (!enabled())
+      {
+	temperatures.clear();
+	thermal_conductivities.clear();
+	heat_capacities.clear();
+	mass_matrices.clear();
+	laplace_matrices.clear();
+	cell_matrices_stored.clear();
+	return;
+      }
+
+    temperatures.resize          (n_cells*n_q_points);
+    thermal_conductivities.resize(n_cells*n_q_points);
+    heat_capacities.resize       (n_cells*n_q_points);
+    mass_matrices.resize         (n_cells*dofs_per_cell*dofs_per_cell);
+    laplace_matrices.resize      (n_cells*dofs_per_cell*dofs_per_cell);
+    cell_matrices_stored.resize  (n_cells);
+    invalidate();
+  }
+
+  inline
+  void CoefficientCache::invalidate ()
+  {
+    std::fill(temperatures.begin(),temperatures.end(),
+	      std::numeric_limits<double>::max());
+    std::fill(cell_matrices_stored.begin(),cell_matrices_stored.end(),false);
+  }
+
+  inline
+  bool CoefficientCache::enabled () const
+  {
+    return tolerance>0.;
+  }
+
+  inline
+  bool CoefficientCache::near_freezing_point (const double temperature) const
+  {
+    return fabs(temperature-freezing_point)<=freezing_band;
+  }
+
+  inline
+  bool CoefficientCache::is_current (const unsigned int cell,
+				     const unsigned int q_point,
+				     const double       temperature) const
+  {
+    const double stored_temperature=temperatures[cell*n_q_points+q_point];
+    return (fabs(temperature-stored_temperature)<=tolerance &&
+	    !near_freezing_point(temperature) &&
+	    !near_freezing_point(stored_temperature));
+  }
+
+  inline
+  bool CoefficientCache::cell_is_current (const unsigned int cell,
+					  const std::vector<double> &temperatures_) const
+  {
+    if (!cell_matrices_stored[cell])
+      return false;
+    for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+      if (!is_current(cell,q_point,temperatures_[q_point]))
+	return false;
+    return true;
+  }
+
+  inline
+  void CoefficientCache::store (const unsigned int cell,
+				const unsigned int q_point,
+				const double       temperature,
+				const double       thermal_conductivity,
+				const double       heat_capacity)
+  {
+    const unsigned int index=cell*n_q_points+q_point;
+    temperatures          [index]=temperature;
+    thermal_conductivities[index]=thermal_conductivity;
+    heat_capacities       [index]=heat_capacity;
+  }
+
+  inline
+  void CoefficientCache::store_cell_matrices (const unsigned int cell,
+					      const FullMatrix<double> &mass_matrix,
+					      const FullMatrix<double> &laplace_matrix)
+  {
+    const unsigned int offset=cell*dofs_per_cell*dofs_per_cell;
+    for (unsigned int i=0; i<dofs_per_cell; ++i)
+      for (unsigned int j=0; j<dofs_per_cell; ++j)
+	{
+	  mass_matrices   [offset+i*dofs_per_cell+j]=mass_matrix(i,j);
+	  laplace_matrices[offset+i*dofs_per_cell+j]=laplace_matrix(i,j);
+	}
+    cell_matrices_stored[cell]=true;
+  }
+
+  inline
+  void CoefficientCache::get_cell_matrices (const unsigned int cell,
+					    FullMatrix<double> &mass_matrix,
+					    FullMatrix<double> &laplace_matrix) const
+  {
+    const unsigned int offset=cell*dofs_per_cell*dofs_per_cell;
+    for (unsigned int i=0; i<dofs_per_cell; ++i)
+      for (unsigned int j=0; j<dofs_per_cell; ++j)
+	{
+	  mass_matrix(i,j)   =mass_matrices   [offset+i*dofs_per_cell+j];
+	  laplace_matrix(i,j)=laplace_matrices[offset+i*dofs_per_cell+j];
+	}
+  }
+
+  inline
+  double CoefficientCache::thermal_conductivity (const unsigned int cell,
+						 const unsigned int q_point) const
+  {
+    return thermal_conductivities[cell*n_q_points+q_point];
+  }
+
+  inline
+  double CoefficientCache::heat_capacity (const unsigned int cell,
+					  const unsigned int q_point) const
+  {
+    return heat_capacities[cell*n_q_points+q_point];
+  }
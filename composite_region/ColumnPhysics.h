@@ -0,0 +1,844 @@
+  /*
+   * Top boundary condition types: fixed temperature (first), fixed heat
+   * flux (second) and convective (third).
+   */
+  enum TopBoundaryCondition
+  {
+    first_type_top,
+    second_type_top,
+    third_type_top
+  };
+  /*
+   * Theta values for which the assembly kernels are specialised. The
+   * theta factors are compile time constants in the specialised kernels,
+   * and for backward_euler the old time step terms are skipped.
+   */
+  enum ThetaScheme
+  {
+    general_theta,
+    crank_nicolson,
+    backward_euler
+  };
+  /*
+   * Boundary indicators. The top surface is at z=0 and the bottom at
+   * z=-domain_size, where z is the last coordinate. In 1D these are the
+   * indicators hyper_cube assigns to the left and right ends.
+   */
+  enum BoundaryId
+  {
+    bottom_boundary_id  = 0,
+    top_boundary_id     = 1,
+    lateral_boundary_id = 2
+  };
+
+  /*
+   * Heat flux (W/m2) into the domain for the second type top condition,
+   * and heat transfer coefficient (W/m2K) for the third type.
+   */
+  const double top_fixed_heat_flux       =-100.;
+  const double top_convective_coefficient=10.;
+
+  template <ThetaScheme scheme>
+  inline double theta_value (const double theta)
+  {
+    return theta;
+  }
+
+  template <>
+  inline double theta_value<crank_nicolson> (const double)
+  {
+    return 0.5;
+  }
+
+  template <>
+  inline double theta_value<backward_euler> (const double)
+  {
+    return 1.0;
+  }
+
+  inline
+  TopBoundaryCondition top_boundary_condition_type (const std::string &name)
+  {
+    if (name.compare("first")==0)
+      return first_type_top;
+    else if (name.compare("second")==0)
+      return second_type_top;
+    else if (name.compare("third")==0)
+      return third_type_top;
+
+    std::cout << "\n\n\tError, wrong top boundary condition type\n\n";
+    throw 1;
+  }
+
+  /*
+   * Physics of the column, shared by the serial model (Heat_Pipe) and the
+   * distributed one (Heat_Pipe_MPI): the layer materials, the forcing of
+   * the data files and the cell and face integrals of the theta scheme.
+   * The models own the mesh, the linear algebra and the time loop, and
+   * pass the finite element values of each cell or face in.
+   *
+   * The kernels add to the cell matrices and vectors they are given, the
+   * caller zeroes them. Heat rates are positive into the domain.
+   * */
+  template <int dim>
+  class ColumnPhysics
+  {
+  public:
+    ColumnPhysics ();
+
+    /*
+     * Keeps a reference to 'parameters', so that later changes (e.g. of
+     * the heat loss factor by the calibration) are seen here. 'log' gets
+     * the information about the data files read, or nothing if it is 0.
+     */
+    void reinit (const Parameters::AllParameters<dim> &parameters,
+		 std::ostream                         *log);
+
+    unsigned int find_layer (const double cell_center) const;
+    /*
+     * Rebuilds the material of 'layer' after layer_data[layer] changed.
+     */
+    void update_layer_material (const unsigned int layer);
+    void material_data (const double cell_center/*(m)*/,
+			const double cell_temperature/*(C)*/,
+			double &thermal_conductivity/*(W/mK)*/,
+			double &total_volumetric_heat_capacity/*(J/m3K)*/,
+			double &ice_saturation) const;
+    double thermal_energy (const double cell_center/*(m)*/,
+			   const double cell_temperature/*(C)*/) const;
+    double thermal_losses (const double temperature_gradient/*(m)*/) const;
+
+    /*
+     * Forcing at time t: surface and room temperatures of the forcing
+     * file or of the sinusoid of the parameter file, and magnitude of the
+     * point sources. The files are read at the first lookup.
+     */
+    double surface_temperature (const double t);
+    double room_temperature (const double t);
+    double mean_surface_temperature ();
+    double mean_room_temperature ();
+    double point_source_magnitude (const unsigned int source,
+				   const double       t);
+    void seek_forcing (const double t);
+
+    /*
+     * Mass and laplace matrices of a cell with the coefficients at the
+     * (theta weighted) temperatures of its quadrature points, and the heat
+     * losses of the step (times time_step). With evaluate_matrices=false
+     * only the heat losses are added, for cells whose matrices are kept
+     * from an earlier evaluation. The coefficients evaluated are returned
+     * in thermal_conductivities and heat_capacities.
+     */
+    template <ThetaScheme scheme>
+    void cell_terms (const FEValues<dim>       &fe_values,
+		     const double               cell_center,
+		     const std::vector<double> &temperatures,
+		     const double               theta_temperature,
+		     const double               time_step,
+		     const double               old_room_temperature,
+		     const double               new_room_temperature,
+		     const bool                 evaluate_matrices,
+		     std::vector<double>       &thermal_conductivities,
+		     std::vector<double>       &heat_capacities,
+		     FullMatrix<double>        &mass_matrix,
+		     FullMatrix<double>        &laplace_matrix,
+		     Vector<double>            &rhs) const;
+    /*
+     * Theta scheme on the cell:
+     *   (M + theta dt K) T_new = (M - (1-theta) dt K) T_old + rhs
+     * Sets system_matrix and adds the old time step part to rhs, so that
+     * no global mass and laplace matrices are needed.
+     */
+    template <ThetaScheme scheme>
+    void theta_system (const FullMatrix<double> &mass_matrix,
+		       const FullMatrix<double> &laplace_matrix,
+		       const Vector<double>     &old_temperature_values,
+		       const double              theta_temperature,
+		       const double              time_step,
+		       FullMatrix<double>       &system_matrix,
+		       Vector<double>           &rhs) const;
+    /*
+     * Terms of a top face for the second and third type conditions (none
+     * for the first type, which is a Dirichlet condition). Returns whether
+     * the laplace matrix was changed.
+     */
+    template <ThetaScheme scheme, TopBoundaryCondition top_condition>
+    bool top_face_terms (const FEFaceValues<dim> &fe_face_values,
+			 const double             theta_temperature,
+			 const double             time_step,
+			 const double             old_surface_temperature,
+			 const double             new_surface_temperature,
+			 FullMatrix<double>      &laplace_matrix,
+			 Vector<double>          &rhs) const;
+    /*
+     * Heat exchange with the room through a lateral face.
+     */
+    template <ThetaScheme scheme>
+    void lateral_face_terms (const FEFaceValues<dim> &fe_face_values,
+			     const double             theta_temperature,
+			     const double             time_step,
+			     const double             old_room_temperature,
+			     const double             new_room_temperature,
+			     FullMatrix<double>      &laplace_matrix,
+			     Vector<double>          &rhs) const;
+
+    /*
+     * Energy balance terms of a step, with the same theta weighting as
+     * the time discretization: heat losses in a cell and heat flowing in
+     * through a boundary face (W in 3D, per unit length in 2D and per
+     * unit area in 1D).
+     */
+    double cell_heat_loss_rate (const FEValues<dim>       &fe_values,
+				const std::vector<double> &old_values,
+				const std::vector<double> &new_values,
+				const double               theta,
+				const double               old_room_temperature,
+				const double               new_room_temperature) const;
+    double boundary_heat_rate (const FEFaceValues<dim>           &fe_face_values,
+			       const types::boundary_id           boundary_id,
+			       const TopBoundaryCondition         top_condition,
+			       const double                       cell_center,
+			       const double                       theta,
+			       const std::vector<double>         &old_face_values,
+			       const std::vector<double>         &new_face_values,
+			       const std::vector<Tensor<1,dim> > &old_face_gradients,
+			       const std::vector<Tensor<1,dim> > &new_face_gradients,
+			       const double                       old_surface_temperature,
+			       const double                       new_surface_temperature,
+			       const double                       old_room_temperature,
+			       const double                       new_room_temperature) const;
+
+    /*
+     * One line of the output file: time step, time, probe temperatures,
+     * stored energy, heat rates through the top, bottom and lateral
+     * boundaries, of the point sources and of the heat losses, and the
+     * accumulated energy balance error. All but the time step and the
+     * time are written with 'precision' significant digits.
+     */
+    static void write_output_line (std::ostream              &out,
+				   const unsigned int         precision,
+				   const unsigned int         timestep_number,
+				   const double               time,
+				   const std::vector<double> &probe_values,
+				   const double               column_thermal_energy,
+				   const double               heat_flux_top,
+				   const double               heat_flux_bottom,
+				   const double               heat_flux_lateral,
+				   const double               point_source_rate,
+				   const double               heat_loss_rate,
+				   const double               energy_balance_error);
+
+    /*
+     * string "material_name"
+     * double "porosity"
+     * double "degree_of_saturation"
+     * string "relationship"
+     */
+    std::vector<std::tuple<std::string,double,double,std::string> > layer_data;
+
+  private:
+    void read_forcing_series ();
+    void read_point_sources ();
+
+    const Parameters::AllParameters<dim> *parameters;
+    std::ostream                         *log;
+    /*
+     * One PorousMaterial per layer, built from layer_data by
+     * update_layer_material() whenever a layer changes, instead of one
+     * per call of material_data().
+     */
+    std::vector<std::unique_ptr<PorousMaterial> > layer_materials;
+
+    ForcingSeries                      surface_temperature_series;
+    ForcingSeries                      room_temperature_series;
+    std::vector< std::vector< std::vector<double> > > point_source_data;
+  };
+
+  template <int dim>
+  ColumnPhysics<dim>::ColumnPhysics ()
+    :
+    parameters(0),
+    log(0)
+  {}
+
+  template <int dim>
+  void ColumnPhysics<dim>::reinit (const Parameters::AllParameters<dim> &parameters_,
+				   std::ostream                         *log_)
+  {
+    parameters=&parameters_;
+    log=log_;
+
+    layer_data.clear();
+    layer_data
+      .push_back(std::tuple<std::string,double,double,std::string>
+		 (parameters->material_0_name,
+		  parameters->material_0_porosity,
+		  parameters->material_0_degree_of_saturation,
+		  parameters->material_0_thermal_conductivity_relationship));
+    layer_data
+      .push_back(std::tuple<std::string,double,double,std::string>
+		 (parameters->material_1_name,
+		  parameters->material_1_porosity,
+		  parameters->material_1_degree_of_saturation,
+		  parameters->material_1_thermal_conductivity_relationship));
+    layer_data
+      .push_back(std::tuple<std::string,double,double,std::string>
+		 (parameters->material_2_name,
+		  parameters->material_2_porosity,
+		  parameters->material_2_degree_of_saturation,
+		  parameters->material_2_thermal_conductivity_relationship));
+    layer_data
+      .push_back(std::tuple<std::string,double,double,std::string>
+		 (parameters->material_3_name,
+		  parameters->material_3_porosity,
+		  parameters->material_3_degree_of_saturation,
+		  parameters->material_3_thermal_conductivity_relationship));
+    layer_data
+      .push_back(std::tuple<std::string,double,double,std::string>
+		 (parameters->material_4_name,
+		  parameters->material_4_porosity,
+		  parameters->material_4_degree_of_saturation,
+		  parameters->material_4_thermal_conductivity_relationship));
+    layer_materials.resize(layer_data.size());
+    for (unsigned int layer=0; layer<layer_data.size(); layer++)
+      update_layer_material(layer);
+
+    surface_temperature_series=ForcingSeries();
+    room_temperature_series   =ForcingSeries();
+    point_source_data.clear();
+  }
+
+  template <int dim>
+  unsigned int ColumnPhysics<dim>::find_layer (const double cell_center) const
+  {
+    unsigned int layer_number=0;
+    if (cell_center>-1.*(parameters->material_0_depth+parameters->material_0_thickness))
+      layer_number=0;
+    else if (cell_center<=-1.*parameters->material_1_depth &&
+	     cell_center>-1.*(parameters->material_1_depth+parameters->material_1_thickness))
+      layer_number=1;
+    else if (cell_center<=-1.* parameters->material_2_depth &&
+	     cell_center>-1.*(parameters->material_2_depth+parameters->material_2_thickness))
+      layer_number=2;
+    else if (cell_center<=-1.* parameters->material_3_depth &&
+	     cell_center>-1.*(parameters->material_3_depth+parameters->material_3_thickness))
+      layer_number=3;
+    else if (cell_center<=-1.*parameters->material_4_depth)
+      layer_number=4;
+    else
+      {
+	std::cout << "Error. Cell centre not found." << std::endl;
+	throw -1;
+      }
+    return layer_number;
+  }
+
+  template <int dim>
+  void ColumnPhysics<dim>::update_layer_material (const unsigned int layer)
+  {
+    layer_materials[layer].reset(new PorousMaterial(std::get<0>(layer_data[layer]),
+						    std::get<1>(layer_data[layer]),
+						    std::get<2>(layer_data[layer])));
+  }
+
+  template <int dim>
+  void ColumnPhysics<dim>::material_data (const double cell_center,
+					  const double cell_temperature,
+					  double &thermal_conductivity,
+					  double &total_volumetric_heat_capacity,
+					  double &ice_saturation) const
+  {
+    /*
+     * We are assuming that each layer is composed of three fractions: solid, liquid, frozen liquid,
+     * and gas. At the moment, the assumption is that liquid is water, frozen liquid is ice and gas
+     * is air for all layers. Solids can vary, in out particular case, at least one layer has a
+     * different kind of solids.
+     *
+     * Porosity and degree of saturation is also layer dependent. Thus, fractions are layer
+     * dependent.
+     *
+     * Thermal properties can be considered equal for liquids and gas fractions but not for solids
+     * across the layers.
+     *
+     * NOTE that at the moment there are two layers composed of a single element (plastic lids)
+     * the thermal properties of these layers are calculated in a different way until we think of
+     * a way of homogenize the code.
+     * */
+    const unsigned int layer_number=
+      find_layer(cell_center);
+    const std::string &relationship=std::get<3>(layer_data[layer_number]);
+    PorousMaterial &porous_material=*layer_materials[layer_number];
+    thermal_conductivity=
+      porous_material.thermal_conductivity(relationship);
+    total_volumetric_heat_capacity=
+      porous_material.volumetric_heat_capacity(cell_temperature);
+    ice_saturation=
+      porous_material.degree_of_saturation_ice(cell_temperature);
+
+    if (thermal_conductivity<0. || total_volumetric_heat_capacity<0.)
+      {
+	std::cout << "thermal_conductivity: " << thermal_conductivity << "\t"
+		  << "total_volumetric_heat_capacity: "<< total_volumetric_heat_capacity << "\t"
+		  << "cell temperature: " << cell_temperature << "\t"
+		  << "ice content: " << ice_saturation << "\t"
+		  << std::endl;
+	throw -1;
+      }
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::thermal_energy (const double cell_center,
+					     const double cell_temperature) const
+  {
+    return layer_materials[find_layer(cell_center)]->thermal_energy(cell_temperature);
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::thermal_losses (const double temperature_gradient) const
+  {
+    /*
+     * At the moment is the convective coefficient is read from the input
+     * file, but this function could include the equations used to estimate
+     * this coefficient.
+     * */
+    double convective_coefficient = parameters->heat_loss_factor; // W/m3K
+    return (-1.*convective_coefficient*(temperature_gradient)); //(W/m3)
+  }
+
+  template <int dim>
+  void ColumnPhysics<dim>::read_forcing_series ()
+  {
+    DataTools data_tools;
+    std::vector<std::string> filenames;
+    filenames.push_back(parameters->top_fixed_value_file);
+    std::vector< std::vector<double> > met_data;
+    data_tools.read_data (filenames,
+			  met_data);
+
+    if (log)
+      *log << "\tAvailable surface data lines: " << met_data.size()
+	   << "\n\n";
+
+    /*
+     * Originally the forcing file had dates (dd/mm/yyyy) and met data (air
+     * temperature, solar radiation, wind speed, etc). Now it has the time
+     * and the surface and room temperatures. A single column is one
+     * surface temperature per time step of the parameter file, also used
+     * as the room temperature.
+     */
+    if (met_data.size()!=0 && met_data[0].size()==1)
+      for (unsigned int i=0; i<met_data.size(); i++)
+	{
+	  met_data[i].insert(met_data[i].begin(),i*parameters->time_step);
+	  met_data[i].push_back(met_data[i][1]);
+	}
+    surface_temperature_series.reinit(met_data,0,1);
+    room_temperature_series.reinit   (met_data,0,2);
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::surface_temperature (const double t)
+  {
+    /*
+     * The series are built once, in time linear in the length of the
+     * file, and each lookup is O(1) (see ForcingSeries). The sinusoid is a
+     * function of the time only, so that it is the same for any time step.
+     */
+    if (parameters->top_forcing.compare("file")==0)
+      {
+	if (surface_temperature_series.empty())
+	  read_forcing_series();
+	return surface_temperature_series.value(t);
+      }
+    const double phase=0.;
+    return (parameters->forcing_average+
+	    parameters->forcing_amplitude*
+	    cos((2.*M_PI/parameters->forcing_period)*(t-phase)));
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::room_temperature (const double t)
+  {
+    if (parameters->top_forcing.compare("file")==0)
+      {
+	if (room_temperature_series.empty())
+	  read_forcing_series();
+	return room_temperature_series.value(t);
+      }
+    const double phase=0.;
+    return (parameters->forcing_average+
+	    parameters->forcing_amplitude*
+	    cos((2.*M_PI/parameters->forcing_period)*(t-phase)));
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::mean_surface_temperature ()
+  {
+    if (parameters->top_forcing.compare("file")==0)
+      {
+	if (surface_temperature_series.empty())
+	  read_forcing_series();
+	return surface_temperature_series.mean();
+      }
+    return parameters->forcing_average;
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::mean_room_temperature ()
+  {
+    if (parameters->top_forcing.compare("file")==0)
+      {
+	if (room_temperature_series.empty())
+	  read_forcing_series();
+	return room_temperature_series.mean();
+      }
+    return parameters->forcing_average;
+  }
+
+  template <int dim>
+  void ColumnPhysics<dim>::seek_forcing (const double t)
+  {
+    if (!surface_temperature_series.empty())
+      {
+	surface_temperature_series.seek(t);
+	room_temperature_series.seek(t);
+      }
+  }
+
+  template <int dim>
+  void ColumnPhysics<dim>::read_point_sources ()
+  {
+    point_source_data.resize(parameters->point_source_files.size());
+    for (unsigned int s=0; s<parameters->point_source_files.size(); s++)
+      {
+	DataTools data_tools;
+	std::vector<std::string> filenames;
+	filenames.push_back(parameters->point_source_files[s]);
+	data_tools.read_data (filenames,
+			      point_source_data[s]);
+
+	if (log)
+	  *log << "\n\tPoint source active at: " << parameters->point_source_depths[s]
+	       << "\n\tAvailable point source entries: "
+	       << point_source_data[s].size()
+	       << "\n\n";
+      }
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::point_source_magnitude (const unsigned int source,
+						     const double       t)
+  {
+    if (point_source_data.size()==0)
+      read_point_sources();
+    /*
+     * One line of the point source files per time step of the parameter
+     * file, modulated with a daily sinusoid.
+     */
+    const unsigned int line=
+      static_cast<unsigned int>(t/parameters->time_step+0.5);
+    if (line>=point_source_data[source].size())
+      {
+	std::cout << "Error, point source file " << parameters->point_source_files[source]
+		  << " has " << point_source_data[source].size()
+		  << " lines, line " << line << " needed at time "
+		  << t << " s\n";
+	throw 1;
+      }
+    return -point_source_data[source][line][1]*sin((2.*M_PI/86400)*(t-54000));
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void ColumnPhysics<dim>::cell_terms (const FEValues<dim>       &fe_values,
+				       const double               cell_center,
+				       const std::vector<double> &temperatures,
+				       const double               theta_temperature,
+				       const double               time_step,
+				       const double               old_room_temperature,
+				       const double               new_room_temperature,
+				       const bool                 evaluate_matrices,
+				       std::vector<double>       &thermal_conductivities,
+				       std::vector<double>       &heat_capacities,
+				       FullMatrix<double>        &mass_matrix,
+				       FullMatrix<double>        &laplace_matrix,
+				       Vector<double>            &rhs) const
+  {
+    const double theta=theta_value<scheme>(theta_temperature);
+    const unsigned int dofs_per_cell=fe_values.dofs_per_cell;
+    const unsigned int n_q_points   =fe_values.n_quadrature_points;
+
+    for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+      {
+	const double new_heat_loss=thermal_losses(temperatures[q_point]-new_room_temperature);
+	double old_heat_loss=0.;
+	if (scheme!=backward_euler)
+	  old_heat_loss=thermal_losses(temperatures[q_point]-old_room_temperature);
+
+	if (evaluate_matrices)
+	  {
+	    double ice_saturation=0.;
+	    material_data(cell_center,temperatures[q_point],
+			  thermal_conductivities[q_point],heat_capacities[q_point],
+			  ice_saturation);
+	  }
+
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  {
+	    if (evaluate_matrices)
+	      for (unsigned int j=0; j<dofs_per_cell; ++j)
+		{
+		  mass_matrix(i,j)+=
+		    heat_capacities[q_point]*
+		    fe_values.shape_value(i,q_point) *
+		    fe_values.shape_value(j,q_point) *
+		    fe_values.JxW(q_point);
+		  laplace_matrix(i,j)+=
+		    thermal_conductivities[q_point] *
+		    fe_values.shape_grad(i,q_point) *
+		    fe_values.shape_grad(j,q_point) *
+		    fe_values.JxW(q_point);
+		}
+	    rhs(i)+=
+	      new_heat_loss*theta*time_step*
+	      fe_values.shape_value(i,q_point) *
+	      fe_values.JxW(q_point);
+	    if (scheme!=backward_euler)
+	      rhs(i)+=
+		old_heat_loss*(1.-theta)*time_step*
+		fe_values.shape_value(i,q_point) *
+		fe_values.JxW(q_point);
+	  }
+      }
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void ColumnPhysics<dim>::theta_system (const FullMatrix<double> &mass_matrix,
+					 const FullMatrix<double> &laplace_matrix,
+					 const Vector<double>     &old_temperature_values,
+					 const double              theta_temperature,
+					 const double              time_step,
+					 FullMatrix<double>       &system_matrix,
+					 Vector<double>           &rhs) const
+  {
+    const double theta=theta_value<scheme>(theta_temperature);
+    const unsigned int dofs_per_cell=mass_matrix.m();
+
+    for (unsigned int i=0; i<dofs_per_cell; ++i)
+      for (unsigned int j=0; j<dofs_per_cell; ++j)
+	{
+	  system_matrix(i,j)=
+	    mass_matrix(i,j)+
+	    theta*time_step*laplace_matrix(i,j);
+	  if (scheme!=backward_euler)
+	    rhs(i)+=
+	      (mass_matrix(i,j)-
+	       (1.-theta)*time_step*laplace_matrix(i,j))*
+	      old_temperature_values(j);
+	  else
+	    rhs(i)+=
+	      mass_matrix(i,j)*old_temperature_values(j);
+	}
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme, TopBoundaryCondition top_condition>
+  bool ColumnPhysics<dim>::top_face_terms (const FEFaceValues<dim> &fe_face_values,
+					   const double             theta_temperature,
+					   const double             time_step,
+					   const double             old_surface_temperature,
+					   const double             new_surface_temperature,
+					   FullMatrix<double>      &laplace_matrix,
+					   Vector<double>          &rhs) const
+  {
+    if (top_condition==first_type_top)
+      return false;
+
+    const double theta=theta_value<scheme>(theta_temperature);
+    const unsigned int dofs_per_cell  =fe_face_values.dofs_per_cell;
+    const unsigned int n_face_q_points=fe_face_values.n_quadrature_points;
+
+    double top_outbound_convective_coefficient=0.;
+    double top_inbound_heat_flux_new=0.;
+    double top_inbound_heat_flux_old=0.;
+    if (top_condition==second_type_top)
+      {
+	top_inbound_heat_flux_new=top_fixed_heat_flux;
+	top_inbound_heat_flux_old=top_fixed_heat_flux;
+      }
+    else
+      {
+	top_outbound_convective_coefficient=top_convective_coefficient;
+	top_inbound_heat_flux_new=top_convective_coefficient*new_surface_temperature;
+	top_inbound_heat_flux_old=top_convective_coefficient*old_surface_temperature;
+      }
+    const double inbound_heat_flux=
+      top_inbound_heat_flux_new*theta+
+      (scheme!=backward_euler ? top_inbound_heat_flux_old*(1.-theta) : 0.);
+
+    for (unsigned int q_face_point=0; q_face_point<n_face_q_points; ++q_face_point)
+      for (unsigned int i=0; i<dofs_per_cell; ++i)
+	{
+	  if (top_condition==third_type_top)
+	    for (unsigned int j=0; j<dofs_per_cell; ++j)
+	      laplace_matrix (i,j)+=
+		top_outbound_convective_coefficient *
+		fe_face_values.shape_value (i,q_face_point) *
+		fe_face_values.shape_value (j,q_face_point) *
+		fe_face_values.JxW         (q_face_point);
+	  rhs(i)+=
+	    inbound_heat_flux*time_step*
+	    fe_face_values.shape_value(i,q_face_point) *
+	    fe_face_values.JxW(q_face_point);
+	}
+    return (top_condition==third_type_top);
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void ColumnPhysics<dim>::lateral_face_terms (const FEFaceValues<dim> &fe_face_values,
+					       const double             theta_temperature,
+					       const double             time_step,
+					       const double             old_room_temperature,
+					       const double             new_room_temperature,
+					       FullMatrix<double>      &laplace_matrix,
+					       Vector<double>          &rhs) const
+  {
+    const double theta=theta_value<scheme>(theta_temperature);
+    const unsigned int dofs_per_cell  =fe_face_values.dofs_per_cell;
+    const unsigned int n_face_q_points=fe_face_values.n_quadrature_points;
+
+    const double h=parameters->lateral_heat_transfer_coefficient;
+    const double exterior_temperature=
+      theta*new_room_temperature+(1.-theta)*old_room_temperature;
+    for (unsigned int q_face_point=0; q_face_point<n_face_q_points; ++q_face_point)
+      for (unsigned int i=0; i<dofs_per_cell; ++i)
+	{
+	  for (unsigned int j=0; j<dofs_per_cell; ++j)
+	    laplace_matrix (i,j)+=
+	      h *
+	      fe_face_values.shape_value (i,q_face_point) *
+	      fe_face_values.shape_value (j,q_face_point) *
+	      fe_face_values.JxW         (q_face_point);
+	  rhs(i)+=
+	    h*exterior_temperature*time_step*
+	    fe_face_values.shape_value(i,q_face_point) *
+	    fe_face_values.JxW(q_face_point);
+	}
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::cell_heat_loss_rate (const FEValues<dim>       &fe_values,
+						  const std::vector<double> &old_values,
+						  const std::vector<double> &new_values,
+						  const double               theta,
+						  const double               old_room_temperature,
+						  const double               new_room_temperature) const
+  {
+    double rate=0.;
+    for (unsigned int q_point=0; q_point<fe_values.n_quadrature_points; ++q_point)
+      {
+	const double average_temperature=
+	  theta*new_values[q_point]+(1.-theta)*old_values[q_point];
+	rate+=
+	  (theta*thermal_losses(average_temperature-new_room_temperature)+
+	   (1.-theta)*thermal_losses(average_temperature-old_room_temperature))*
+	  fe_values.JxW(q_point);
+      }
+    return rate;
+  }
+
+  template <int dim>
+  double ColumnPhysics<dim>::boundary_heat_rate (const FEFaceValues<dim>           &fe_face_values,
+						 const types::boundary_id           boundary_id,
+						 const TopBoundaryCondition         top_condition,
+						 const double                       cell_center,
+						 const double                       theta,
+						 const std::vector<double>         &old_face_values,
+						 const std::vector<double>         &new_face_values,
+						 const std::vector<Tensor<1,dim> > &old_face_gradients,
+						 const std::vector<Tensor<1,dim> > &new_face_gradients,
+						 const double                       old_surface_temperature,
+						 const double                       new_surface_temperature,
+						 const double                       old_room_temperature,
+						 const double                       new_room_temperature) const
+  {
+    double thermal_conductivity          = -1.E10;
+    double total_volumetric_heat_capacity= -1.E10;
+    double ice_saturation                = -1.E10;
+    material_data(cell_center,
+		  theta*new_face_values[0]+(1.-theta)*old_face_values[0],
+		  thermal_conductivity,total_volumetric_heat_capacity,
+		  ice_saturation);
+
+    double rate=0.;
+    for (unsigned int q_face_point=0; q_face_point<fe_face_values.n_quadrature_points; ++q_face_point)
+      {
+	const double average_temperature=
+	  theta*new_face_values[q_face_point]+
+	  (1.-theta)*old_face_values[q_face_point];
+	/*
+	 * Conductive heat flow into the domain, k grad(T).n with the
+	 * outward normal n.
+	 */
+	const double conductive_flux=
+	  thermal_conductivity*
+	  (theta*new_face_gradients[q_face_point]+
+	   (1.-theta)*old_face_gradients[q_face_point])*
+	  fe_face_values.normal_vector(q_face_point);
+	const double JxW=fe_face_values.JxW(q_face_point);
+
+	if (boundary_id==top_boundary_id)
+	  {
+	    if (top_condition==first_type_top)
+	      rate+=conductive_flux*JxW;
+	    else if (top_condition==second_type_top)
+	      rate+=top_fixed_heat_flux*JxW;
+	    else
+	      rate+=
+		top_convective_coefficient*
+		(theta*new_surface_temperature+
+		 (1.-theta)*old_surface_temperature-
+		 average_temperature)*JxW;
+	  }
+	else if (boundary_id==bottom_boundary_id)
+	  rate+=conductive_flux*JxW;
+	else if (boundary_id==lateral_boundary_id)
+	  rate+=
+	    parameters->lateral_heat_transfer_coefficient*
+	    (theta*new_room_temperature+
+	     (1.-theta)*old_room_temperature-
+	     average_temperature)*JxW;
+      }
+    return rate;
+  }
+
+  template <int dim>
+  void ColumnPhysics<dim>::write_output_line (std::ostream              &out,
+					      const unsigned int         precision,
+					      const unsigned int         timestep_number,
+					      const double               time,
+					      const std::vector<double> &probe_values,
+					      const double               column_thermal_energy,
+					      const double               heat_flux_top,
+					      const double               heat_flux_bottom,
+					      const double               heat_flux_lateral,
+					      const double               point_source_rate,
+					      const double               heat_loss_rate,
+					      const double               energy_balance_error)
+  {
+    out << timestep_number << "\t" << std::setprecision(10) << time;
+    out << std::setprecision(precision);
+    for (unsigned int i=0; i<probe_values.size(); i++)
+      out << "\t" << probe_values[i];
+
+    out << "\t" << column_thermal_energy
+	<< "\t" << heat_flux_top
+	<< "\t" << heat_flux_bottom
+	<< "\t" << heat_flux_lateral
+	<< "\t" << point_source_rate
+	<< "\t" << heat_loss_rate
+	<< "\t" << energy_balance_error
+	<< "\n";
+  }
@@ -0,0 +1,151 @@
+  /*
+   * Time series of a forcing value (e.g. the surface temperature) read
+   * from a data file, linearly interpolated in time. The series keeps a
+   * cursor to the interval of the last lookup. The simulation time only
+   * moves forward during a run, so the cursor is usually moved by one
+   * interval at most and a lookup costs O(1) independently of the length
+   * of the record. Going back in time (a restart from a stored state) or
+   * skipping several lines moves the cursor with a binary search.
+   *
+   * Before the first and after the last time of the record the first and
+   * last values are used.
+   * */
+  class ForcingSeries
+  {
+  public:
+    ForcingSeries ();
+
+    /*
+     * Takes the time and the value columns of 'table' (one row per line
+     * of the data file). Times must be increasing. The work is linear in
+     * the number of rows.
+     */
+    void reinit (const std::vector< std::vector<double> > &table,
+		 const unsigned int                        time_column,
+		 const unsigned int                        value_column);
+    bool empty () const;
+    unsigned int size () const;
+
+    double value (const double t);
+    void seek (const double t);
+    /*
+     * Time average of the interpolated series over the whole record (the
+     * value itself for a single line).
+     */
+    double mean () const;
+
+  private:
+    std::vector<double> times;
+    std::vector<double> values;
+    /*
+     * times[cursor]<=t<times[cursor+1] for the last lookup, or cursor=0
+     * before the first time.
+     */
+    unsigned int        cursor;
+  };
+
+  inline
+  ForcingSeries::ForcingSeries ()
+    :
+    cursor(0)
+  {}
+
+  inline
+  void ForcingSeries::reinit (const std::vector< std::vector<double> > &table,
+			      const unsigned int                        time_column,
+			      const unsigned int                        value_column)
+  {
+    times.resize(table.size());
+    values.resize(table.size());
+    for (unsigned int i=0; i<table.size(); i++)
+      {
+	if (table[i].size()<=std::max(time_column,value_column))
+	  {
+	    std::cout << "Error, line " << i << " of the forcing data has "
+		      << table[i].size() << " columns\n";
+	    throw 1;
+	  }
+	times[i] =table[i][time_column];
+	values[i]=table[i][value_column];
+	if (i>0 && times[i]<=times[i-1])
+	  {
+	    std::cout << "Error, the times of the forcing data are not "
+		      << "increasing at line " << i << "\n";
+	    throw 1;
+	  }
+      }
+    cursor=0;
+  }
+
+  inline
+  bool ForcingSeries::empty () const
+  {
+    return times.size()==0;
+  }
+
+  inline
+  unsigned int ForcingSeries::size () const
+  {
+    return times.size();
+  }
+
+  inline
+  void ForcingSeries::seek (const double t)
+  {
+    /*
+     * Last interval whose start is not after t.
+     */
+    const std::vector<double>::const_iterator upper=
+      std::upper_bound(times.begin(),times.end(),t);
+    cursor=(upper==times.begin() ? 0 : (upper-times.begin())-1);
+  }
+
+  inline
+  double ForcingSeries::value (const double t)
+  {
+    if (times.size()==0)
+      {
+	std::cout << "Error, forcing series without data\n";
+	throw 1;
+      }
+    if (t<=times[0])
+      {
+	cursor=0;
+	return values[0];
+      }
+    if (t>=times.back())
+      {
+	cursor=times.size()-1;
+	return values.back();
+      }
+
+    /*
+     * Usually t is in the same interval as the last lookup or in the
+     * next one. Otherwise (going back, or skipping several lines of the
+     * record) the interval is searched for.
+     */
+    if (cursor+1<times.size() && times[cursor+1]<=t)
+      cursor++;
+    if (cursor+1>=times.size() || t<times[cursor] || times[cursor+1]<=t)
+      seek(t);
+
+    const double weight=(t-times[cursor])/(times[cursor+1]-times[cursor]);
+    return (1.-weight)*values[cursor]+weight*values[cursor+1];
+  }
+
+  inline
+  double ForcingSeries::mean () const
+  {
+    if (times.size()==0)
+      {
+	std::cout << "Error, forcing series without data\n";
+	throw 1;
+      }
+    if (times.size()==1)
+      return values[0];
+
+    double integral=0.;
+    for (unsigned int i=0; i+1<times.size(); i++)
+      integral+=0.5*(values[i]+values[i+1])*(times[i+1]-times[i]);
+    return integral/(times.back()-times[0]);
+  }
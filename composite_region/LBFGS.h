@@ -0,0 +1,278 @@
+  /*
+   * Limited memory BFGS minimiser with simple bounds (projected L-BFGS),
+   * used by the parameter calibration of Heat_Pipe. The search direction
+   * is the usual two loop recursion with the last history_size pairs of
+   * steps and gradient changes. Variables that sit on a bound with the
+   * gradient pointing outwards are kept fixed, and the step is projected
+   * back into the bounds during the backtracking (Armijo) line search.
+   *
+   * The variables should be scaled so that a unit change is meaningful
+   * in all of them: the first step changes them by at most initial_step.
+   * */
+  class LBFGS
+  {
+  public:
+    LBFGS (const unsigned int history_size,
+	   const unsigned int max_iterations,
+	   const double       gradient_tolerance,
+	   const double       initial_step=0.1);
+
+    /*
+     * Minimises f(x) for lower<=x<=upper starting from x, and returns the
+     * number of iterations. 'function' is called as f=function(x,gradient)
+     * and fills the gradient. Iterations stop when the largest component
+     * of the projected gradient is smaller than gradient_tolerance times
+     * its initial value, or when the line search makes no progress. On
+     * return x is the best point found and 'value' f there. If 'log' is
+     * given, one line per iteration is written to it.
+     */
+    template <class Function>
+    unsigned int minimize (std::vector<double>       &x,
+			   const std::vector<double> &lower,
+			   const std::vector<double> &upper,
+			   Function                   function,
+			   double                    &value,
+			   std::ostream              *log=0);
+
+  private:
+    void direction (const std::vector<double> &gradient,
+		    const std::vector<bool>   &fixed,
+		    std::vector<double>       &d) const;
+    static double projected_gradient_norm (const std::vector<double> &x,
+					   const std::vector<double> &gradient,
+					   const std::vector<double> &lower,
+					   const std::vector<double> &upper);
+    static bool is_fixed (const double x,
+			  const double gradient,
+			  const double lower,
+			  const double upper);
+
+    unsigned int history_size;
+    unsigned int max_iterations;
+    double       gradient_tolerance;
+    double       initial_step;
+
+    std::vector< std::vector<double> > steps;
+    std::vector< std::vector<double> > gradient_changes;
+  };
+
+  inline
+  LBFGS::LBFGS (const unsigned int history_size_,
+		const unsigned int max_iterations_,
+		const double       gradient_tolerance_,
+		const double       initial_step_)
+    :
+    history_size(history_size_),
+    max_iterations(max_iterations_),
+    gradient_tolerance(gradient_tolerance_),
+    initial_step(initial_step_)
+  {}
+
+  inline
+  bool LBFGS::is_fixed (const double x,
+			const double gradient,
+			const double lower,
+			const double upper)
+  {
+    return ((x<=lower && gradient>0.) ||
+	    (x>=upper && gradient<0.));
+  }
+
+  inline
+  double LBFGS::projected_gradient_norm (const std::vector<double> &x,
+					 const std::vector<double> &gradient,
+					 const std::vector<double> &lower,
+					 const std::vector<double> &upper)
+  {
+    double norm=0.;
+    for (unsigned int i=0; i<x.size(); i++)
+      if (!is_fixed(x[i],gradient[i],lower[i],upper[i]))
+	norm=std::max(norm,std::fabs(gradient[i]));
+    return norm;
+  }
+
+  inline
+  void LBFGS::direction (const std::vector<double> &gradient,
+			 const std::vector<bool>   &fixed,
+			 std::vector<double>       &d) const
+  {
+    /*
+     * d=-H g with the two loop recursion, restricted to the free
+     * variables. The initial inverse Hessian is gamma I with
+     * gamma=s^T y/y^T y of the last pair.
+     */
+    const unsigned int n=gradient.size();
+    const unsigned int m=steps.size();
+    d.assign(n,0.);
+    for (unsigned int i=0; i<n; i++)
+      if (!fixed[i])
+	d[i]=-gradient[i];
+
+    std::vector<double> alpha(m,0.);
+    std::vector<double> rho(m,0.);
+    for (int k=m-1; k>=0; k--)
+      {
+	double sy=0.;
+	double sd=0.;
+	for (unsigned int i=0; i<n; i++)
+	  if (!fixed[i])
+	    {
+	      sy+=steps[k][i]*gradient_changes[k][i];
+	      sd+=steps[k][i]*d[i];
+	    }
+	rho[k]  =(sy>0. ? 1./sy : 0.);
+	alpha[k]=rho[k]*sd;
+	for (unsigned int i=0; i<n; i++)
+	  if (!fixed[i])
+	    d[i]-=alpha[k]*gradient_changes[k][i];
+      }
+    if (m>0)
+      {
+	double sy=0.;
+	double yy=0.;
+	for (unsigned int i=0; i<n; i++)
+	  if (!fixed[i])
+	    {
+	      sy+=steps[m-1][i]*gradient_changes[m-1][i];
+	      yy+=gradient_changes[m-1][i]*gradient_changes[m-1][i];
+	    }
+	if (sy>0. && yy>0.)
+	  for (unsigned int i=0; i<n; i++)
+	    d[i]*=sy/yy;
+      }
+    for (unsigned int k=0; k<m; k++)
+      {
+	double yd=0.;
+	for (unsigned int i=0; i<n; i++)
+	  if (!fixed[i])
+	    yd+=gradient_changes[k][i]*d[i];
+	const double beta=rho[k]*yd;
+	for (unsigned int i=0; i<n; i++)
+	  if (!fixed[i])
+	    d[i]+=(alpha[k]-beta)*steps[k][i];
+      }
+  }
+
+  template <class Function>
+  unsigned int LBFGS::minimize (std::vector<double>       &x,
+				const std::vector<double> &lower,
+				const std::vector<double> &upper,
+				Function                   function,
+				double                    &value,
+				std::ostream              *log)
+  {
+    const unsigned int n=x.size();
+    steps.clear();
+    gradient_changes.clear();
+
+    for (unsigned int i=0; i<n; i++)
+      x[i]=std::min(upper[i],std::max(lower[i],x[i]));
+
+    std::vector<double> gradient(n,0.);
+    value=function(x,gradient);
+    const double initial_gradient_norm=
+      projected_gradient_norm(x,gradient,lower,upper);
+    if (log)
+      *log << "\tL-BFGS iteration 0\tf: " << value
+	   << "\t|g|: " << initial_gradient_norm << "\n";
+
+    std::vector<double> d;
+    std::vector<double> trial_x(n,0.);
+    std::vector<double> trial_gradient(n,0.);
+    std::vector<bool>   fixed(n,false);
+    unsigned int iteration=0;
+    while (iteration<max_iterations)
+      {
+	const double gradient_norm=projected_gradient_norm(x,gradient,lower,upper);
+	if (gradient_norm<=gradient_tolerance*initial_gradient_norm ||
+	    gradient_norm==0.)
+	  break;
+
+	for (unsigned int i=0; i<n; i++)
+	  fixed[i]=is_fixed(x[i],gradient[i],lower[i],upper[i]);
+	direction(gradient,fixed,d);
+
+	double slope=0.;
+	double max_d=0.;
+	for (unsigned int i=0; i<n; i++)
+	  {
+	    slope+=gradient[i]*d[i];
+	    max_d=std::max(max_d,std::fabs(d[i]));
+	  }
+	if (slope>=0.)
+	  {
+	    /*
+	     * Not a descent direction: drop the history and use steepest
+	     * descent.
+	     */
+	    steps.clear();
+	    gradient_changes.clear();
+	    direction(gradient,fixed,d);
+	    max_d=0.;
+	    for (unsigned int i=0; i<n; i++)
+	      max_d=std::max(max_d,std::fabs(d[i]));
+	  }
+
+	double step_length=1.;
+	if (steps.size()==0 && max_d>0.)
+	  step_length=initial_step/max_d;
+
+	/*
+	 * Backtracking along the projected path x(a)=P(x+a d) until
+	 * f(x(a)) <= f(x) + 1e-4 g^T (x(a)-x).
+	 */
+	bool accepted=false;
+	double trial_value=value;
+	for (unsigned int backtrack=0; backtrack<20; backtrack++)
+	  {
+	    double decrease=0.;
+	    for (unsigned int i=0; i<n; i++)
+	      {
+		trial_x[i]=std::min(upper[i],std::max(lower[i],x[i]+step_length*d[i]));
+		decrease+=gradient[i]*(trial_x[i]-x[i]);
+	      }
+	    if (decrease>=0.)
+	      break;
+	    trial_value=function(trial_x,trial_gradient);
+	    if (trial_value<=value+1.E-4*decrease)
+	      {
+		accepted=true;
+		break;
+	      }
+	    step_length*=0.5;
+	  }
+	if (!accepted)
+	  break;
+
+	std::vector<double> s(n,0.);
+	std::vector<double> y(n,0.);
+	double sy=0.;
+	for (unsigned int i=0; i<n; i++)
+	  {
+	    s[i]=trial_x[i]-x[i];
+	    y[i]=trial_gradient[i]-gradient[i];
+	    sy+=s[i]*y[i];
+	  }
+	if (sy>1.E-12)
+	  {
+	    if (steps.size()==history_size)
+	      {
+		steps.erase(steps.begin());
+		gradient_changes.erase(gradient_changes.begin());
+	      }
+	    steps.push_back(s);
+	    gradient_changes.push_back(y);
+	  }
+
+	x=trial_x;
+	gradient=trial_gradient;
+	value=trial_value;
+	iteration++;
+
+	if (log)
+	  *log << "\tL-BFGS iteration " << iteration << "\tf: " << value
+	       << "\t|g|: " << projected_gradient_norm(x,gradient,lower,upper)
+	       << "\tstep: " << step_length << "\n";
+      }
+    return iteration;
+  }
@@ -0,0 +1,190 @@
+namespace Logging
+{
+  /*
+   * Console/file output with verbosity levels. Messages are written to an
+   * internal buffer and passed to the sink (std::cout or a file) only when
+   * the buffer is full, when flush() is called or when the logger is
+   * destroyed, so that long runs do not pay for a synchronous write per
+   * line.
+   *
+   * Guard every message with is_enabled() (or step_due() for per time step
+   * messages) so that nothing is formatted for disabled levels:
+   *
+   *   if (logger.step_due(timestep_number))
+   *     logger.stream() << "Time step " << timestep_number << "\n";
+   *
+   * Errors are not routed through the logger, they are printed to std::cout
+   * right before throwing, as everywhere else in the code.
+   * */
+  class Logger
+  {
+  public:
+    enum Level
+    {
+      quiet  = 0,
+      normal = 1, // setup information and summaries
+      steps  = 2, // one line per (rate limited) time step
+      debug  = 3  // extra checks and per iteration data
+    };
+
+    Logger ();
+    ~Logger ();
+
+    void set_verbosity (const Level level);
+    void set_rate_limit (const unsigned int every_n_steps,
+			 const double       every_seconds);
+    void set_file (const std::string &filename);
+    void set_buffer_size (const std::size_t buffer_size);
+
+    static Level level_from_string (const std::string &name);
+
+    bool is_enabled (const Level level) const;
+    bool step_due (const unsigned int step);
+
+    std::ostream &stream ();
+    void flush ();
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    Level              verbosity;
+    unsigned int       every_n_steps;
+    double             every_seconds;
+    unsigned int       last_logged_step;
+    bool               logged_any_step;
+    clock::time_point  last_logged_time;
+
+    std::size_t        buffer_size;
+    std::ostringstream buffer;
+    std::ofstream      file;
+  };
+
+  inline
+  Logger::Logger ()
+    :
+    verbosity(steps),
+    every_n_steps(1),
+    every_seconds(0.),
+    last_logged_step(0),
+    logged_any_step(false),
+    last_logged_time(clock::now()),
+    buffer_size(1<<16)
+  {}
+
+  inline
+  Logger::~Logger ()
+  {
+    flush();
+  }
+
+  inline
+  void Logger::set_verbosity (const Level level)
+  {
+    verbosity=level;
+  }
+
+  inline
+  void Logger::set_rate_limit (const unsigned int every_n_steps_,
+			       const double       every_seconds_)
+  {
+    every_n_steps=every_n_steps_;
+    every_seconds=every_seconds_;
+  }
+
+  inline
+  void Logger::set_file (const std::string &filename)
+  {
+    flush();
+    if (file.is_open())
+      file.close();
+    if (filename.size()==0)
+      return;
+
+    file.open(filename.c_str());
+    if (!file.is_open())
+      {
+	std::cout << "Error opening log file " << filename << "\n";
+	throw 1;
+      }
+  }
+
+  inline
+  void Logger::set_buffer_size (const std::size_t buffer_size_)
+  {
+    buffer_size=buffer_size_;
+  }
+
+  inline
+  Logger::Level Logger::level_from_string (const std::string &name)
+  {
+    if (name.compare("quiet")==0)
+      return quiet;
+    else if (name.compare("normal")==0)
+      return normal;
+    else if (name.compare("steps")==0)
+      return steps;
+    else if (name.compare("debug")==0)
+      return debug;
+
+    std::cout << "Error, unknown verbosity level " << name << "\n";
+    throw 1;
+  }
+
+  inline
+  bool Logger::is_enabled (const Level level) const
+  {
+    return level<=verbosity;
+  }
+
+  inline
+  bool Logger::step_due (const unsigned int step)
+  {
+    /*
+     * A step is logged if at least every_n_steps steps (if not zero) or
+     * every_seconds seconds (if not zero) have passed since the last
+     * logged step. With both set to zero every step is logged. The clock
+     * is only read when a time limit is set.
+     */
+    if (!is_enabled(steps))
+      return false;
+
+    bool due=!logged_any_step ||
+      (every_n_steps==0 && every_seconds<=0.);
+    if (!due && every_n_steps>0)
+      due=(step>=last_logged_step+every_n_steps);
+    if (!due && every_seconds>0.)
+      due=(std::chrono::duration<double>(clock::now()-last_logged_time).count()
+	   >=every_seconds);
+    if (!due)
+      return false;
+
+    logged_any_step =true;
+    last_logged_step=step;
+    if (every_seconds>0.)
+      last_logged_time=clock::now();
+    return true;
+  }
+
+  inline
+  std::ostream &Logger::stream ()
+  {
+    if (static_cast<std::size_t>(buffer.tellp())>=buffer_size)
+      flush();
+    return buffer;
+  }
+
+  inline
+  void Logger::flush ()
+  {
+    const std::string text=buffer.str();
+    if (text.size()==0)
+      return;
+
+    if (file.is_open())
+      file << text << std::flush;
+    else
+      std::cout << text << std::flush;
+    buffer.str("");
+    buffer.clear();
+  }
+}
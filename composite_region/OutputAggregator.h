@@ -0,0 +1,181 @@
+  /*
+   * Streaming aggregation of the probe temperatures over fixed time
+   * windows (e.g. hourly or daily). Each time step adds its values,
+   * weighted with the time step, to running sums and extremes; when a
+   * step ends in a new window the previous one is written as one line:
+   *
+   *   window  end_time  mean_0 min_0 max_0  mean_1 min_1 max_1 ...
+   *
+   * Memory does not grow with the length of the run. A window where a
+   * probe goes through the freezing point (min<freezing point<max) is
+   * counted as a freeze-thaw window for that probe, and one where its
+   * maximum is at or below the freezing point as a frozen one. The totals
+   * are written at the end of the file as comment lines by finish().
+   *
+   * Windows are aligned with time zero: window w holds the steps that
+   * end in (w*period,(w+1)*period].
+   * */
+  class OutputAggregator
+  {
+  public:
+    OutputAggregator (const std::string  &name,
+		      const double        period,
+		      const unsigned int  n_values,
+		      const double        freezing_point,
+		      const std::string  &filename);
+
+    void add (const double               time,
+	      const double               time_step,
+	      const std::vector<double> &values);
+    /*
+     * Writes the last (possibly incomplete) window and the freeze-thaw
+     * totals.
+     */
+    void finish ();
+
+    const std::string &get_name () const;
+    unsigned int n_windows () const;
+    const std::vector<unsigned int> &freeze_thaw_windows () const;
+    const std::vector<unsigned int> &frozen_windows () const;
+
+  private:
+    void write_window ();
+
+    std::string  name;
+    double       period;
+    double       freezing_point;
+    std::ofstream file;
+
+    unsigned int window;
+    double       window_end_time;
+    double       window_duration;
+    unsigned int windows_written;
+    std::vector<double> sums;
+    std::vector<double> minima;
+    std::vector<double> maxima;
+    std::vector<unsigned int> freeze_thaw_counts;
+    std::vector<unsigned int> frozen_counts;
+  };
+
+  inline
+  OutputAggregator::OutputAggregator (const std::string  &name_,
+				      const double        period_,
+				      const unsigned int  n_values,
+				      const double        freezing_point_,
+				      const std::string  &filename)
+    :
+    name(name_),
+    period(period_),
+    freezing_point(freezing_point_),
+    window(0),
+    window_end_time(0.),
+    window_duration(0.),
+    windows_written(0),
+    sums(n_values,0.),
+    minima(n_values,std::numeric_limits<double>::max()),
+    maxima(n_values,-std::numeric_limits<double>::max()),
+    freeze_thaw_counts(n_values,0),
+    frozen_counts(n_values,0)
+  {
+    if (period<=0.)
+      {
+	std::cout << "Error, aggregation period of '" << name << "' must be positive\n";
+	throw 1;
+      }
+    file.open(filename.c_str());
+    if (!file.is_open())
+      {
+	std::cout << "Error opening aggregated output file " << filename << "\n";
+	throw 1;
+      }
+  }
+
+  inline
+  void OutputAggregator::add (const double               time,
+			      const double               time_step,
+			      const std::vector<double> &values)
+  {
+    /*
+     * Index of the window the step ending at 'time' belongs to. The small
+     * shift keeps a step that ends exactly on a window boundary in the
+     * window it closes.
+     */
+    const double position=time/period-1.E-9;
+    const unsigned int step_window=
+      (position>0. ? static_cast<unsigned int>(std::floor(position)) : 0);
+    if (window_duration>0. && step_window!=window)
+      write_window();
+    window=step_window;
+    window_end_time=time;
+
+    for (unsigned int i=0; i<sums.size(); i++)
+      {
+	sums[i]+=time_step*values[i];
+	minima[i]=std::min(minima[i],values[i]);
+	maxima[i]=std::max(maxima[i],values[i]);
+      }
+    window_duration+=time_step;
+  }
+
+  inline
+  void OutputAggregator::write_window ()
+  {
+    file << window << "\t" << std::setprecision(10) << window_end_time;
+    for (unsigned int i=0; i<sums.size(); i++)
+      {
+	file << "\t" << std::setprecision(5) << sums[i]/window_duration
+	     << "\t" << std::setprecision(5) << minima[i]
+	     << "\t" << std::setprecision(5) << maxima[i];
+	if (minima[i]<freezing_point && maxima[i]>freezing_point)
+	  freeze_thaw_counts[i]++;
+	else if (maxima[i]<=freezing_point)
+	  frozen_counts[i]++;
+
+	sums[i]  =0.;
+	minima[i]=std::numeric_limits<double>::max();
+	maxima[i]=-std::numeric_limits<double>::max();
+      }
+    file << "\n";
+    window_duration=0.;
+    windows_written++;
+  }
+
+  inline
+  void OutputAggregator::finish ()
+  {
+    if (window_duration>0.)
+      write_window();
+
+    file << "# freeze-thaw windows:";
+    for (unsigned int i=0; i<freeze_thaw_counts.size(); i++)
+      file << "\t" << freeze_thaw_counts[i];
+    file << "\n# frozen windows:";
+    for (unsigned int i=0; i<frozen_counts.size(); i++)
+      file << "\t" << frozen_counts[i];
+    file << "\n";
+    file.close();
+  }
+
+  inline
+  const std::string &OutputAggregator::get_name () const
+  {
+    return name;
+  }
+
+  inline
+  unsigned int OutputAggregator::n_windows () const
+  {
+    return windows_written;
+  }
+
+  inline
+  const std::vector<unsigned int> &OutputAggregator::freeze_thaw_windows () const
+  {
+    return freeze_thaw_counts;
+  }
+
+  inline
+  const std::vector<unsigned int> &OutputAggregator::frozen_windows () const
+  {
+    return frozen_counts;
+  }
@@ -0,0 +1,219 @@
+  /*
+   * Cholesky factorization of a sparse symmetric positive definite matrix
+   * in profile (envelope) storage, for the linear regime of Heat_Pipe
+   * where the same system is solved every time step. Row i of the factor
+   * holds the columns from the first nonzero of row i of the matrix to the
+   * diagonal; the factorization does not fill in outside of this envelope.
+   * The unknowns are reordered with reverse Cuthill-McKee to keep the
+   * envelope small, without touching the dof numbering of the caller.
+   *
+   * Entries with value zero (e.g. rows and columns of Dirichlet dofs after
+   * elimination) are left out of the envelope. solve() does not allocate
+   * memory.
+   * */
+  class ProfileCholesky
+  {
+  public:
+    ProfileCholesky ();
+
+    void factorize (const SparseMatrix<double> &matrix);
+    /*
+     * Overwrites the right hand side with the solution.
+     */
+    void solve (Vector<double> &rhs_and_solution);
+    /*
+     * Number of stored entries of the factor, 0 before factorize().
+     */
+    std::size_t n_entries () const;
+    /*
+     * Number of stored entries if 'matrix' was factorized, without doing
+     * it, to decide whether a factorization is worth its memory.
+     */
+    std::size_t envelope_size (const SparseMatrix<double> &matrix);
+
+  private:
+    void reorder (const SparseMatrix<double> &matrix);
+    std::size_t row (const unsigned int p) const;
+
+    std::vector<unsigned int> permutation;
+    std::vector<unsigned int> inverse_permutation;
+    std::vector<unsigned int> first_column;
+    std::vector<std::size_t>  row_start;
+    std::vector<double>       values;
+    std::vector<double>       work;
+  };
+
+  inline
+  ProfileCholesky::ProfileCholesky ()
+  {}
+
+  inline
+  void ProfileCholesky::reorder (const SparseMatrix<double> &matrix)
+  {
+    /*
+     * Reverse Cuthill-McKee: breadth first search from a node of minimum
+     * degree of each connected component, visiting neighbours by
+     * increasing degree, and the resulting order reversed.
+     */
+    const unsigned int n=matrix.m();
+    std::vector< std::vector<unsigned int> > neighbours (n);
+    for (unsigned int i=0; i<n; i++)
+      for (SparseMatrix<double>::const_iterator entry=matrix.begin(i);
+	   entry!=matrix.end(i); ++entry)
+	if (entry->column()!=i && entry->value()!=0.)
+	  neighbours[i].push_back(entry->column());
+
+    std::vector<unsigned int> order;
+    order.reserve(n);
+    std::vector<bool> visited (n,false);
+    std::vector<unsigned int> by_degree (n);
+    for (unsigned int i=0; i<n; i++)
+      by_degree[i]=i;
+    std::stable_sort(by_degree.begin(),by_degree.end(),
+		     [&neighbours](const unsigned int a, const unsigned int b)
+		     {
+		       return neighbours[a].size()<neighbours[b].size();
+		     });
+    for (unsigned int s=0; s<n; s++)
+      {
+	if (visited[by_degree[s]])
+	  continue;
+	std::size_t head=order.size();
+	order.push_back(by_degree[s]);
+	visited[by_degree[s]]=true;
+	while (head<order.size())
+	  {
+	    const unsigned int node=order[head++];
+	    const std::size_t first_new=order.size();
+	    for (unsigned int k=0; k<neighbours[node].size(); k++)
+	      if (!visited[neighbours[node][k]])
+		{
+		  visited[neighbours[node][k]]=true;
+		  order.push_back(neighbours[node][k]);
+		}
+	    std::stable_sort(order.begin()+first_new,order.end(),
+			     [&neighbours](const unsigned int a, const unsigned int b)
+			     {
+			       return neighbours[a].size()<neighbours[b].size();
+			     });
+	  }
+      }
+
+    permutation.assign(order.rbegin(),order.rend());
+    inverse_permutation.resize(n);
+    for (unsigned int p=0; p<n; p++)
+      inverse_permutation[permutation[p]]=p;
+
+    first_column.resize(n);
+    for (unsigned int p=0; p<n; p++)
+      {
+	const unsigned int i=permutation[p];
+	first_column[p]=p;
+	for (unsigned int k=0; k<neighbours[i].size(); k++)
+	  first_column[p]=std::min(first_column[p],inverse_permutation[neighbours[i][k]]);
+      }
+    row_start.resize(n+1);
+    row_start[0]=0;
+    for (unsigned int p=0; p<n; p++)
+      row_start[p+1]=row_start[p]+(p-first_column[p]+1);
+  }
+
+  inline
+  std::size_t ProfileCholesky::row (const unsigned int p) const
+  {
+    return row_start[p]-first_column[p];
+  }
+
+  inline
+  std::size_t ProfileCholesky::envelope_size (const SparseMatrix<double> &matrix)
+  {
+    reorder(matrix);
+    values.clear();
+    return row_start.back();
+  }
+
+  inline
+  void ProfileCholesky::factorize (const SparseMatrix<double> &matrix)
+  {
+    reorder(matrix);
+    const unsigned int n=matrix.m();
+    values.assign(row_start.back(),0.);
+    work.resize(n);
+
+    for (unsigned int i=0; i<n; i++)
+      {
+	const unsigned int p=inverse_permutation[i];
+	for (SparseMatrix<double>::const_iterator entry=matrix.begin(i);
+	     entry!=matrix.end(i); ++entry)
+	  {
+	    const unsigned int q=inverse_permutation[entry->column()];
+	    if (q<=p && entry->value()!=0.)
+	      values[row_start[p]+q-first_column[p]]=entry->value();
+	  }
+      }
+
+    /*
+     * Row by row: L(p,q) = (A(p,q) - sum_k L(p,k) L(q,k)) / L(q,q) for the
+     * columns q of the envelope of row p, then the diagonal. L(p,k) is
+     * values[row(p)+k], with the row offsets computed modulo 2^N.
+     */
+    for (unsigned int p=0; p<n; p++)
+      {
+	const std::size_t row_p=row(p);
+	for (unsigned int q=first_column[p]; q<p; q++)
+	  {
+	    const std::size_t row_q=row(q);
+	    double sum=values[row_p+q];
+	    for (unsigned int k=std::max(first_column[p],first_column[q]); k<q; k++)
+	      sum-=values[row_p+k]*values[row_q+k];
+	    values[row_p+q]=sum/values[row_q+q];
+	  }
+	double diagonal=values[row_p+p];
+	for (unsigned int k=first_column[p]; k<p; k++)
+	  diagonal-=values[row_p+k]*values[row_p+k];
+	if (!(diagonal>0.))
+	  {
+	    std::cout << "Error, matrix is not positive definite in the profile "
+		      << "Cholesky factorization (row " << permutation[p] << ")\n";
+	    throw 1;
+	  }
+	values[row_p+p]=std::sqrt(diagonal);
+      }
+  }
+
+  inline
+  void ProfileCholesky::solve (Vector<double> &rhs_and_solution)
+  {
+    const unsigned int n=work.size();
+    for (unsigned int p=0; p<n; p++)
+      work[p]=rhs_and_solution(permutation[p]);
+
+    /*
+     * L y = b, then L^T x = y (column oriented, the rows of L are the
+     * columns of L^T).
+     */
+    for (unsigned int p=0; p<n; p++)
+      {
+	const std::size_t row_p=row(p);
+	double sum=work[p];
+	for (unsigned int k=first_column[p]; k<p; k++)
+	  sum-=values[row_p+k]*work[k];
+	work[p]=sum/values[row_p+p];
+      }
+    for (unsigned int p=n; p-->0; )
+      {
+	const std::size_t row_p=row(p);
+	work[p]/=values[row_p+p];
+	for (unsigned int k=first_column[p]; k<p; k++)
+	  work[k]-=values[row_p+k]*work[p];
+      }
+
+    for (unsigned int p=0; p<n; p++)
+      rhs_and_solution(permutation[p])=work[p];
+  }
+
+  inline
+  std::size_t ProfileCholesky::n_entries () const
+  {
+    return values.size();
+  }
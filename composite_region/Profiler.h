@@ -0,0 +1,256 @@
+namespace Profiling
+{
+  /*
+   * Low overhead wall clock profiler. Sections are registered once and
+   * afterwards referred to by the integer returned by add_section(), so that
+   * starting and stopping a section only costs a clock read and an addition.
+   * Callers that keep the identifiers in an enum pass the expected value to
+   * add_section(), which then fails if the registration order differs.
+   * Sections are meant for phases of a time step, not for the work on a
+   * single cell. Sections may be nested; the percentages in the summary are
+   * always relative to the total run time.
+   * Counters are used for iteration counts and similar quantities.
+   *
+   * When the profiler is disabled Scope objects do nothing.
+   * */
+  class Profiler
+  {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    Profiler ();
+
+    void set_enabled (const bool enabled);
+    bool is_enabled () const;
+
+    unsigned int add_section (const std::string &name);
+    unsigned int add_counter (const std::string &name);
+    void add_section (const unsigned int section, const std::string &name);
+    void add_counter (const unsigned int counter, const std::string &name);
+    void set_info (const std::string &name, const double value);
+
+    void start (const unsigned int section);
+    void stop  (const unsigned int section);
+    void count (const unsigned int counter, const unsigned long n=1);
+
+    double wall_time (const unsigned int section) const;
+    unsigned long counter_value (const unsigned int counter) const;
+    double total_wall_time () const;
+
+    void print_summary (std::ostream &out) const;
+    void write_json (const std::string &filename) const;
+
+    class Scope
+    {
+    public:
+      Scope (Profiler &profiler, const unsigned int section)
+	:
+	profiler(profiler),
+	section(section)
+      {
+	profiler.start(section);
+      }
+      ~Scope ()
+      {
+	profiler.stop(section);
+      }
+    private:
+      Profiler          &profiler;
+      const unsigned int section;
+    };
+
+  private:
+    struct Section
+    {
+      std::string       name;
+      double            wall_time;
+      unsigned long     n_calls;
+      clock::time_point started;
+    };
+
+    bool enabled;
+    clock::time_point created;
+    std::vector<Section> sections;
+    std::vector<std::pair<std::string,unsigned long> > counters;
+    std::vector<std::pair<std::string,double> > info;
+  };
+
+  inline
+  Profiler::Profiler ()
+    :
+    enabled(true),
+    created(clock::now())
+  {}
+
+  inline
+  void Profiler::set_enabled (const bool enabled_)
+  {
+    enabled=enabled_;
+  }
+
+  inline
+  bool Profiler::is_enabled () const
+  {
+    return enabled;
+  }
+
+  inline
+  unsigned int Profiler::add_section (const std::string &name)
+  {
+    Section section;
+    section.name     =name;
+    section.wall_time=0.;
+    section.n_calls  =0;
+    sections.push_back(section);
+    return sections.size()-1;
+  }
+
+  inline
+  unsigned int Profiler::add_counter (const std::string &name)
+  {
+    counters.push_back(std::make_pair(name,0ul));
+    return counters.size()-1;
+  }
+
+  inline
+  void Profiler::add_section (const unsigned int section, const std::string &name)
+  {
+    if (add_section(name)!=section)
+      {
+	std::cout << "Error, profiler section " << name << " registered as "
+		  << sections.size()-1 << " instead of " << section << "\n";
+	throw 1;
+      }
+  }
+
+  inline
+  void Profiler::add_counter (const unsigned int counter, const std::string &name)
+  {
+    if (add_counter(name)!=counter)
+      {
+	std::cout << "Error, profiler counter " << name << " registered as "
+		  << counters.size()-1 << " instead of " << counter << "\n";
+	throw 1;
+      }
+  }
+
+  inline
+  void Profiler::set_info (const std::string &name, const double value)
+  {
+    for (unsigned int i=0; i<info.size(); ++i)
+      if (info[i].first==name)
+	{
+	  info[i].second=value;
+	  return;
+	}
+    info.push_back(std::make_pair(name,value));
+  }
+
+  inline
+  void Profiler::start (const unsigned int section)
+  {
+    if (enabled)
+      sections[section].started=clock::now();
+  }
+
+  inline
+  void Profiler::stop (const unsigned int section)
+  {
+    if (enabled)
+      {
+	sections[section].wall_time+=
+	  std::chrono::duration<double>(clock::now()-sections[section].started).count();
+	sections[section].n_calls++;
+      }
+  }
+
+  inline
+  void Profiler::count (const unsigned int counter, const unsigned long n)
+  {
+    counters[counter].second+=n;
+  }
+
+  inline
+  double Profiler::wall_time (const unsigned int section) const
+  {
+    return sections[section].wall_time;
+  }
+
+  inline
+  unsigned long Profiler::counter_value (const unsigned int counter) const
+  {
+    return counters[counter].second;
+  }
+
+  inline
+  double Profiler::total_wall_time () const
+  {
+    return std::chrono::duration<double>(clock::now()-created).count();
+  }
+
+  inline
+  void Profiler::print_summary (std::ostream &out) const
+  {
+    if (!enabled)
+      return;
+
+    const double total=total_wall_time();
+    const std::ios::fmtflags flags=out.flags();
+    const std::streamsize    precision=out.precision();
+
+    out << "\n+--------------------------------------+------------+------------+--------+\n"
+	<< "| Total wall clock time elapsed        |"
+	<< std::setw(10) << std::fixed << std::setprecision(3) << total << "s |"
+	<< "            |        |\n"
+	<< "| Section                              | no. calls  | wall time  | % total|\n"
+	<< "+--------------------------------------+------------+------------+--------+\n";
+    for (unsigned int i=0; i<sections.size(); ++i)
+      out << "| " << std::left << std::setw(37) << sections[i].name << std::right
+	  << "|" << std::setw(11) << sections[i].n_calls << " "
+	  << "|" << std::setw(10) << std::setprecision(3) << sections[i].wall_time << "s "
+	  << "|" << std::setw(6)  << std::setprecision(1)
+	  << (total>0. ? 100.*sections[i].wall_time/total : 0.) << "% |\n";
+    out << "+--------------------------------------+------------+------------+--------+\n";
+    for (unsigned int i=0; i<counters.size(); ++i)
+      out << "| " << std::left << std::setw(37) << counters[i].first << std::right
+	  << "|" << std::setw(11) << counters[i].second << " "
+	  << "|            |        |\n";
+    out << "+--------------------------------------+------------+------------+--------+\n"
+	<< std::endl;
+
+    out.flags(flags);
+    out.precision(precision);
+  }
+
+  inline
+  void Profiler::write_json (const std::string &filename) const
+  {
+    std::ofstream out(filename.c_str());
+    if (!out.is_open())
+      {
+	std::cout << "Error opening profiling file " << filename << "\n";
+	return;
+      }
+    out << std::setprecision(9);
+    out << "{\n"
+	<< "  \"total_wall_time\": " << total_wall_time() << ",\n"
+	<< "  \"info\": {";
+    for (unsigned int i=0; i<info.size(); ++i)
+      out << (i==0 ? "\n" : ",\n")
+	  << "    \"" << info[i].first << "\": " << info[i].second;
+    out << "\n  },\n"
+	<< "  \"sections\": [";
+    for (unsigned int i=0; i<sections.size(); ++i)
+      out << (i==0 ? "\n" : ",\n")
+	  << "    {\"name\": \"" << sections[i].name << "\", "
+	  << "\"calls\": " << sections[i].n_calls << ", "
+	  << "\"wall_time\": " << sections[i].wall_time << "}";
+    out << "\n  ],\n"
+	<< "  \"counters\": {";
+    for (unsigned int i=0; i<counters.size(); ++i)
+      out << (i==0 ? "\n" : ",\n")
+	  << "    \"" << counters[i].first << "\": " << counters[i].second;
+    out << "\n  }\n"
+	<< "}\n";
+  }
+}
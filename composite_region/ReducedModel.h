@@ -0,0 +1,569 @@
+  /*
+   * Reduced order model (POD-Galerkin with DEIM) of the heat equation
+   * discretized by Heat_Pipe, with backward Euler in time:
+   *
+   *   M(T_new) (T_new-T_old) + dt K(T_new) T_new = 0
+   *
+   * The temperature is written as T = V a + g_top l_top + g_bottom l_bottom,
+   * where the columns of V (the POD basis) are zero on the Dirichlet
+   * boundaries and l_top, l_bottom are one on the top and bottom boundary
+   * dofs and zero elsewhere. The heat capacity and the thermal
+   * conductivity at all quadrature points are approximated by DEIM: they
+   * are evaluated at a few quadrature points only and interpolated with
+   * a basis of coefficient fields, so that M and K are linear
+   * combinations of reduced matrices computed once. A time step costs a
+   * few material evaluations and the solution of a system of the size of
+   * the basis.
+   *
+   * The reduced data are built by Heat_Pipe::build_reduced_model() from
+   * snapshots of full runs, and written to and read from a text file.
+   * */
+  class ReducedModel
+  {
+  public:
+    /*
+     * DEIM approximation of a coefficient field given at the quadrature
+     * points. For each of the p interpolation points: the depth used for
+     * the material data, the values of the basis functions and of the
+     * lifting functions there, and the reduced mass or laplace matrix and
+     * lifting vectors weighted with the corresponding coefficient basis
+     * function.
+     */
+    struct Field
+    {
+      std::vector<double>               depths;
+      FullMatrix<double>                point_values;
+      std::vector<double>               point_lift_top;
+      std::vector<double>               point_lift_bottom;
+      FullMatrix<double>                interpolation;
+      std::vector<FullMatrix<double> >  matrices;
+      std::vector<Vector<double> >      lift_top;
+      std::vector<Vector<double> >      lift_bottom;
+
+      unsigned int n_points () const;
+      void reinit (const unsigned int n_points,
+		   const unsigned int n_basis);
+    };
+
+    unsigned int size () const;
+
+    /*
+     * Reduced coordinates of a full solution. The basis is orthonormal
+     * and zero where the lifting functions are not, so this is V^T T.
+     */
+    void reduce (const Vector<double> &full_solution,
+		 Vector<double>       &coordinates) const;
+    /*
+     * One time step from 'coordinates' with Picard iterations, the
+     * boundary values at the start and the end of the step and a
+     * function material(depth,temperature,conductivity,heat_capacity).
+     * Returns the number of iterations.
+     */
+    template <class MaterialFunction>
+    unsigned int advance (Vector<double>  &coordinates,
+			  const double     old_top_value,
+			  const double     new_top_value,
+			  const double     bottom_value,
+			  const double     dt,
+			  MaterialFunction material);
+    void probe_temperatures (const Vector<double> &coordinates,
+			     const double          top_value,
+			     const double          bottom_value,
+			     std::vector<double>  &temperatures) const;
+
+    void write (const std::string &filename) const;
+    void read (const std::string &filename);
+
+    /*
+     * Offline helpers. pod() returns the left singular vectors of the
+     * snapshot matrix whose singular values are larger than tolerance
+     * times the largest one, at most max_size of them. deim_points()
+     * returns the greedy DEIM interpolation indices of a basis.
+     */
+    static void pod (const std::vector<Vector<double> > &snapshots,
+		     const double                        tolerance,
+		     const unsigned int                  max_size,
+		     std::vector<Vector<double> >       &basis);
+    static void deim_points (const std::vector<Vector<double> > &basis,
+			     std::vector<unsigned int>          &indices);
+    static void symmetric_eigenvectors (FullMatrix<double>  &matrix,
+					std::vector<double> &eigenvalues,
+					FullMatrix<double>  &eigenvectors);
+
+    FullMatrix<double>  basis;
+    Field               heat_capacity;
+    Field               conductivity;
+    FullMatrix<double>  probe_values;
+    std::vector<double> probe_lift_top;
+    std::vector<double> probe_lift_bottom;
+
+  private:
+    void field_coefficients (const Field               &field,
+			     const std::vector<double> &point_values,
+			     Vector<double>            &coefficients) const;
+    static void write_matrix (std::ostream &out, const FullMatrix<double> &matrix);
+    static void read_matrix (std::istream &in, FullMatrix<double> &matrix);
+    static void write_vector (std::ostream &out, const std::vector<double> &vector);
+    static void read_vector (std::istream &in, std::vector<double> &vector);
+    static void write_field (std::ostream &out, const Field &field);
+    static void read_field (std::istream &in, Field &field);
+
+    FullMatrix<double>  system_matrix;
+    Vector<double>      system_rhs;
+    Vector<double>      old_coordinates;
+    Vector<double>      previous_iterate;
+    Vector<double>      matrix_product;
+    std::vector<double> point_heat_capacities;
+    std::vector<double> point_conductivities;
+    Vector<double>      heat_capacity_coefficients;
+    Vector<double>      conductivity_coefficients;
+  };
+
+  inline
+  unsigned int ReducedModel::Field::n_points () const
+  {
+    return depths.size();
+  }
+
+  inline
+  void ReducedModel::Field::reinit (const unsigned int n_points,
+				    const unsigned int n_basis)
+  {
+    depths.assign           (n_points,0.);
+    point_values.reinit     (n_points,n_basis);
+    point_lift_top.assign   (n_points,0.);
+    point_lift_bottom.assign(n_points,0.);
+    interpolation.reinit    (n_points,n_points);
+    matrices.assign   (n_points,FullMatrix<double>(n_basis,n_basis));
+    lift_top.assign   (n_points,Vector<double>(n_basis));
+    lift_bottom.assign(n_points,Vector<double>(n_basis));
+  }
+
+  inline
+  unsigned int ReducedModel::size () const
+  {
+    return basis.n();
+  }
+
+  inline
+  void ReducedModel::reduce (const Vector<double> &full_solution,
+			     Vector<double>       &coordinates) const
+  {
+    if (full_solution.size()!=basis.m())
+      {
+	std::cout << "Error, the reduced model was built for "
+		  << basis.m() << " dofs, the mesh has "
+		  << full_solution.size() << "\n";
+	throw 1;
+      }
+    coordinates.reinit(size());
+    basis.Tvmult(coordinates,full_solution);
+  }
+
+  inline
+  void ReducedModel::field_coefficients (const Field               &field,
+					 const std::vector<double> &point_values,
+					 Vector<double>            &coefficients) const
+  {
+    const unsigned int p=field.n_points();
+    coefficients.reinit(p,true);
+    for (unsigned int i=0; i<p; ++i)
+      {
+	double value=0.;
+	for (unsigned int j=0; j<p; ++j)
+	  value+=field.interpolation(i,j)*point_values[j];
+	coefficients(i)=value;
+      }
+  }
+
+  template <class MaterialFunction>
+  unsigned int ReducedModel::advance (Vector<double>  &coordinates,
+				      const double     old_top_value,
+				      const double     new_top_value,
+				      const double     bottom_value,
+				      const double     dt,
+				      MaterialFunction material)
+  {
+    /*
+     * With T=V a+L and theta the DEIM coefficients, the Galerkin system is
+     *   (sum theta_c,j M_j + dt sum theta_k,j K_j) a_new =
+     *     sum theta_c,j (M_j a_old + (L_old-L_new) terms)
+     *     - dt sum theta_k,j (L_new terms)
+     * where the coefficients are evaluated at the new temperature.
+     */
+    const unsigned int r=size();
+    system_matrix.reinit(r,r);
+    system_rhs.reinit(r);
+    matrix_product.reinit(r);
+    old_coordinates=coordinates;
+
+    unsigned int iteration=0;
+    double change=0.;
+    do
+      {
+	previous_iterate=coordinates;
+
+	const Field *fields[2]={&heat_capacity,&conductivity};
+	for (unsigned int f=0; f<2; ++f)
+	  {
+	    const Field &field=*fields[f];
+	    const unsigned int p=field.n_points();
+	    std::vector<double> &values=(f==0 ? point_heat_capacities : point_conductivities);
+	    values.resize(p);
+	    for (unsigned int i=0; i<p; ++i)
+	      {
+		double temperature=
+		  new_top_value*field.point_lift_top[i]+
+		  bottom_value *field.point_lift_bottom[i];
+		for (unsigned int j=0; j<r; ++j)
+		  temperature+=field.point_values(i,j)*coordinates(j);
+
+		double k=0.;
+		double c=0.;
+		material(field.depths[i],temperature,k,c);
+		values[i]=(f==0 ? c : k);
+	      }
+	  }
+	field_coefficients(heat_capacity,point_heat_capacities,heat_capacity_coefficients);
+	field_coefficients(conductivity, point_conductivities, conductivity_coefficients);
+
+	system_matrix=0.;
+	system_rhs   =0.;
+	for (unsigned int j=0; j<heat_capacity.n_points(); ++j)
+	  {
+	    const double theta=heat_capacity_coefficients(j);
+	    system_matrix.add(theta,heat_capacity.matrices[j]);
+	    heat_capacity.matrices[j].vmult(matrix_product,old_coordinates);
+	    system_rhs.add(theta,matrix_product,
+			   theta*(old_top_value-new_top_value),heat_capacity.lift_top[j]);
+	  }
+	for (unsigned int j=0; j<conductivity.n_points(); ++j)
+	  {
+	    const double theta=conductivity_coefficients(j);
+	    system_matrix.add(dt*theta,conductivity.matrices[j]);
+	    system_rhs.add(-dt*theta*new_top_value,conductivity.lift_top[j],
+			   -dt*theta*bottom_value, conductivity.lift_bottom[j]);
+	  }
+
+	system_matrix.gauss_jordan();
+	system_matrix.vmult(coordinates,system_rhs);
+
+	previous_iterate-=coordinates;
+	change=previous_iterate.linfty_norm();
+	iteration++;
+      }
+    while (change>1e-8*(1.+coordinates.linfty_norm()) && iteration<50);
+
+    return iteration;
+  }
+
+  inline
+  void ReducedModel::probe_temperatures (const Vector<double> &coordinates,
+					 const double          top_value,
+					 const double          bottom_value,
+					 std::vector<double>  &temperatures) const
+  {
+    temperatures.resize(probe_values.m());
+    for (unsigned int i=0; i<probe_values.m(); ++i)
+      {
+	double temperature=
+	  top_value   *probe_lift_top[i]+
+	  bottom_value*probe_lift_bottom[i];
+	for (unsigned int j=0; j<size(); ++j)
+	  temperature+=probe_values(i,j)*coordinates(j);
+	temperatures[i]=temperature;
+      }
+  }
+
+  inline
+  void ReducedModel::symmetric_eigenvectors (FullMatrix<double>  &matrix,
+					     std::vector<double> &eigenvalues,
+					     FullMatrix<double>  &eigenvectors)
+  {
+    /*
+     * Cyclic Jacobi rotations. 'matrix' is overwritten, eigenvalues are
+     * returned in decreasing order with the eigenvectors in the columns
+     * of 'eigenvectors'.
+     */
+    const unsigned int n=matrix.m();
+    eigenvectors.reinit(n,n);
+    for (unsigned int i=0; i<n; ++i)
+      eigenvectors(i,i)=1.;
+
+    for (unsigned int sweep=0; sweep<100; ++sweep)
+      {
+	double off_diagonal=0.;
+	double diagonal    =0.;
+	for (unsigned int i=0; i<n; ++i)
+	  {
+	    diagonal+=matrix(i,i)*matrix(i,i);
+	    for (unsigned int j=i+1; j<n; ++j)
+	      off_diagonal+=matrix(i,j)*matrix(i,j);
+	  }
+	if (off_diagonal<=1e-30*diagonal)
+	  break;
+
+	for (unsigned int p=0; p<n; ++p)
+	  for (unsigned int q=p+1; q<n; ++q)
+	    {
+	      if (matrix(p,q)==0.)
+		continue;
+	      const double tau=(matrix(q,q)-matrix(p,p))/(2.*matrix(p,q));
+	      const double t  =(tau>=0. ? 1. : -1.)/(std::fabs(tau)+std::sqrt(1.+tau*tau));
+	      const double c  =1./std::sqrt(1.+t*t);
+	      const double s  =t*c;
+	      for (unsigned int k=0; k<n; ++k)
+		{
+		  const double a_kp=matrix(k,p);
+		  const double a_kq=matrix(k,q);
+		  matrix(k,p)=c*a_kp-s*a_kq;
+		  matrix(k,q)=s*a_kp+c*a_kq;
+		}
+	      for (unsigned int k=0; k<n; ++k)
+		{
+		  const double a_pk=matrix(p,k);
+		  const double a_qk=matrix(q,k);
+		  matrix(p,k)=c*a_pk-s*a_qk;
+		  matrix(q,k)=s*a_pk+c*a_qk;
+		}
+	      for (unsigned int k=0; k<n; ++k)
+		{
+		  const double v_kp=eigenvectors(k,p);
+		  const double v_kq=eigenvectors(k,q);
+		  eigenvectors(k,p)=c*v_kp-s*v_kq;
+		  eigenvectors(k,q)=s*v_kp+c*v_kq;
+		}
+	    }
+      }
+
+    std::vector<std::pair<double,unsigned int> > order (n);
+    for (unsigned int i=0; i<n; ++i)
+      order[i]=std::make_pair(-matrix(i,i),i);
+    std::sort(order.begin(),order.end());
+
+    const FullMatrix<double> unsorted=eigenvectors;
+    eigenvalues.resize(n);
+    for (unsigned int j=0; j<n; ++j)
+      {
+	eigenvalues[j]=-order[j].first;
+	for (unsigned int i=0; i<n; ++i)
+	  eigenvectors(i,j)=unsorted(i,order[j].second);
+      }
+  }
+
+  inline
+  void ReducedModel::pod (const std::vector<Vector<double> > &snapshots,
+			  const double                        tolerance,
+			  const unsigned int                  max_size,
+			  std::vector<Vector<double> >       &basis)
+  {
+    /*
+     * Eigenvectors of the smaller of the two correlation matrices S^T S
+     * (method of snapshots) and S S^T.
+     */
+    basis.clear();
+    const unsigned int m=snapshots.size();
+    if (m==0)
+      return;
+    const unsigned int n=snapshots[0].size();
+    const bool method_of_snapshots=(m<=n);
+    const unsigned int k=(method_of_snapshots ? m : n);
+
+    FullMatrix<double> correlation (k,k);
+    if (method_of_snapshots)
+      {
+	for (unsigned int i=0; i<m; ++i)
+	  for (unsigned int j=i; j<m; ++j)
+	    correlation(i,j)=correlation(j,i)=snapshots[i]*snapshots[j];
+      }
+    else
+      for (unsigned int s=0; s<m; ++s)
+	for (unsigned int i=0; i<n; ++i)
+	  if (snapshots[s](i)!=0.)
+	    for (unsigned int j=0; j<n; ++j)
+	      correlation(i,j)+=snapshots[s](i)*snapshots[s](j);
+
+    std::vector<double> eigenvalues;
+    FullMatrix<double>  eigenvectors;
+    symmetric_eigenvectors(correlation,eigenvalues,eigenvectors);
+    if (eigenvalues[0]<=0.)
+      return;
+
+    for (unsigned int j=0; j<k && basis.size()<max_size; ++j)
+      {
+	if (eigenvalues[j]<=tolerance*tolerance*eigenvalues[0])
+	  break;
+	Vector<double> mode (n);
+	if (method_of_snapshots)
+	  {
+	    for (unsigned int s=0; s<m; ++s)
+	      mode.add(eigenvectors(s,j),snapshots[s]);
+	    mode/=std::sqrt(eigenvalues[j]);
+	  }
+	else
+	  for (unsigned int i=0; i<n; ++i)
+	    mode(i)=eigenvectors(i,j);
+	basis.push_back(mode);
+      }
+  }
+
+  inline
+  void ReducedModel::deim_points (const std::vector<Vector<double> > &basis,
+				  std::vector<unsigned int>          &indices)
+  {
+    /*
+     * Each new point is where the next basis function differs most from
+     * its interpolation on the points chosen so far.
+     */
+    indices.clear();
+    for (unsigned int l=0; l<basis.size(); ++l)
+      {
+	Vector<double> residual=basis[l];
+	if (l>0)
+	  {
+	    FullMatrix<double> point_matrix (l,l);
+	    Vector<double>     point_rhs (l);
+	    Vector<double>     interpolation_coefficients (l);
+	    for (unsigned int i=0; i<l; ++i)
+	      {
+		point_rhs(i)=basis[l](indices[i]);
+		for (unsigned int j=0; j<l; ++j)
+		  point_matrix(i,j)=basis[j](indices[i]);
+	      }
+	    point_matrix.gauss_jordan();
+	    point_matrix.vmult(interpolation_coefficients,point_rhs);
+	    for (unsigned int j=0; j<l; ++j)
+	      residual.add(-interpolation_coefficients(j),basis[j]);
+	  }
+
+	unsigned int index=0;
+	for (unsigned int i=1; i<residual.size(); ++i)
+	  if (std::fabs(residual(i))>std::fabs(residual(index)))
+	    index=i;
+	indices.push_back(index);
+      }
+  }
+
+  inline
+  void ReducedModel::write_matrix (std::ostream &out, const FullMatrix<double> &matrix)
+  {
+    out << matrix.m() << " " << matrix.n() << "\n";
+    for (unsigned int i=0; i<matrix.m(); ++i)
+      {
+	for (unsigned int j=0; j<matrix.n(); ++j)
+	  out << " " << matrix(i,j);
+	out << "\n";
+      }
+  }
+
+  inline
+  void ReducedModel::read_matrix (std::istream &in, FullMatrix<double> &matrix)
+  {
+    unsigned int m=0;
+    unsigned int n=0;
+    in >> m >> n;
+    matrix.reinit(m,n);
+    for (unsigned int i=0; i<m; ++i)
+      for (unsigned int j=0; j<n; ++j)
+	in >> matrix(i,j);
+  }
+
+  inline
+  void ReducedModel::write_vector (std::ostream &out, const std::vector<double> &vector)
+  {
+    out << vector.size() << "\n";
+    for (unsigned int i=0; i<vector.size(); ++i)
+      out << " " << vector[i];
+    out << "\n";
+  }
+
+  inline
+  void ReducedModel::read_vector (std::istream &in, std::vector<double> &vector)
+  {
+    unsigned int n=0;
+    in >> n;
+    vector.resize(n);
+    for (unsigned int i=0; i<n; ++i)
+      in >> vector[i];
+  }
+
+  inline
+  void ReducedModel::write_field (std::ostream &out, const Field &field)
+  {
+    write_vector(out,field.depths);
+    write_matrix(out,field.point_values);
+    write_vector(out,field.point_lift_top);
+    write_vector(out,field.point_lift_bottom);
+    write_matrix(out,field.interpolation);
+    for (unsigned int j=0; j<field.n_points(); ++j)
+      {
+	write_matrix(out,field.matrices[j]);
+	write_vector(out,std::vector<double>(field.lift_top[j].begin(),
+					     field.lift_top[j].end()));
+	write_vector(out,std::vector<double>(field.lift_bottom[j].begin(),
+					     field.lift_bottom[j].end()));
+      }
+  }
+
+  inline
+  void ReducedModel::read_field (std::istream &in, Field &field)
+  {
+    read_vector(in,field.depths);
+    read_matrix(in,field.point_values);
+    read_vector(in,field.point_lift_top);
+    read_vector(in,field.point_lift_bottom);
+    read_matrix(in,field.interpolation);
+    const unsigned int p=field.n_points();
+    field.matrices.resize(p);
+    field.lift_top.resize(p);
+    field.lift_bottom.resize(p);
+    std::vector<double> values;
+    for (unsigned int j=0; j<p; ++j)
+      {
+	read_matrix(in,field.matrices[j]);
+	read_vector(in,values);
+	field.lift_top[j]=Vector<double>(values.begin(),values.end());
+	read_vector(in,values);
+	field.lift_bottom[j]=Vector<double>(values.begin(),values.end());
+      }
+  }
+
+  inline
+  void ReducedModel::write (const std::string &filename) const
+  {
+    std::ofstream out (filename.c_str());
+    if (!out.is_open())
+      {
+	std::cout << "Error opening reduced model file " << filename << "\n";
+	throw 1;
+      }
+    out << std::setprecision(17);
+    write_matrix(out,basis);
+    write_field (out,heat_capacity);
+    write_field (out,conductivity);
+    write_matrix(out,probe_values);
+    write_vector(out,probe_lift_top);
+    write_vector(out,probe_lift_bottom);
+  }
+
+  inline
+  void ReducedModel::read (const std::string &filename)
+  {
+    std::ifstream in (filename.c_str());
+    if (!in.is_open())
+      {
+	std::cout << "Error opening reduced model file " << filename << "\n";
+	throw 1;
+      }
+    read_matrix(in,basis);
+    read_field (in,heat_capacity);
+    read_field (in,conductivity);
+    read_matrix(in,probe_values);
+    read_vector(in,probe_lift_top);
+    read_vector(in,probe_lift_bottom);
+    if (!in)
+      {
+	std::cout << "Error reading reduced model file " << filename << "\n";
+	throw 1;
+      }
+  }
@@ -0,0 +1,396 @@
+namespace Monitoring
+{
+  /*
+   * Live monitoring of a running simulation through POSIX shared memory.
+   * The solver (Publisher) pushes one record per time step into a ring
+   * buffer in a shared memory segment, and any number of readers (Reader,
+   * see monitor_reader.cc) attach to it and follow the records. The
+   * solver never waits for readers and never makes a system call while
+   * publishing: a slow reader loses the records that are overwritten
+   * before it gets to them, and is told how many.
+   *
+   * Layout of the segment: a Header, then 'capacity' slots of slot_stride
+   * bytes. A slot is a sequence number followed by the record_size values
+   * of the record. The slot of record n (n=0,1,...) is n%capacity, and
+   * its sequence number is 2n+1 while the record is written and 2n+2 when
+   * it is complete (a seqlock), so that a reader can tell a complete
+   * record from a torn or overwritten one.
+   *
+   * The first n_fields values of a record are the ones in Field, then one
+   * value per probe.
+   * */
+  enum Field
+  {
+    step_field,
+    time_field,
+    time_step_field,
+    picard_iterations_field,
+    linear_iterations_field,
+    thermal_energy_field,
+    heat_flux_top_field,
+    heat_flux_bottom_field,
+    heat_flux_lateral_field,
+    point_source_rate_field,
+    heat_loss_rate_field,
+    balance_error_field,
+    n_fields
+  };
+
+  inline
+  const char *field_name (const unsigned int field)
+  {
+    static const char *const names[n_fields]=
+      {
+	"step", "time", "time_step", "picard_iterations", "linear_iterations",
+	"thermal_energy", "heat_flux_top", "heat_flux_bottom", "heat_flux_lateral",
+	"point_source_rate", "heat_loss_rate", "balance_error"
+      };
+    return names[field];
+  }
+
+  const std::uint32_t magic_number=0x54524c4d; // "TRLM"
+  const std::uint32_t layout_version=1;
+
+  struct alignas(64) Header
+  {
+    std::atomic<std::uint32_t> magic;
+    std::uint32_t              version;
+    std::uint32_t              n_probes;
+    std::uint32_t              record_size;
+    std::uint64_t              capacity;
+    std::uint64_t              slot_stride;
+    /*
+     * Number of records published so far, and 1 once the run is over.
+     */
+    std::atomic<std::uint64_t> n_published;
+    std::atomic<std::uint32_t> finished;
+  };
+
+  inline
+  std::uint64_t slot_stride (const unsigned int record_size)
+  {
+    const std::uint64_t bytes=
+      sizeof(std::atomic<std::uint64_t>)+record_size*sizeof(std::atomic<double>);
+    return 64*((bytes+63)/64);
+  }
+
+  inline
+  std::atomic<std::uint64_t> &slot_sequence (char *slot)
+  {
+    return *reinterpret_cast<std::atomic<std::uint64_t>*>(slot);
+  }
+
+  inline
+  std::atomic<double> *slot_values (char *slot)
+  {
+    return reinterpret_cast<std::atomic<double>*>(slot+sizeof(std::atomic<std::uint64_t>));
+  }
+
+  class Publisher
+  {
+  public:
+    /*
+     * Creates the shared memory segment 'name' (e.g. "/composite_region",
+     * replacing a stale one left by an earlier run) with room for
+     * 'capacity' records. The segment is removed by the destructor;
+     * readers that are still attached keep their mapping.
+     */
+    Publisher (const std::string  &name,
+	       const unsigned int  capacity,
+	       const unsigned int  n_probes);
+    ~Publisher ();
+
+    unsigned int record_size () const;
+    /*
+     * Publishes the record_size() values in 'record'.
+     */
+    void publish (const std::vector<double> &record);
+    /*
+     * Tells the readers that no more records will come.
+     */
+    void finish ();
+
+  private:
+    std::string   name;
+    char         *memory;
+    std::size_t   memory_size;
+    Header       *header;
+    char         *slots;
+    std::uint64_t n_published;
+  };
+
+  inline
+  Publisher::Publisher (const std::string  &name_,
+			const unsigned int  capacity,
+			const unsigned int  n_probes)
+    :
+    name(name_),
+    memory(0),
+    memory_size(0),
+    header(0),
+    slots(0),
+    n_published(0)
+  {
+    static_assert(ATOMIC_LLONG_LOCK_FREE==2,
+		  "the monitor needs lock free 64 bit atomics");
+    std::atomic<double> probe;
+    if (!probe.is_lock_free() || capacity==0)
+      {
+	std::cout << "Error, the shared memory monitor needs lock free atomic "
+		  << "doubles and a positive buffer size\n";
+	throw 1;
+      }
+
+    const unsigned int size=n_fields+n_probes;
+    memory_size=sizeof(Header)+capacity*slot_stride(size);
+
+    /*
+     * An existing segment may belong to a run that is still going, with
+     * readers attached, so it is never replaced. A segment left behind by
+     * a run that crashed has to be removed by hand.
+     */
+    const int fd=shm_open(name.c_str(),O_CREAT|O_EXCL|O_RDWR,0644);
+    if (fd<0)
+      {
+	if (errno==EEXIST)
+	  std::cout << "Error, shared memory segment " << name << " already "
+		    << "exists. Another run may be publishing to it; if not, "
+		    << "remove /dev/shm" << name << " or choose another "
+		    << "'monitor shared memory' name\n";
+	else
+	  std::cout << "Error creating shared memory segment " << name << "\n";
+	throw 1;
+      }
+    if (ftruncate(fd,memory_size)!=0)
+      {
+	close(fd);
+	shm_unlink(name.c_str());
+	std::cout << "Error sizing shared memory segment " << name << "\n";
+	throw 1;
+      }
+    void *address=mmap(0,memory_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if (address==MAP_FAILED)
+      {
+	shm_unlink(name.c_str());
+	std::cout << "Error mapping shared memory segment " << name << "\n";
+	throw 1;
+      }
+    memory=static_cast<char*>(address);
+
+    header=new (memory) Header;
+    header->version    =layout_version;
+    header->n_probes   =n_probes;
+    header->record_size=size;
+    header->capacity   =capacity;
+    header->slot_stride=slot_stride(size);
+    header->n_published.store(0,std::memory_order_relaxed);
+    header->finished.store(0,std::memory_order_relaxed);
+
+    slots=memory+sizeof(Header);
+    for (unsigned int k=0; k<capacity; k++)
+      {
+	char *slot=slots+k*header->slot_stride;
+	new (slot) std::atomic<std::uint64_t>(0);
+	for (unsigned int i=0; i<size; i++)
+	  new (slot_values(slot)+i) std::atomic<double>(0.);
+      }
+    /*
+     * Readers wait for the magic number before they look at anything
+     * else.
+     */
+    header->magic.store(magic_number,std::memory_order_release);
+  }
+
+  inline
+  Publisher::~Publisher ()
+  {
+    finish();
+    munmap(memory,memory_size);
+    shm_unlink(name.c_str());
+  }
+
+  inline
+  unsigned int Publisher::record_size () const
+  {
+    return header->record_size;
+  }
+
+  inline
+  void Publisher::publish (const std::vector<double> &record)
+  {
+    char *slot=slots+(n_published%header->capacity)*header->slot_stride;
+    std::atomic<std::uint64_t> &sequence=slot_sequence(slot);
+    std::atomic<double>        *values  =slot_values(slot);
+
+    sequence.store(2*n_published+1,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (unsigned int i=0; i<header->record_size; i++)
+      values[i].store(record[i],std::memory_order_relaxed);
+    sequence.store(2*n_published+2,std::memory_order_release);
+
+    n_published++;
+    header->n_published.store(n_published,std::memory_order_release);
+  }
+
+  inline
+  void Publisher::finish ()
+  {
+    header->finished.store(1,std::memory_order_release);
+  }
+
+  class Reader
+  {
+  public:
+    enum Status
+    {
+      record_read,
+      no_new_record,
+      end_of_run
+    };
+
+    /*
+     * Attaches to the segment 'name'. Throws if it does not exist (yet).
+     * If 'from_start' is false, only the records published after
+     * attaching are read.
+     */
+    Reader (const std::string &name,
+	    const bool         from_start);
+    ~Reader ();
+
+    unsigned int n_probes () const;
+    unsigned int record_size () const;
+    /*
+     * Copies the next record to 'record'. 'skipped' is the number of
+     * records that were overwritten before they could be read.
+     */
+    Status next (std::vector<double> &record,
+		 unsigned long       &skipped);
+
+  private:
+    char         *memory;
+    std::size_t   memory_size;
+    const Header *header;
+    char         *slots;
+    std::uint64_t next_record;
+  };
+
+  inline
+  Reader::Reader (const std::string &name,
+		  const bool         from_start)
+    :
+    memory(0),
+    memory_size(0),
+    header(0),
+    slots(0),
+    next_record(0)
+  {
+    const int fd=shm_open(name.c_str(),O_RDONLY,0);
+    if (fd<0)
+      {
+	std::cout << "Error, shared memory segment " << name << " not found\n";
+	throw 1;
+      }
+    struct stat status;
+    if (fstat(fd,&status)!=0 || status.st_size<(off_t)sizeof(Header))
+      {
+	close(fd);
+	std::cout << "Error, shared memory segment " << name << " is not ready\n";
+	throw 1;
+      }
+    memory_size=status.st_size;
+    void *address=mmap(0,memory_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (address==MAP_FAILED)
+      {
+	std::cout << "Error mapping shared memory segment " << name << "\n";
+	throw 1;
+      }
+    memory=static_cast<char*>(address);
+    header=reinterpret_cast<const Header*>(memory);
+
+    if (header->magic.load(std::memory_order_acquire)!=magic_number ||
+	header->version!=layout_version ||
+	memory_size<sizeof(Header)+header->capacity*header->slot_stride)
+      {
+	munmap(memory,memory_size);
+	std::cout << "Error, " << name << " is not a monitor segment of this "
+		  << "version, or is not ready\n";
+	throw 1;
+      }
+    slots=memory+sizeof(Header);
+
+    const std::uint64_t n_published=
+      header->n_published.load(std::memory_order_acquire);
+    if (!from_start)
+      next_record=n_published;
+    else if (n_published>header->capacity)
+      next_record=n_published-header->capacity;
+  }
+
+  inline
+  Reader::~Reader ()
+  {
+    munmap(memory,memory_size);
+  }
+
+  inline
+  unsigned int Reader::n_probes () const
+  {
+    return header->n_probes;
+  }
+
+  inline
+  unsigned int Reader::record_size () const
+  {
+    return header->record_size;
+  }
+
+  inline
+  Reader::Status Reader::next (std::vector<double> &record,
+			       unsigned long       &skipped)
+  {
+    skipped=0;
+    record.resize(header->record_size);
+    while (true)
+      {
+	/*
+	 * 'finished' is set after the last record is published, so it is
+	 * read first.
+	 */
+	const bool finished=
+	  (header->finished.load(std::memory_order_acquire)!=0);
+	const std::uint64_t n_published=
+	  header->n_published.load(std::memory_order_acquire);
+	if (next_record>=n_published)
+	  return (finished ? end_of_run : no_new_record);
+	if (n_published-next_record>header->capacity)
+	  {
+	    skipped    +=n_published-header->capacity-next_record;
+	    next_record =n_published-header->capacity;
+	  }
+
+	char *slot=slots+(next_record%header->capacity)*header->slot_stride;
+	std::atomic<std::uint64_t> &sequence=slot_sequence(slot);
+	std::atomic<double>        *values  =slot_values(slot);
+
+	const std::uint64_t expected=2*next_record+2;
+	if (sequence.load(std::memory_order_acquire)==expected)
+	  {
+	    for (unsigned int i=0; i<header->record_size; i++)
+	      record[i]=values[i].load(std::memory_order_relaxed);
+	    std::atomic_thread_fence(std::memory_order_acquire);
+	    if (sequence.load(std::memory_order_relaxed)==expected)
+	      {
+		next_record++;
+		return record_read;
+	      }
+	  }
+	/*
+	 * Overwritten by a later record while we were reading it.
+	 */
+	skipped++;
+	next_record++;
+      }
+  }
+}
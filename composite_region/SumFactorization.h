@@ -0,0 +1,308 @@
+  /*
+   * Sum factorization kernels for FE_Q elements on cells that are boxes
+   * with faces parallel to the coordinate planes (as the meshes built in
+   * read_grid_temperature()). Shape functions and Gauss points are tensor
+   * products of 1D ones, so values at quadrature points, integrals against
+   * the test functions and cell matrices are computed one direction at a
+   * time. With n=degree+1 shape functions and m quadrature points per
+   * direction a cell matrix costs O(dim n^(2 dim) m) operations instead of
+   * the O(n^(2 dim) m^dim) of a loop over FEValues.
+   *
+   * Dof and quadrature point data are in lexicographic order (x running
+   * fastest). For quadrature points this is the order of QGauss<dim>, for
+   * dofs lexicographic_numbering[i] is the FE_Q index of lexicographic
+   * dof i. Cell matrices are returned in FE_Q numbering.
+   * */
+  template <int dim>
+  class SumFactorization
+  {
+  public:
+    SumFactorization ();
+
+    void reinit (const FE_Q<dim>    &fe,
+		 const Quadrature<1> &quadrature_1d);
+
+    /*
+     * Values at the quadrature points of a function given by its
+     * (lexicographic) dof values.
+     */
+    void evaluate (const std::vector<double> &dof_values,
+		   std::vector<double>       &q_values) const;
+    /*
+     * Integrals of f against each shape function, with f given at the
+     * quadrature points and already multiplied by JxW.
+     */
+    void integrate (const std::vector<double> &q_values,
+		    std::vector<double>       &dof_values) const;
+    void JxW_values (const Tensor<1,dim>  &cell_size,
+		     std::vector<double>  &JxW) const;
+    /*
+     * Mass matrix with coefficient c and laplace matrix with coefficient
+     * k, both given at the quadrature points.
+     */
+    void cell_matrices (const Tensor<1,dim>       &cell_size,
+			const std::vector<double> &mass_coefficients,
+			const std::vector<double> &laplace_coefficients,
+			FullMatrix<double>        &mass_matrix,
+			FullMatrix<double>        &laplace_matrix) const;
+
+    std::vector<unsigned int> lexicographic_numbering;
+
+  private:
+    static void apply (const std::vector<double> &matrix,
+		       const unsigned int n_rows,
+		       const unsigned int n_columns,
+		       const unsigned int n_inner,
+		       const unsigned int n_outer,
+		       const double      *in,
+		       double            *out);
+    void product_integral (const std::vector<double> &coefficients,
+			   const unsigned int         derivative_direction,
+			   std::vector<double>       &result) const;
+
+    unsigned int n_dofs_1d;
+    unsigned int n_q_points_1d;
+
+    std::vector<double> weights;
+    /*
+     * shape_values[q*n+i] is shape function i at point q and
+     * shape_values_transposed[i*m+q] the same value. The product tables
+     * hold, for p=i+n*j, the product of the values (mass) or derivatives
+     * (laplace) of shape functions i and j times the weight of point q,
+     * at [p*m+q].
+     */
+    std::vector<double> shape_values;
+    std::vector<double> shape_values_transposed;
+    std::vector<double> mass_products;
+    std::vector<double> laplace_products;
+
+    mutable std::vector<double> buffer_0;
+    mutable std::vector<double> buffer_1;
+    mutable std::vector<double> product_buffer;
+  };
+
+  template <int dim>
+  SumFactorization<dim>::SumFactorization ()
+    :
+    n_dofs_1d(0),
+    n_q_points_1d(0)
+  {}
+
+  template <int dim>
+  void SumFactorization<dim>::reinit (const FE_Q<dim>    &fe,
+				      const Quadrature<1> &quadrature_1d)
+  {
+    const FE_Q<1> fe_1d (fe.degree);
+    n_dofs_1d    =fe.degree+1;
+    n_q_points_1d=quadrature_1d.size();
+    const unsigned int n=n_dofs_1d;
+    const unsigned int m=n_q_points_1d;
+
+    lexicographic_numbering=
+      FETools::lexicographic_to_hierarchic_numbering<dim> (fe);
+    /*
+     * FE_Q<1> numbers the two vertex dofs first and then the interior
+     * ones from left to right.
+     */
+    std::vector<unsigned int> numbering_1d (n);
+    numbering_1d[0]  =0;
+    numbering_1d[n-1]=1;
+    for (unsigned int i=1; i<n-1; ++i)
+      numbering_1d[i]=i+1;
+
+    weights=quadrature_1d.get_weights();
+    shape_values.resize           (m*n);
+    shape_values_transposed.resize(n*m);
+    std::vector<double> shape_derivatives (m*n);
+    for (unsigned int q=0; q<m; ++q)
+      for (unsigned int i=0; i<n; ++i)
+	{
+	  const Point<1> &point=quadrature_1d.point(q);
+	  shape_values[q*n+i]           =fe_1d.shape_value(numbering_1d[i],point);
+	  shape_values_transposed[i*m+q]=shape_values[q*n+i];
+	  shape_derivatives[q*n+i]      =fe_1d.shape_grad(numbering_1d[i],point)[0];
+	}
+
+    mass_products.resize   (n*n*m);
+    laplace_products.resize(n*n*m);
+    for (unsigned int i=0; i<n; ++i)
+      for (unsigned int j=0; j<n; ++j)
+	for (unsigned int q=0; q<m; ++q)
+	  {
+	    const unsigned int p=i+n*j;
+	    mass_products   [p*m+q]=
+	      shape_values[q*n+i]*shape_values[q*n+j]*weights[q];
+	    laplace_products[p*m+q]=
+	      shape_derivatives[q*n+i]*shape_derivatives[q*n+j]*weights[q];
+	  }
+
+    unsigned int buffer_size=1;
+    for (unsigned int d=0; d<dim; ++d)
+      buffer_size*=std::max(n*n,m);
+    buffer_0.resize(buffer_size);
+    buffer_1.resize(buffer_size);
+    product_buffer.resize(buffer_size);
+  }
+
+  template <int dim>
+  void SumFactorization<dim>::apply (const std::vector<double> &matrix,
+				     const unsigned int n_rows,
+				     const unsigned int n_columns,
+				     const unsigned int n_inner,
+				     const unsigned int n_outer,
+				     const double      *in,
+				     double            *out)
+  {
+    /*
+     * out(inner,row,outer) = sum_column matrix(row,column) in(inner,column,outer)
+     */
+    for (unsigned int o=0; o<n_outer; ++o)
+      for (unsigned int r=0; r<n_rows; ++r)
+	{
+	  double *out_row=out+n_inner*(r+n_rows*o);
+	  for (unsigned int i=0; i<n_inner; ++i)
+	    out_row[i]=0.;
+	  for (unsigned int c=0; c<n_columns; ++c)
+	    {
+	      const double  a    =matrix[r*n_columns+c];
+	      const double *in_row=in+n_inner*(c+n_columns*o);
+	      for (unsigned int i=0; i<n_inner; ++i)
+		out_row[i]+=a*in_row[i];
+	    }
+	}
+  }
+
+  template <int dim>
+  void SumFactorization<dim>::evaluate (const std::vector<double> &dof_values,
+					std::vector<double>       &q_values) const
+  {
+    const unsigned int n=n_dofs_1d;
+    const unsigned int m=n_q_points_1d;
+
+    const double *in=&dof_values[0];
+    unsigned int n_inner=1;
+    unsigned int n_outer=Utilities::fixed_power<dim-1>(n);
+    for (unsigned int d=0; d<dim; ++d)
+      {
+	double *out=(d==dim-1 ? &q_values[0] : (d%2==0 ? &buffer_0[0] : &buffer_1[0]));
+	apply (shape_values,m,n,n_inner,n_outer,in,out);
+	in=out;
+	n_inner*=m;
+	n_outer/=n;
+      }
+  }
+
+  template <int dim>
+  void SumFactorization<dim>::integrate (const std::vector<double> &q_values,
+					 std::vector<double>       &dof_values) const
+  {
+    const unsigned int n=n_dofs_1d;
+    const unsigned int m=n_q_points_1d;
+
+    const double *in=&q_values[0];
+    unsigned int n_inner=1;
+    unsigned int n_outer=Utilities::fixed_power<dim-1>(m);
+    for (unsigned int d=0; d<dim; ++d)
+      {
+	double *out=(d==dim-1 ? &dof_values[0] : (d%2==0 ? &buffer_0[0] : &buffer_1[0]));
+	apply (shape_values_transposed,n,m,n_inner,n_outer,in,out);
+	in=out;
+	n_inner*=n;
+	n_outer/=m;
+      }
+  }
+
+  template <int dim>
+  void SumFactorization<dim>::JxW_values (const Tensor<1,dim> &cell_size,
+					  std::vector<double> &JxW) const
+  {
+    const unsigned int m=n_q_points_1d;
+    const unsigned int n_q_points=Utilities::fixed_power<dim>(m);
+    for (unsigned int q=0; q<n_q_points; ++q)
+      {
+	double value=1.;
+	unsigned int index=q;
+	for (unsigned int d=0; d<dim; ++d)
+	  {
+	    value*=weights[index%m]*cell_size[d];
+	    index/=m;
+	  }
+	JxW[q]=value;
+      }
+  }
+
+  template <int dim>
+  void SumFactorization<dim>::product_integral (const std::vector<double> &coefficients,
+						const unsigned int         derivative_direction,
+						std::vector<double>       &result) const
+  {
+    /*
+     * result(p_0,...,p_dim-1) = sum_q c(q) prod_d table_d(p_d,q_d), where
+     * table_d is the laplace product table in derivative_direction and the
+     * mass product table otherwise. Weights are included in the tables,
+     * cell sizes are not.
+     */
+    const unsigned int n2=n_dofs_1d*n_dofs_1d;
+    const unsigned int m =n_q_points_1d;
+
+    const double *in=&coefficients[0];
+    unsigned int n_inner=1;
+    unsigned int n_outer=Utilities::fixed_power<dim-1>(m);
+    for (unsigned int d=0; d<dim; ++d)
+      {
+	double *out=(d==dim-1 ? &result[0] : (d%2==0 ? &buffer_0[0] : &buffer_1[0]));
+	apply ((d==derivative_direction ? laplace_products : mass_products),
+	       n2,m,n_inner,n_outer,in,out);
+	in=out;
+	n_inner*=n2;
+	n_outer/=m;
+      }
+  }
+
+  template <int dim>
+  void SumFactorization<dim>::cell_matrices (const Tensor<1,dim>       &cell_size,
+					     const std::vector<double> &mass_coefficients,
+					     const std::vector<double> &laplace_coefficients,
+					     FullMatrix<double>        &mass_matrix,
+					     FullMatrix<double>        &laplace_matrix) const
+  {
+    const unsigned int n         =n_dofs_1d;
+    const unsigned int n2        =n*n;
+    const unsigned int n_products=Utilities::fixed_power<dim>(n2);
+
+    double volume=1.;
+    for (unsigned int d=0; d<dim; ++d)
+      volume*=cell_size[d];
+
+    mass_matrix   =0.;
+    laplace_matrix=0.;
+    for (unsigned int e=0; e<=dim; ++e)
+      {
+	/*
+	 * e<dim is the derivative direction of a laplace term, e==dim is
+	 * the mass matrix.
+	 */
+	product_integral ((e<dim ? laplace_coefficients : mass_coefficients),
+			  e,product_buffer);
+	FullMatrix<double> &matrix=(e<dim ? laplace_matrix : mass_matrix);
+	const double factor=(e<dim ? volume/(cell_size[e]*cell_size[e]) : volume);
+
+	for (unsigned int index=0; index<n_products; ++index)
+	  {
+	    unsigned int i=0;
+	    unsigned int j=0;
+	    unsigned int stride=1;
+	    unsigned int p_index=index;
+	    for (unsigned int d=0; d<dim; ++d)
+	      {
+		const unsigned int p=p_index%n2;
+		i+=(p%n)*stride;
+		j+=(p/n)*stride;
+		stride *=n;
+		p_index/=n2;
+	      }
+	    matrix(lexicographic_numbering[i],lexicographic_numbering[j])+=
+	      factor*product_buffer[index];
+	  }
+      }
+  }
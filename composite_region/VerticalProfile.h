@@ -0,0 +1,24 @@
+/*
+ * The initial condition file contains temperatures as a function of depth
+ * only. This class evaluates that profile using the vertical coordinate
+ * (the last one) of the given point, so that the same file can be used in
+ * 1D, 2D and 3D.
+ */
+template <int dim>
+class VerticalProfile : public Function<dim>
+{
+public:
+  VerticalProfile (const std::vector< std::pair<double,double> > &table)
+    :
+    Function<dim>(),
+    profile(table)
+  {}
+
+  virtual double value (const Point<dim>   &p,
+			const unsigned int  component=0) const
+  {
+    return profile.value(Point<1>(p[dim-1]),component);
+  }
+private:
+  InitialValue<1> profile;
+};
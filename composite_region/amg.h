@@ -0,0 +1,545 @@
+namespace LinearSolvers
+{
+  using namespace dealii;
+  /*
+   * Self-contained smoothed aggregation algebraic multigrid preconditioner.
+   * It is used when deal.II has not been configured with Trilinos (in which
+   * case TrilinosWrappers::PreconditionAMG is used instead). The hierarchy
+   * is built from the assembled system matrix only, so it works for any
+   * dimension and finite element degree:
+   *
+   * - aggregates are formed from the strongly coupled neighbours of each
+   *   node (Vanek, Mandel and Brezina, 1996), using the constant vector as
+   *   near null space
+   * - the tentative (piecewise constant) prolongator is smoothed with one
+   *   damped Jacobi step
+   * - coarse operators are computed as Galerkin products P^T A P
+   * - a symmetric V-cycle with damped Jacobi smoothing is applied, with an
+   *   exact (Cholesky) solve on the coarsest level, so it can be used with
+   *   SolverCG.
+   *
+   * Since the mesh does not change during a run, the aggregates,
+   * prolongators and sparsity patterns are kept between calls to
+   * reinit_values() and only the operators on each level are recomputed
+   * when the matrix values change (e.g. every Picard iteration), without
+   * allocating memory.
+   *
+   * If coarsening stops with a coarsest level larger than
+   * max_direct_coarse_size (e.g. aggregation makes no progress on the
+   * fine level), that level is not factorized but gets one SSOR sweep,
+   * and direct_coarse_solve() returns false so that the caller can report
+   * it.
+   * */
+  template <typename number>
+    class PreconditionSmoothedAggregation : public Subscriptor
+    {
+    public:
+      struct AdditionalData
+      {
+	AdditionalData (const double       strong_threshold   =0.08,
+			const unsigned int n_smoothing_steps  =2,
+			const double       smoother_relaxation=0.6,
+			const unsigned int max_coarse_size    =64,
+			const unsigned int max_levels         =20,
+			const unsigned int max_direct_coarse_size=1000);
+
+	double       strong_threshold;
+	unsigned int n_smoothing_steps;
+	double       smoother_relaxation;
+	unsigned int max_coarse_size;
+	unsigned int max_levels;
+	unsigned int max_direct_coarse_size;
+      };
+
+      void initialize (const SparseMatrix<number> &matrix,
+		       const AdditionalData       &additional_data=AdditionalData());
+      void reinit_values (const SparseMatrix<number> &matrix);
+      void clear ();
+      unsigned int n_levels () const;
+      /*
+       * Size of the coarsest level, and whether it is solved exactly.
+       */
+      unsigned int coarse_size () const;
+      bool direct_coarse_solve () const;
+
+      template <typename somenumber>
+      void vmult (Vector<somenumber> &dst, const Vector<somenumber> &src) const;
+
+    private:
+      const SparseMatrix<number> &level_matrix (const unsigned int level) const;
+      unsigned int aggregate (const SparseMatrix<number>  &matrix,
+			      std::vector<unsigned int>   &aggregate_of) const;
+      void build_prolongation (const unsigned int level,
+			       const std::vector<unsigned int> &aggregate_of,
+			       const unsigned int n_aggregates);
+      void galerkin_product (const unsigned int level,
+			     const bool build_sparsity);
+      void setup_smoothers ();
+      void coarse_solve () const;
+      void smooth (const unsigned int level) const;
+      void v_cycle (const unsigned int level) const;
+
+      AdditionalData data;
+      SmartPointer<const SparseMatrix<number> > fine_matrix;
+      /*
+       * Entry 'l' of the prolongation vectors maps level l+1 into level l,
+       * and entry 'l' of the products is A_l P_l, the first half of the
+       * Galerkin product. Coarse matrices are stored from level 1 onwards,
+       * entry 0 is empty because the fine level matrix belongs to the
+       * caller.
+       * */
+      std::vector<std::unique_ptr<SparsityPattern> >      prolongation_sparsity;
+      std::vector<std::unique_ptr<SparseMatrix<number> > > prolongation;
+      std::vector<std::unique_ptr<SparsityPattern> >      product_sparsity;
+      std::vector<std::unique_ptr<SparseMatrix<number> > > products;
+      std::vector<std::unique_ptr<SparsityPattern> >      coarse_sparsity;
+      std::vector<std::unique_ptr<SparseMatrix<number> > > coarse_matrices;
+      std::vector<Vector<double> > inverse_diagonal;
+      /*
+       * Lower triangular Cholesky factor of the coarsest matrix, sized
+       * once by initialize() (empty if the coarsest level is too large).
+       * */
+      FullMatrix<double>           coarse_factor;
+      bool                         direct_coarse;
+      Vector<number>               no_scaling;
+
+      mutable std::vector<Vector<double> > level_rhs;
+      mutable std::vector<Vector<double> > level_solution;
+      mutable std::vector<Vector<double> > level_residual;
+    };
+
+  template <typename number>
+    PreconditionSmoothedAggregation<number>::AdditionalData::
+    AdditionalData (const double       strong_threshold,
+		    const unsigned int n_smoothing_steps,
+		    const double       smoother_relaxation,
+		    const unsigned int max_coarse_size,
+		    const unsigned int max_levels,
+		    const unsigned int max_direct_coarse_size)
+    :
+    strong_threshold    (strong_threshold),
+    n_smoothing_steps   (n_smoothing_steps),
+    smoother_relaxation (smoother_relaxation),
+    max_coarse_size     (max_coarse_size),
+    max_levels          (max_levels),
+    max_direct_coarse_size (max_direct_coarse_size)
+    {}
+
+  template <typename number>
+    void PreconditionSmoothedAggregation<number>::clear ()
+    {
+      fine_matrix=0;
+      prolongation.clear();
+      prolongation_sparsity.clear();
+      products.clear();
+      product_sparsity.clear();
+      coarse_matrices.clear();
+      coarse_sparsity.clear();
+      inverse_diagonal.clear();
+      coarse_factor.reinit(0,0);
+      direct_coarse=false;
+      level_rhs.clear();
+      level_solution.clear();
+      level_residual.clear();
+    }
+
+  template <typename number>
+    unsigned int PreconditionSmoothedAggregation<number>::n_levels () const
+    {
+      return level_rhs.size();
+    }
+
+  template <typename number>
+    unsigned int PreconditionSmoothedAggregation<number>::coarse_size () const
+    {
+      return (n_levels()==0 ? 0 : level_rhs.back().size());
+    }
+
+  template <typename number>
+    bool PreconditionSmoothedAggregation<number>::direct_coarse_solve () const
+    {
+      return direct_coarse;
+    }
+
+  template <typename number>
+    const SparseMatrix<number> &
+    PreconditionSmoothedAggregation<number>::level_matrix (const unsigned int level) const
+    {
+      if (level==0)
+	return *fine_matrix;
+      else
+	return *coarse_matrices[level];
+    }
+
+  template <typename number>
+    unsigned int
+    PreconditionSmoothedAggregation<number>::aggregate (const SparseMatrix<number> &matrix,
+							std::vector<unsigned int>  &aggregate_of) const
+    {
+      const unsigned int n=matrix.m();
+      const unsigned int unassigned=numbers::invalid_unsigned_int;
+      /*
+       * Strong connections are those with |a_ij| >= threshold*sqrt(|a_ii a_jj|).
+       * Nodes without strong connections (e.g. Dirichlet rows after the
+       * boundary values have been applied) are not aggregated at all. Their
+       * prolongator row is zero and the smoother deals with them exactly.
+       * */
+      std::vector<std::vector<unsigned int> > strong_neighbours(n);
+      for (unsigned int i=0; i<n; ++i)
+	{
+	  const double a_ii=std::fabs(matrix.diag_element(i));
+	  for (typename SparseMatrix<number>::const_iterator entry=matrix.begin(i);
+	       entry!=matrix.end(i); ++entry)
+	    if (entry->column()!=i &&
+		std::fabs(entry->value())>=
+		data.strong_threshold*std::sqrt(a_ii*std::fabs(matrix.diag_element(entry->column()))))
+	      strong_neighbours[i].push_back(entry->column());
+	}
+
+      aggregate_of.assign(n,unassigned);
+      unsigned int n_aggregates=0;
+      /*
+       * First pass: a node whose strong neighbourhood is still completely
+       * free becomes the root of a new aggregate.
+       * */
+      for (unsigned int i=0; i<n; ++i)
+	{
+	  if (aggregate_of[i]!=unassigned || strong_neighbours[i].size()==0)
+	    continue;
+	  bool free_neighbourhood=true;
+	  for (unsigned int k=0; k<strong_neighbours[i].size(); ++k)
+	    if (aggregate_of[strong_neighbours[i][k]]!=unassigned)
+	      {
+		free_neighbourhood=false;
+		break;
+	      }
+	  if (free_neighbourhood)
+	    {
+	      aggregate_of[i]=n_aggregates;
+	      for (unsigned int k=0; k<strong_neighbours[i].size(); ++k)
+		aggregate_of[strong_neighbours[i][k]]=n_aggregates;
+	      n_aggregates++;
+	    }
+	}
+      /*
+       * Second pass: remaining nodes join the aggregate of one of their
+       * strongly connected neighbours (the ones formed in the first pass).
+       * */
+      std::vector<unsigned int> first_pass(aggregate_of);
+      for (unsigned int i=0; i<n; ++i)
+	if (aggregate_of[i]==unassigned)
+	  for (unsigned int k=0; k<strong_neighbours[i].size(); ++k)
+	    if (first_pass[strong_neighbours[i][k]]!=unassigned)
+	      {
+		aggregate_of[i]=first_pass[strong_neighbours[i][k]];
+		break;
+	      }
+      /*
+       * Third pass: whatever is left forms new aggregates with its free
+       * strong neighbours.
+       * */
+      for (unsigned int i=0; i<n; ++i)
+	if (aggregate_of[i]==unassigned && strong_neighbours[i].size()!=0)
+	  {
+	    aggregate_of[i]=n_aggregates;
+	    for (unsigned int k=0; k<strong_neighbours[i].size(); ++k)
+	      if (aggregate_of[strong_neighbours[i][k]]==unassigned)
+		aggregate_of[strong_neighbours[i][k]]=n_aggregates;
+	    n_aggregates++;
+	  }
+
+      return n_aggregates;
+    }
+
+  template <typename number>
+    void
+    PreconditionSmoothedAggregation<number>::build_prolongation (const unsigned int level,
+								 const std::vector<unsigned int> &aggregate_of,
+								 const unsigned int n_aggregates)
+    {
+      const SparseMatrix<number> &matrix=level_matrix(level);
+      const unsigned int n=matrix.m();
+      const unsigned int unassigned=numbers::invalid_unsigned_int;
+      /*
+       * Tentative prolongator: the (normalized) constant vector restricted
+       * to each aggregate.
+       * */
+      std::vector<unsigned int> aggregate_size(n_aggregates,0);
+      for (unsigned int i=0; i<n; ++i)
+	if (aggregate_of[i]!=unassigned)
+	  aggregate_size[aggregate_of[i]]++;
+
+      std::vector<double> tentative(n,0.);
+      for (unsigned int i=0; i<n; ++i)
+	if (aggregate_of[i]!=unassigned)
+	  tentative[i]=1./std::sqrt(1.*aggregate_size[aggregate_of[i]]);
+      /*
+       * Jacobi smoothing of the tentative prolongator,
+       *   P = (I - omega D^{-1} A) P_tent,  omega = (4/3)/rho(D^{-1} A),
+       * with the spectral radius estimated from Gershgorin's theorem.
+       * */
+      double spectral_radius=0.;
+      for (unsigned int i=0; i<n; ++i)
+	{
+	  double row_sum=0.;
+	  for (typename SparseMatrix<number>::const_iterator entry=matrix.begin(i);
+	       entry!=matrix.end(i); ++entry)
+	    row_sum+=std::fabs(entry->value());
+	  spectral_radius=std::max(spectral_radius,row_sum/std::fabs(matrix.diag_element(i)));
+	}
+      const double omega=(4./3.)/spectral_radius;
+
+      std::vector<std::map<unsigned int,double> > rows(n);
+      for (unsigned int i=0; i<n; ++i)
+	{
+	  const double scaling=omega/matrix.diag_element(i);
+	  if (aggregate_of[i]!=unassigned)
+	    rows[i][aggregate_of[i]]+=tentative[i];
+	  for (typename SparseMatrix<number>::const_iterator entry=matrix.begin(i);
+	       entry!=matrix.end(i); ++entry)
+	    if (aggregate_of[entry->column()]!=unassigned)
+	      rows[i][aggregate_of[entry->column()]]-=
+		scaling*entry->value()*tentative[entry->column()];
+	}
+
+      DynamicSparsityPattern dsp(n,n_aggregates);
+      for (unsigned int i=0; i<n; ++i)
+	for (std::map<unsigned int,double>::const_iterator it=rows[i].begin();
+	     it!=rows[i].end(); ++it)
+	  dsp.add(i,it->first);
+
+      prolongation_sparsity[level].reset(new SparsityPattern);
+      prolongation_sparsity[level]->copy_from(dsp);
+      prolongation[level].reset(new SparseMatrix<number>(*prolongation_sparsity[level]));
+      for (unsigned int i=0; i<n; ++i)
+	for (std::map<unsigned int,double>::const_iterator it=rows[i].begin();
+	     it!=rows[i].end(); ++it)
+	  prolongation[level]->set(i,it->first,it->second);
+    }
+
+  template <typename number>
+    void
+    PreconditionSmoothedAggregation<number>::galerkin_product (const unsigned int level,
+							       const bool build_sparsity)
+    {
+      /*
+       * A_{l} = P^T (A_{l-1} P). The sparsity patterns of the products are
+       * built by mmult() and Tmmult() when the hierarchy is created and
+       * kept afterwards. The values are then recomputed in place, entry
+       * by entry, since mmult() and Tmmult() allocate a work array on
+       * every call.
+       * */
+      const SparseMatrix<number> &matrix=level_matrix(level-1);
+      const SparseMatrix<number> &P     =*prolongation[level-1];
+      SparseMatrix<number>       &AP    =*products[level-1];
+      SparseMatrix<number>       &coarse=*coarse_matrices[level];
+      if (build_sparsity)
+	{
+	  matrix.mmult(AP,P,no_scaling,true);
+	  P.Tmmult(coarse,AP,no_scaling,true);
+	  return;
+	}
+
+      AP=0;
+      for (unsigned int i=0; i<matrix.m(); ++i)
+	for (typename SparseMatrix<number>::const_iterator entry=matrix.begin(i);
+	     entry!=matrix.end(i); ++entry)
+	  for (typename SparseMatrix<number>::const_iterator p=P.begin(entry->column());
+	       p!=P.end(entry->column()); ++p)
+	    AP.add(i,p->column(),entry->value()*p->value());
+      coarse=0;
+      for (unsigned int k=0; k<P.m(); ++k)
+	for (typename SparseMatrix<number>::const_iterator p=P.begin(k);
+	     p!=P.end(k); ++p)
+	  for (typename SparseMatrix<number>::const_iterator ap=AP.begin(k);
+	       ap!=AP.end(k); ++ap)
+	    coarse.add(p->column(),ap->column(),p->value()*ap->value());
+    }
+
+  template <typename number>
+    void PreconditionSmoothedAggregation<number>::setup_smoothers ()
+    {
+      inverse_diagonal.resize(n_levels());
+      for (unsigned int level=0; level<n_levels(); ++level)
+	{
+	  const SparseMatrix<number> &matrix=level_matrix(level);
+	  inverse_diagonal[level].reinit(matrix.m());
+	  for (unsigned int i=0; i<matrix.m(); ++i)
+	    inverse_diagonal[level](i)=1./matrix.diag_element(i);
+	}
+      if (!direct_coarse)
+	return;
+
+      /*
+       * Cholesky factorization of the coarsest matrix in place, in the
+       * lower triangle of coarse_factor.
+       * */
+      const SparseMatrix<number> &matrix=level_matrix(n_levels()-1);
+      const unsigned int n=matrix.m();
+      coarse_factor=0;
+      for (unsigned int i=0; i<n; ++i)
+	for (typename SparseMatrix<number>::const_iterator entry=matrix.begin(i);
+	     entry!=matrix.end(i); ++entry)
+	  if (entry->column()<=i)
+	    coarse_factor(i,entry->column())=entry->value();
+      for (unsigned int j=0; j<n; ++j)
+	{
+	  double diagonal=coarse_factor(j,j);
+	  for (unsigned int k=0; k<j; ++k)
+	    diagonal-=coarse_factor(j,k)*coarse_factor(j,k);
+	  if (!(diagonal>0.))
+	    {
+	      std::cout << "Error, the coarsest AMG matrix is not positive definite\n";
+	      throw 1;
+	    }
+	  coarse_factor(j,j)=std::sqrt(diagonal);
+	  for (unsigned int i=j+1; i<n; ++i)
+	    {
+	      double sum=coarse_factor(i,j);
+	      for (unsigned int k=0; k<j; ++k)
+		sum-=coarse_factor(i,k)*coarse_factor(j,k);
+	      coarse_factor(i,j)=sum/coarse_factor(j,j);
+	    }
+	}
+    }
+
+  template <typename number>
+    void PreconditionSmoothedAggregation<number>::coarse_solve () const
+    {
+      const unsigned int level=n_levels()-1;
+      Vector<double> &x=level_solution[level];
+      if (!direct_coarse)
+	{
+	  level_matrix(level).precondition_SSOR(x,level_rhs[level],1.2);
+	  return;
+	}
+
+      /*
+       * L y = b, then L^T x = y.
+       * */
+      const unsigned int n=x.size();
+      for (unsigned int i=0; i<n; ++i)
+	{
+	  double sum=level_rhs[level](i);
+	  for (unsigned int k=0; k<i; ++k)
+	    sum-=coarse_factor(i,k)*x(k);
+	  x(i)=sum/coarse_factor(i,i);
+	}
+      for (unsigned int i=n; i-->0; )
+	{
+	  x(i)/=coarse_factor(i,i);
+	  for (unsigned int k=0; k<i; ++k)
+	    x(k)-=coarse_factor(i,k)*x(i);
+	}
+    }
+
+  template <typename number>
+    void
+    PreconditionSmoothedAggregation<number>::initialize (const SparseMatrix<number> &matrix,
+							 const AdditionalData       &additional_data)
+    {
+      clear();
+      data=additional_data;
+      fine_matrix=&matrix;
+      /*
+       * Coarsen until the coarse problem is small enough to be inverted
+       * directly, or until aggregation stops making progress.
+       * */
+      unsigned int level=0;
+      level_rhs.push_back(Vector<double>(matrix.m()));
+      coarse_sparsity.push_back(std::unique_ptr<SparsityPattern>());
+      coarse_matrices.push_back(std::unique_ptr<SparseMatrix<number> >());
+      while (level_matrix(level).m()>data.max_coarse_size &&
+	     level+1<data.max_levels)
+	{
+	  std::vector<unsigned int> aggregate_of;
+	  const unsigned int n_aggregates=
+	    aggregate(level_matrix(level),aggregate_of);
+	  if (n_aggregates==0 ||
+	      n_aggregates>=level_matrix(level).m())
+	    break;
+
+	  prolongation_sparsity.push_back(std::unique_ptr<SparsityPattern>());
+	  prolongation.push_back(std::unique_ptr<SparseMatrix<number> >());
+	  build_prolongation(level,aggregate_of,n_aggregates);
+	  product_sparsity.push_back(std::unique_ptr<SparsityPattern>(new SparsityPattern));
+	  products.push_back(std::unique_ptr<SparseMatrix<number> >
+			     (new SparseMatrix<number>(*product_sparsity.back())));
+
+	  coarse_sparsity.push_back(std::unique_ptr<SparsityPattern>(new SparsityPattern));
+	  coarse_matrices.push_back(std::unique_ptr<SparseMatrix<number> >
+				    (new SparseMatrix<number>(*coarse_sparsity.back())));
+	  level_rhs.push_back(Vector<double>(n_aggregates));
+	  level++;
+	  galerkin_product(level,true);
+	}
+      level_solution=level_rhs;
+      level_residual=level_rhs;
+      direct_coarse=(coarse_size()<=data.max_direct_coarse_size);
+      if (direct_coarse)
+	coarse_factor.reinit(coarse_size(),coarse_size());
+      setup_smoothers();
+    }
+
+  template <typename number>
+    void
+    PreconditionSmoothedAggregation<number>::reinit_values (const SparseMatrix<number> &matrix)
+    {
+      Assert (n_levels()>0, ExcNotInitialized());
+      Assert (matrix.m()==level_rhs[0].size(),
+	      ExcDimensionMismatch(matrix.m(),level_rhs[0].size()));
+      fine_matrix=&matrix;
+      for (unsigned int level=1; level<n_levels(); ++level)
+	galerkin_product(level,false);
+      setup_smoothers();
+    }
+
+  template <typename number>
+    void PreconditionSmoothedAggregation<number>::smooth (const unsigned int level) const
+    {
+      const SparseMatrix<number> &matrix=level_matrix(level);
+      Vector<double> &x=level_solution[level];
+      Vector<double> &r=level_residual[level];
+      for (unsigned int step=0; step<data.n_smoothing_steps; ++step)
+	{
+	  matrix.residual(r,x,level_rhs[level]);
+	  for (unsigned int i=0; i<x.size(); ++i)
+	    x(i)+=data.smoother_relaxation*inverse_diagonal[level](i)*r(i);
+	}
+    }
+
+  template <typename number>
+    void PreconditionSmoothedAggregation<number>::v_cycle (const unsigned int level) const
+    {
+      if (level==n_levels()-1)
+	{
+	  coarse_solve();
+	  return;
+	}
+      level_solution[level]=0;
+      smooth(level);
+
+      level_matrix(level).residual(level_residual[level],
+				   level_solution[level],
+				   level_rhs[level]);
+      prolongation[level]->Tvmult(level_rhs[level+1],level_residual[level]);
+      v_cycle(level+1);
+      prolongation[level]->vmult_add(level_solution[level],level_solution[level+1]);
+
+      smooth(level);
+    }
+
+  template <typename number>
+  template <typename somenumber>
+    void PreconditionSmoothedAggregation<number>::vmult (Vector<somenumber>       &dst,
+							 const Vector<somenumber> &src) const
+    {
+      /*
+       * The level vectors are always double, also for single precision
+       * matrices and vectors.
+       */
+      level_rhs[0]=src;
+      v_cycle(0);
+      dst=level_solution[0];
+    }
+}
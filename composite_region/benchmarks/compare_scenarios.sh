@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Compares the profiles of two benchmark scenarios that have already been
+# run by run_benchmark.sh in the same work dir.
+#
+#   compare_scenarios.sh <work dir> <scenario> <reference scenario>
+#
+# Prints the total and linear solve wall times and the linear iterations
+# of both runs, and the ratios scenario/reference.
+#
+
+if [ $# -ne 3 ]; then
+    echo "usage: $0 <work dir> <scenario> <reference scenario>"
+    exit 1
+fi
+
+work_dir=$1
+scenario=$2
+reference=$3
+
+# profile.json is written by Profiling::Profiler::write_json, one key per line
+json_value ()
+{
+    sed -n "s/^ *\"$2\": *\([-0-9.eE+]*\).*/\1/p" "$1" | head -n 1
+}
+
+section_time ()
+{
+    sed -n "s/.*\"name\": \"$2\".*\"wall_time\": *\([-0-9.eE+]*\).*/\1/p" "$1" | head -n 1
+}
+
+for s in "$scenario" "$reference"; do
+    if [ ! -f "$work_dir/$s/profile.json" ]; then
+	echo "Error, no profile.json for $s in $work_dir/$s. Run bench_$s first."
+	exit 1
+    fi
+done
+
+printf "%-24s %12s %14s %12s\n" "scenario" "wall time" "linear solve" "linear it"
+for s in "$scenario" "$reference"; do
+    profile=$work_dir/$s/profile.json
+    printf "%-24s %11ss %13ss %12s\n" "$s" \
+	"$(json_value "$profile" total_wall_time)" \
+	"$(section_time "$profile" "linear solve")" \
+	"$(json_value "$profile" "linear iterations")"
+done
+
+awk -v a="$(json_value "$work_dir/$scenario/profile.json" total_wall_time)" \
+    -v b="$(json_value "$work_dir/$reference/profile.json" total_wall_time)" \
+    -v la="$(section_time "$work_dir/$scenario/profile.json" "linear solve")" \
+    -v lb="$(section_time "$work_dir/$reference/profile.json" "linear solve")" \
+    -v s="$scenario" -v r="$reference" 'BEGIN {
+    if (b>0)
+	printf "%s/%s wall time:    %.3f\n", s, r, a/b;
+    if (lb>0)
+	printf "%s/%s linear solve: %.3f\n", s, r, la/lb;
+}'
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Spatial convergence and cost of the finite element degrees.
+#
+#   convergence_study.sh <mycode> <benchmarks source dir> <work dir> [dimension]
+#
+# Runs convergence.prm for finite element degrees 1, 2 and 3 over a range
+# of refinement levels, plus a reference run with degree 3 on a finer
+# mesh. All runs use the same time step, so the difference between a run
+# and the reference at the probes is the spatial error. Prints degree,
+# refinement level, number of dofs, max probe error (C) over all time
+# steps and wall time (s) as taken from profile.json. convergence.prm
+# writes the probes with 'output precision = 17', so the errors are not
+# limited by the output format.
+#
+
+if [ $# -lt 3 ] || [ $# -gt 4 ]; then
+    echo "usage: $0 <mycode> <benchmarks source dir> <work dir> [dimension]"
+    exit 1
+fi
+
+executable=$1
+source_dir=$2
+work_dir=$3/convergence
+dimension=${4:-1}
+n_probes=$(grep -c . "$source_dir/data/depths.txt")
+
+case $dimension in
+    1) levels="3 4 5 6 7 8"; reference_level=11 ;;
+    2) levels="2 3 4 5";     reference_level=7  ;;
+    *) echo "Error, convergence study only for dimension 1 or 2"; exit 1 ;;
+esac
+
+# run_case <degree> <refinement level>, output in $work_dir/p<degree>_r<level>
+run_case ()
+{
+    case_dir=$work_dir/p$1_r$2
+    rm -rf "$case_dir"
+    mkdir -p "$case_dir/output"
+    cp "$source_dir"/data/* "$case_dir"
+    sed -e "s/^\( *set dimension *=\) *[0-9]*/\1 $dimension/" \
+	-e "s/^\( *set refinement level *=\) *[0-9]*/\1 $2/" \
+	-e "s/^\( *set finite element degree *=\) *[0-9]*/\1 $1/" \
+	"$source_dir/convergence.prm" > "$case_dir/convergence.prm"
+    (cd "$case_dir" && "$executable" convergence.prm > log.txt 2>&1)
+    if [ $? -ne 0 ]; then
+	echo "Error, run p$1_r$2 failed. See $case_dir/log.txt"
+	exit 1
+    fi
+}
+
+json_value ()
+{
+    sed -n "s/^ *\"$2\": *\([-0-9.eE+]*\).*/\1/p" "$1/profile.json" | head -n 1
+}
+
+run_case 3 $reference_level
+reference=$work_dir/p3_r$reference_level/output_data.txt
+
+printf "%8s %8s %10s %14s %12s\n" "degree" "level" "dofs" "probe error" "wall time"
+for degree in 1 2 3; do
+    for level in $levels; do
+	run_case $degree $level
+	case_dir=$work_dir/p${degree}_r$level
+	# columns 1 and 2 are time step and time, then one per probe
+	error=$(paste "$case_dir/output_data.txt" "$reference" | awk \
+	    -v n="$n_probes" '{
+		columns=NF/2;
+		for (i=3; i<3+n; ++i) {
+		    e=$i-$(i+columns); if (e<0) e=-e;
+		    if (e>max) max=e;
+		}
+	    } END { printf "%.3e", max }')
+	printf "%8s %8s %10s %14s %11ss\n" "$degree" "$level" \
+	    "$(json_value "$case_dir" n_dofs)" "$error" \
+	    "$(json_value "$case_dir" total_wall_time)"
+    done
+done
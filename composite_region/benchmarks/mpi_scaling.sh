@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Strong scaling of the distributed memory code on a fixed problem.
+#
+#   mpi_scaling.sh <mycode_mpi> <benchmarks source dir> <work dir> [process counts]
+#
+# Runs mpi_scaling.prm (2D quiet column, refinement level 9) with each of
+# the process counts (default "1 2 4 8") and prints, from the TimerOutput
+# summary of each run, the total, assembly and solve wall times, the
+# speedup and the parallel efficiency with respect to the first count.
+# MPIEXEC overrides the launcher (default mpirun).
+#
+
+if [ $# -lt 3 ] || [ $# -gt 4 ]; then
+    echo "usage: $0 <mycode_mpi> <benchmarks source dir> <work dir> [process counts]"
+    exit 1
+fi
+
+executable=$1
+source_dir=$2
+work_dir=$3/mpi_scaling
+process_counts=${4:-"1 2 4 8"}
+mpiexec=${MPIEXEC:-mpirun}
+
+# TimerOutput prints "| Total wallclock time elapsed since start | 1.2s |"
+# and one "| section | calls | 1.2s | 40% |" line per section
+total_time ()
+{
+    sed -n 's/^| Total wallclock time elapsed since start *| *\([0-9.eE+-]*\)s.*/\1/p' "$1" | tail -n 1
+}
+
+section_time ()
+{
+    sed -n "s/^| $2 *| *[0-9]* *| *\([0-9.eE+-]*\)s.*/\1/p" "$1" | tail -n 1
+}
+
+printf "%10s %12s %12s %12s %10s %11s\n" \
+    "processes" "total (s)" "assembly (s)" "solve (s)" "speedup" "efficiency"
+reference_processes=
+reference_time=
+for n in $process_counts; do
+    case_dir=$work_dir/np_$n
+    rm -rf "$case_dir"
+    mkdir -p "$case_dir/output"
+    cp "$source_dir"/data/* "$case_dir"
+    cp "$source_dir/mpi_scaling.prm" "$case_dir"
+    (cd "$case_dir" && $mpiexec -np $n "$executable" mpi_scaling.prm > log.txt 2>&1)
+    if [ $? -ne 0 ]; then
+	echo "Error, run with $n processes failed. See $case_dir/log.txt"
+	exit 1
+    fi
+    total=$(total_time "$case_dir/log.txt")
+    if [ -z "$total" ]; then
+	echo "Error, no timer summary in $case_dir/log.txt"
+	exit 1
+    fi
+    if [ -z "$reference_time" ]; then
+	reference_processes=$n
+	reference_time=$total
+    fi
+    awk -v n="$n" -v t="$total" -v a="$(section_time "$case_dir/log.txt" assembly)" \
+	-v s="$(section_time "$case_dir/log.txt" solve)" \
+	-v n0="$reference_processes" -v t0="$reference_time" '
+	BEGIN {
+	    speedup=t0/t;
+	    printf "%10d %12.3f %12.3f %12.3f %10.2f %10.0f%%\n",
+		n, t, a, s, speedup, 100.*speedup*n0/n;
+	}'
+done
@@ -0,0 +1,108 @@
+#!/bin/sh
+#
+# Runs a single benchmark scenario and compares it against the stored
+# baseline.
+#
+#   run_benchmark.sh <mycode> <benchmarks source dir> <work dir> <scenario>
+#
+# The scenario is run from <work dir>/<scenario> with a copy of the data
+# files, output to terminal and vtu files disabled. Wall time, number of
+# time steps and number of degrees of freedom are taken from the profiling
+# file written by mycode (profile.json).
+#
+# Environment:
+#   UPDATE_BASELINE=1       store the measured values in baseline.txt
+#   BENCHMARK_TOLERANCE=x   allowed relative slow down (default 0.10)
+#
+# Baselines depend on the machine. A scenario without a stored baseline is
+# reported as not compared, and the run does not fail.
+#
+
+if [ $# -ne 4 ]; then
+    echo "usage: $0 <mycode> <benchmarks source dir> <work dir> <scenario>"
+    exit 1
+fi
+
+executable=$1
+source_dir=$2
+work_dir=$3/$4
+scenario=$4
+baseline=$source_dir/baseline.txt
+tolerance=${BENCHMARK_TOLERANCE:-0.10}
+
+if [ ! -f "$source_dir/$scenario.prm" ]; then
+    echo "Error, unknown benchmark scenario $scenario"
+    exit 1
+fi
+
+rm -rf "$work_dir"
+mkdir -p "$work_dir/output"
+cp "$source_dir"/data/* "$work_dir"
+cp "$source_dir/$scenario.prm" "$work_dir"
+
+cd "$work_dir" || exit 1
+if ! "$executable" "$scenario.prm" > log.txt 2>&1; then
+    echo "Error, benchmark $scenario failed. See $work_dir/log.txt"
+    exit 1
+fi
+
+# profile.json is written by Profiling::Profiler::write_json, one key per line
+json_value ()
+{
+    sed -n "s/^ *\"$1\": *\([-0-9.eE+]*\).*/\1/p" profile.json | head -n 1
+}
+
+wall_time=$(json_value total_wall_time)
+n_dofs=$(json_value n_dofs)
+n_steps=$(json_value "time steps")
+n_picard=$(json_value "picard iterations")
+
+if [ -z "$wall_time" ] || [ -z "$n_dofs" ] || [ -z "$n_steps" ]; then
+    echo "Error, could not read profile.json for benchmark $scenario"
+    exit 1
+fi
+
+steps_per_second=$(awk -v s="$n_steps" -v t="$wall_time" \
+    'BEGIN { printf "%.4g", (t>0 ? s/t : 0) }')
+dof_steps_per_second=$(awk -v d="$n_dofs" -v s="$n_steps" -v t="$wall_time" \
+    'BEGIN { printf "%.4g", (t>0 ? d*s/t : 0) }')
+
+printf "%-20s %10s %12s %10s %12s %14s %16s\n" \
+    "scenario" "dofs" "time steps" "picard" "wall time" "steps/s" "dofs*steps/s"
+printf "%-20s %10s %12s %10s %11ss %14s %16s\n" \
+    "$scenario" "$n_dofs" "$n_steps" "$n_picard" "$wall_time" \
+    "$steps_per_second" "$dof_steps_per_second"
+
+if [ "$UPDATE_BASELINE" = "1" ]; then
+    tmp=$(mktemp)
+    grep -v "^$scenario[[:space:]]" "$baseline" > "$tmp"
+    printf "%s\t%s\t%s\t%s\t%s\n" \
+	"$scenario" "$n_dofs" "$n_steps" "$wall_time" "$steps_per_second" >> "$tmp"
+    mv "$tmp" "$baseline"
+    echo "Baseline for $scenario updated"
+    exit 0
+fi
+
+reference=$(awk -v s="$scenario" '$1==s { print $5 }' "$baseline")
+if [ -z "$reference" ]; then
+    echo "Warning, no baseline stored for $scenario in $baseline, not compared."
+    echo "Record one on the reference machine with UPDATE_BASELINE=1."
+    exit 0
+fi
+
+reference_dofs=$(awk -v s="$scenario" '$1==s { print $2 }' "$baseline")
+reference_steps=$(awk -v s="$scenario" '$1==s { print $3 }' "$baseline")
+if [ "$reference_dofs" != "$n_dofs" ] || [ "$reference_steps" != "$n_steps" ]; then
+    echo "Warning, baseline for $scenario was recorded with" \
+	 "$reference_dofs dofs and $reference_steps time steps"
+fi
+
+awk -v s="$scenario" -v new="$steps_per_second" -v old="$reference" \
+    -v tol="$tolerance" 'BEGIN {
+    speedup=new/old;
+    printf "%s: %.3fx baseline (%s steps/s)\n", s, speedup, old;
+    if (speedup < 1.-tol) {
+	printf "Error, %s is slower than the baseline\n", s;
+	exit 1;
+    }
+}'
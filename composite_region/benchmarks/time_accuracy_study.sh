@@ -0,0 +1,102 @@
+#!/bin/sh
+#
+# Accuracy in time of the integrators at matched cost and matched accuracy.
+#
+#   time_accuracy_study.sh <mycode> <benchmarks source dir> <work dir> [tolerance]
+#
+# Runs time_accuracy.prm (one day of a daily surface temperature cycle, the
+# same mesh and forcing for every run) with backward Euler (theta 1),
+# Crank-Nicolson (theta 0.5), bdf2 and sdirk2 over a range of time steps,
+# plus a reference run with sdirk2 and a 45 s step. The difference to the
+# reference at the probes, at the times of each run, is the time error.
+# Prints integrator, time step (s), number of steps, max probe error (C),
+# Picard iterations and wall time (s) as taken from profile.json. Then,
+# for each integrator, the largest time step tried whose error is below
+# 'tolerance' (C, default 0.01) and the number of steps it needs.
+#
+
+if [ $# -lt 3 ] || [ $# -gt 4 ]; then
+    echo "usage: $0 <mycode> <benchmarks source dir> <work dir> [tolerance]"
+    exit 1
+fi
+
+executable=$1
+source_dir=$2
+work_dir=$3/time_accuracy
+tolerance=${4:-0.01}
+n_probes=$(grep -c . "$source_dir/data/depths.txt")
+period=86400
+time_steps="90 180 360 720 1440 2880"
+integrators="backward_euler crank_nicolson bdf2 sdirk2"
+
+# run_case <integrator> <time step>, output in $work_dir/<integrator>_<time step>
+run_case ()
+{
+    case $1 in
+	backward_euler) integrator=theta;  theta=1.0 ;;
+	crank_nicolson) integrator=theta;  theta=0.5 ;;
+	*)              integrator=$1;     theta=1.0 ;;
+    esac
+    case_dir=$work_dir/$1_$2
+    rm -rf "$case_dir"
+    mkdir -p "$case_dir/output"
+    cp "$source_dir"/data/* "$case_dir"
+    sed -e "s/^\( *set time step *=\) *[0-9.]*/\1 $2/" \
+	-e "s/^\( *set timestep number max *=\) *[0-9]*/\1 $((period/$2))/" \
+	-e "s/^\( *set theta scheme value *=\) *[0-9.]*/\1 $theta/" \
+	-e "s/^\( *set time integrator *=\) *[a-z0-9]*/\1 $integrator/" \
+	"$source_dir/time_accuracy.prm" > "$case_dir/time_accuracy.prm"
+    (cd "$case_dir" && "$executable" time_accuracy.prm > log.txt 2>&1)
+    if [ $? -ne 0 ]; then
+	echo "Error, run $1_$2 failed. See $case_dir/log.txt"
+	exit 1
+    fi
+}
+
+json_value ()
+{
+    sed -n "s/^ *\"$2\": *\([-0-9.eE+]*\).*/\1/p" "$1/profile.json" | head -n 1
+}
+
+run_case sdirk2 45
+reference=$work_dir/sdirk2_45/output_data.txt
+summary=$work_dir/summary.txt
+: > "$summary"
+
+printf "%16s %10s %8s %14s %8s %12s\n" \
+    "integrator" "time step" "steps" "probe error" "picard" "wall time"
+for integrator in $integrators; do
+    for time_step in $time_steps; do
+	run_case $integrator $time_step
+	case_dir=$work_dir/${integrator}_$time_step
+	# columns 1 and 2 are time step and time, then one per probe. The
+	# reference lines are looked up by time.
+	error=$(awk -v n="$n_probes" '
+	    NR==FNR { for (i=3; i<3+n; ++i) value[$2,i]=$i; next }
+	    ($2,3) in value {
+		for (i=3; i<3+n; ++i) {
+		    e=$i-value[$2,i]; if (e<0) e=-e;
+		    if (e>max) max=e;
+		}
+	    } END { printf "%.3e", max }' "$reference" "$case_dir/output_data.txt")
+	n_steps=$((period/time_step))
+	printf "%16s %10s %8s %14s %8s %11ss\n" "$integrator" "$time_step" \
+	    "$n_steps" "$error" \
+	    "$(json_value "$case_dir" "picard iterations")" \
+	    "$(json_value "$case_dir" total_wall_time)"
+	echo "$integrator $time_step $n_steps $error" >> "$summary"
+    done
+done
+
+echo
+echo "Largest time step with a probe error below $tolerance C:"
+for integrator in $integrators; do
+    awk -v s="$integrator" -v tol="$tolerance" '
+	$1==s && $4+0<=tol+0 && $2+0>best { best=$2; steps=$3 }
+	END {
+	    if (best>0)
+		printf "%16s %10s s %8s steps\n", s, best, steps;
+	    else
+		printf "%16s %10s\n", s, "none";
+	}' "$summary"
+done
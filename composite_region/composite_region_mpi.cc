@@ -0,0 +1,1067 @@
+#include <deal.II/base/parameter_handler.h>
+#include <deal.II/base/conditional_ostream.h>
+#include <deal.II/base/index_set.h>
+#include <deal.II/base/mpi.h>
+#include <deal.II/base/timer.h>
+#include <deal.II/base/utilities.h>
+
+#include <deal.II/dofs/dof_handler.h>
+#include <deal.II/dofs/dof_tools.h>
+
+#include <deal.II/fe/fe_q.h>
+#include <deal.II/fe/fe_values.h>
+#include <deal.II/fe/mapping_q1.h>
+
+#include <deal.II/grid/tria.h>
+#include <deal.II/grid/grid_generator.h>
+
+#include <deal.II/distributed/tria.h>
+
+#include <deal.II/lac/constraint_matrix.h>
+#include <deal.II/lac/dynamic_sparsity_pattern.h>
+#include <deal.II/lac/full_matrix.h>
+#include <deal.II/lac/sparsity_tools.h>
+#include <deal.II/lac/vector.h>
+#include <deal.II/lac/trilinos_precondition.h>
+#include <deal.II/lac/trilinos_solver.h>
+#include <deal.II/lac/trilinos_sparse_matrix.h>
+#include <deal.II/lac/trilinos_vector.h>
+
+#include <deal.II/numerics/vector_tools.h>
+#include <deal.II/numerics/data_out.h>
+
+#include <PorousMaterial.h>
+#include <DataTools.h>
+#include <Names.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <tuple>
+
+namespace TRL
+{
+  using namespace dealii;
+#include "InitialValue.h"
+#include "VerticalProfile.h"
+#include "parameters.h"
+#include "ForcingSeries.h"
+#include "ColumnPhysics.h"
+
+  /*
+   * Distributed memory version of Heat_Pipe for 2D and 3D problems (deal.II
+   * does not provide distributed triangulations in 1D). The physics (layer
+   * materials, forcing, cell and face integrals) is the one of the serial
+   * code, shared through ColumnPhysics, as are the parameter file and the
+   * output format. The mesh is a parallel::distributed::Triangulation, and
+   * vectors and matrices are Trilinos objects distributed over the
+   * processes.
+   *
+   * The constraints hold the hanging nodes and the Dirichlet boundary
+   * values, which are eliminated during assembly. Integral quantities
+   * (thermal energy stored in the domain, heat rates through the
+   * boundaries, of the point sources and of the heat losses) and the
+   * temperatures at the probes are reduced over all processes and written
+   * by process 0.
+   */
+  template <int dim>
+  class Heat_Pipe_MPI
+  {
+  public:
+    Heat_Pipe_MPI(int argc, char *argv[]);
+    ~Heat_Pipe_MPI();
+    void run();
+
+  private:
+    static Parameters::AllParameters<dim> read_parameters(int argc, char *argv[]);
+
+    void read_grid_temperature();
+    void setup_system_temperature();
+    void setup_boundary_constraints();
+    void update_boundary_values();
+    void assemble_system_temperature();
+    template <TopBoundaryCondition top_condition>
+    void assemble_system_temperature();
+    unsigned int solve_temperature();
+    void initial_condition_temperature();
+
+    void output_results ();
+    void fill_output_vectors();
+    void compute_diagnostics();
+    double total_thermal_energy(const TrilinosWrappers::MPI::Vector &temperature) const;
+    void update_met_data ();
+
+    bool locate_point(const Point<dim> &p,
+		      std::vector<std::pair<types::global_dof_index,double> > &weights);
+
+    MPI_Comm mpi_communicator;
+    ConditionalOStream pcout;
+    TimerOutput computing_timer;
+
+    Parameters::AllParameters<dim>  parameters;
+
+    parallel::distributed::Triangulation<dim> triangulation;
+    DoFHandler<dim>      dof_handler;
+    FE_Q<dim>            fe;
+    QGauss<dim>          quadrature_formula;
+    QGauss<dim-1>        face_quadrature_formula;
+
+    IndexSet locally_owned_dofs;
+    IndexSet locally_relevant_dofs;
+
+    ConstraintMatrix constraints;
+    /*
+     * Locally relevant dofs on the top boundary that carry a Dirichlet
+     * constraint (first type top condition only). Their values are the
+     * only part of the constraints that changes from one step to the next.
+     */
+    std::vector<types::global_dof_index> top_boundary_dofs;
+
+    TrilinosWrappers::SparseMatrix system_matrix;
+    TrilinosWrappers::MPI::Vector  system_rhs;
+    TrilinosWrappers::MPI::Vector  distributed_solution;
+    TrilinosWrappers::MPI::Vector  solution;
+    TrilinosWrappers::MPI::Vector  old_solution;
+    /*
+     * The AMG hierarchy is built from the matrix of one Picard iteration
+     * and kept while it works: it is rebuilt when a solve needs more than
+     * twice the CG iterations of the first solve after the last build.
+     */
+    TrilinosWrappers::PreconditionAMG preconditioner;
+    bool                              preconditioner_valid;
+    unsigned int                      preconditioner_reference_iterations;
+
+    unsigned int timestep_number_max;
+    unsigned int timestep_number;
+    double       time;
+    double       time_step;
+    double       theta_temperature;
+
+    TopBoundaryCondition top_boundary_condition;
+    ColumnPhysics<dim>   physics;
+
+    std::vector< std::vector<double> > depths_coordinates;
+    /*
+     * For each probe (and for each point source) the process that owns the
+     * point stores the (dof, shape value) pairs needed to evaluate (or
+     * apply) it. The other processes store empty lists.
+     */
+    std::vector<std::vector<std::pair<types::global_dof_index,double> > > probe_weights;
+    std::vector<std::vector<std::pair<types::global_dof_index,double> > > point_source_weights;
+
+    double old_room_temperature, new_room_temperature;
+    double old_surface_temperature, new_surface_temperature;
+    std::vector<double> old_point_source_magnitudes, new_point_source_magnitudes;
+    /*
+     * Energy balance of the last step, as in the serial code.
+     */
+    double column_thermal_energy;
+    double old_column_thermal_energy;
+    double heat_flux_top;
+    double heat_flux_bottom;
+    double heat_flux_lateral;
+    double point_source_rate;
+    double heat_loss_rate;
+    double energy_balance_error;
+
+    std::ofstream output_file;
+  };
+
+  template <int dim>
+  Parameters::AllParameters<dim>
+  Heat_Pipe_MPI<dim>::read_parameters(int argc, char *argv[])
+  {
+    ConditionalOStream pcout (std::cout,
+			      (Utilities::MPI::this_mpi_process(MPI_COMM_WORLD)==0));
+    if (argc!=2)
+      {
+	pcout << "Wrong number of input arguments.\n"
+	      << "Number of arguments passed: " << argc << "\n"
+	      << "Number of arguments expected: 2\n"
+	      << "Missing input file?\n" << std::endl;
+	throw 1;
+      }
+
+    const std::string input_filename = argv[1];
+    pcout << "parameter file: " << input_filename << "\n"
+	  << "number of MPI processes: "
+	  << Utilities::MPI::n_mpi_processes(MPI_COMM_WORLD) << "\n";
+
+    ParameterHandler prm;
+    Parameters::AllParameters<dim>::declare_parameters (prm);
+
+    std::ifstream inFile;
+    inFile.open(input_filename.c_str());
+    prm.parse_input(inFile,input_filename);
+
+    Parameters::AllParameters<dim> parameters;
+    parameters.parse_parameters (prm);
+    return parameters;
+  }
+
+  /*
+   * The finite element and the quadrature depend on the parameters, so the
+   * parameter file is read before anything else is constructed.
+   */
+  template<int dim>
+  Heat_Pipe_MPI<dim>::Heat_Pipe_MPI(int argc, char *argv[])
+    :
+    mpi_communicator (MPI_COMM_WORLD),
+    pcout (std::cout,
+	   (Utilities::MPI::this_mpi_process(mpi_communicator)==0)),
+    computing_timer (mpi_communicator,
+		     pcout,
+		     TimerOutput::summary,
+		     TimerOutput::wall_times),
+    parameters (read_parameters(argc,argv)),
+    triangulation (mpi_communicator,
+		   typename Triangulation<dim>::MeshSmoothing
+		   (Triangulation<dim>::smoothing_on_refinement |
+		    Triangulation<dim>::smoothing_on_coarsening)),
+    dof_handler(triangulation),
+    fe(parameters.fe_degree),
+    quadrature_formula(parameters.fe_degree+2),
+    face_quadrature_formula(parameters.fe_degree+2),
+    preconditioner_valid(false),
+    preconditioner_reference_iterations(0)
+  {
+    theta_temperature   = parameters.theta;
+    timestep_number_max = parameters.timestep_number_max;
+    time_step           = parameters.time_step;
+
+    top_boundary_condition=
+      top_boundary_condition_type(parameters.boundary_condition_top);
+    physics.reinit (parameters,
+		    (Utilities::MPI::this_mpi_process(mpi_communicator)==0 ?
+		     &std::cout : 0));
+
+    std::vector< std::string > filenames;
+    filenames.push_back(parameters.depths_file);
+
+    DataTools data_tools;
+    data_tools.read_data (filenames,
+			  depths_coordinates);
+
+    pcout << "Available depth coordinate entries: "
+	  << depths_coordinates.size() << std::endl;
+
+    if (Utilities::MPI::this_mpi_process(mpi_communicator)==0)
+      {
+	std::string output_filename=parameters.output_file;
+	remove(output_filename.c_str());
+	output_file.open(output_filename.c_str(),std::ios::app);
+	if (!output_file.is_open())
+	  {
+	    std::cout << "Error opening output data file\n";
+	    throw 1;
+	  }
+      }
+
+    old_room_temperature       = 0.;
+    new_room_temperature       = 0.;
+    old_surface_temperature    = 0.;
+    new_surface_temperature    = 0.;
+    old_point_source_magnitudes.assign(parameters.point_source_depths.size(),0.);
+    new_point_source_magnitudes.assign(parameters.point_source_depths.size(),0.);
+    time=0.;
+    timestep_number=0;
+    column_thermal_energy    =0.;
+    old_column_thermal_energy=0.;
+    heat_flux_top            =0.;
+    heat_flux_bottom         =0.;
+    heat_flux_lateral        =0.;
+    point_source_rate        =0.;
+    heat_loss_rate           =0.;
+    energy_balance_error     =0.;
+  }
+
+  template<int dim>
+  Heat_Pipe_MPI<dim>::~Heat_Pipe_MPI ()
+  {
+    dof_handler.clear ();
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::read_grid_temperature()
+  {
+    TimerOutput::Scope t(computing_timer, "mesh setup");
+
+    Point<dim> bottom_corner;
+    Point<dim> top_corner;
+    std::vector<unsigned int> repetitions(dim,1);
+    const double coarse_cell_size=
+      std::min(parameters.domain_width,parameters.domain_size);
+    for (unsigned int d=0; d<dim-1; ++d)
+      {
+	bottom_corner[d]=-0.5*parameters.domain_width;
+	top_corner[d]   = 0.5*parameters.domain_width;
+	repetitions[d]  =
+	  std::max(1,(int)std::floor(parameters.domain_width/coarse_cell_size+0.5));
+      }
+    bottom_corner[dim-1]=-1.*parameters.domain_size;
+    top_corner[dim-1]   = 0.;
+    repetitions[dim-1]  =
+      std::max(1,(int)std::floor(parameters.domain_size/coarse_cell_size+0.5));
+
+    GridGenerator::subdivided_hyper_rectangle (triangulation,repetitions,
+					       bottom_corner,top_corner);
+    /*
+     * Boundary indicators are set on the coarse mesh, before it is
+     * distributed, and inherited by the refined cells.
+     */
+    const double tolerance=1.E-8*parameters.domain_size;
+    typename Triangulation<dim>::active_cell_iterator
+      cell = triangulation.begin_active(),
+      endc = triangulation.end();
+    for (; cell!=endc; ++cell)
+      for (unsigned int face=0; face<GeometryInfo<dim>::faces_per_cell; ++face)
+	if (cell->face(face)->at_boundary())
+	  {
+	    const double z=cell->face(face)->center()[dim-1];
+	    if (std::fabs(z)<tolerance)
+	      cell->face(face)->set_boundary_id(top_boundary_id);
+	    else if (std::fabs(z+parameters.domain_size)<tolerance)
+	      cell->face(face)->set_boundary_id(bottom_boundary_id);
+	    else
+	      cell->face(face)->set_boundary_id(lateral_boundary_id);
+	  }
+
+    triangulation.refine_global (parameters.refinement_level);
+    dof_handler.distribute_dofs (fe);
+
+    pcout << "\tNumber of active cells: "
+	  << triangulation.n_global_active_cells() << "\n"
+	  << "\tNumber of degrees of freedom: "
+	  << dof_handler.n_dofs() << "\n";
+  }
+
+  template <int dim>
+  bool Heat_Pipe_MPI<dim>::locate_point(const Point<dim> &p,
+					std::vector<std::pair<types::global_dof_index,double> > &weights)
+  {
+    /*
+     * Find the locally owned cell that contains the point p and store the
+     * values of the shape functions at p. A point on the interface between
+     * two subdomains is assigned to the process with the lowest rank, so
+     * that every point is evaluated (or applied) exactly once.
+     */
+    weights.clear();
+    const unsigned int this_process=
+      Utilities::MPI::this_mpi_process(mpi_communicator);
+    const unsigned int n_processes=
+      Utilities::MPI::n_mpi_processes(mpi_communicator);
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end(),
+      found= dof_handler.end();
+    for (; cell!=endc; ++cell)
+      if (cell->is_locally_owned() && cell->point_inside(p))
+	{
+	  found=cell;
+	  break;
+	}
+
+    const unsigned int owner=
+      Utilities::MPI::min((found!=endc ? this_process : n_processes),
+			  mpi_communicator);
+    if (owner==n_processes)
+      return false;
+
+    if (owner==this_process)
+      {
+	const Point<dim> unit_point=
+	  StaticMappingQ1<dim>::mapping.transform_real_to_unit_cell(found,p);
+	std::vector<types::global_dof_index> local_dof_indices (fe.dofs_per_cell);
+	found->get_dof_indices(local_dof_indices);
+	for (unsigned int i=0; i<fe.dofs_per_cell; ++i)
+	  weights.push_back(std::make_pair(local_dof_indices[i],
+					   fe.shape_value(i,unit_point)));
+      }
+    return true;
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::setup_system_temperature()
+  {
+    TimerOutput::Scope t(computing_timer, "setup");
+
+    locally_owned_dofs = dof_handler.locally_owned_dofs ();
+    DoFTools::extract_locally_relevant_dofs (dof_handler,
+					     locally_relevant_dofs);
+
+    solution.reinit (locally_owned_dofs, locally_relevant_dofs, mpi_communicator);
+    old_solution.reinit (locally_owned_dofs, locally_relevant_dofs, mpi_communicator);
+    system_rhs.reinit (locally_owned_dofs, mpi_communicator);
+    distributed_solution.reinit (locally_owned_dofs, mpi_communicator);
+    /*
+     * The structure of the constraints (hanging nodes and Dirichlet nodes)
+     * does not change during the run, only the boundary values do. The
+     * sparsity pattern is therefore built once.
+     */
+    setup_boundary_constraints();
+
+    DynamicSparsityPattern dsp (locally_relevant_dofs);
+    DoFTools::make_sparsity_pattern (dof_handler, dsp,
+				     constraints, false);
+    SparsityTools::distribute_sparsity_pattern (dsp,
+						dof_handler.n_locally_owned_dofs_per_processor(),
+						mpi_communicator,
+						locally_relevant_dofs);
+    system_matrix.reinit (locally_owned_dofs,
+			  locally_owned_dofs,
+			  dsp,
+			  mpi_communicator);
+
+    probe_weights.resize(depths_coordinates.size());
+    for (unsigned int i=0; i<depths_coordinates.size(); i++)
+      {
+	Point<dim> p;
+	for (unsigned int d=0; d<dim-1; ++d)
+	  p[d]=depths_coordinates[i][d];
+	p[dim-1]=-1.*depths_coordinates[i][2];
+	if (!locate_point(p,probe_weights[i]))
+	  pcout << "\tWarning, probe " << i << " is outside the domain\n";
+      }
+
+    point_source_weights.clear();
+    if (parameters.point_source==true)
+      {
+	point_source_weights.resize(parameters.point_source_depths.size());
+	for (unsigned int s=0; s<parameters.point_source_depths.size(); ++s)
+	  {
+	    Point<dim> p;
+	    p[dim-1]=-1.*parameters.point_source_depths[s];
+	    if (!locate_point(p,point_source_weights[s]))
+	      pcout << "\tWarning, point source " << s << " is outside the domain\n";
+	  }
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::setup_boundary_constraints()
+  {
+    constraints.clear ();
+    constraints.reinit (locally_relevant_dofs);
+    DoFTools::make_hanging_node_constraints (dof_handler,
+					     constraints);
+    if (parameters.fixed_at_bottom)
+      VectorTools::interpolate_boundary_values (dof_handler,
+						bottom_boundary_id,
+						ConstantFunction<dim>(parameters.bottom_fixed_value),
+						constraints);
+    /*
+     * The top values are set every step by update_boundary_values, here
+     * only the constraint lines are added. Dofs already constrained as
+     * hanging nodes keep their hanging node constraint and are left out.
+     */
+    top_boundary_dofs.clear();
+    if (top_boundary_condition==first_type_top)
+      {
+	std::set<types::boundary_id> top_boundary;
+	top_boundary.insert(top_boundary_id);
+	IndexSet top_dofs;
+	DoFTools::extract_boundary_dofs (dof_handler,
+					 ComponentMask(),
+					 top_dofs,
+					 top_boundary);
+	for (IndexSet::ElementIterator dof=top_dofs.begin();
+	     dof!=top_dofs.end(); ++dof)
+	  if (locally_relevant_dofs.is_element(*dof) &&
+	      !constraints.is_constrained(*dof))
+	    {
+	      constraints.add_line(*dof);
+	      top_boundary_dofs.push_back(*dof);
+	    }
+      }
+    constraints.close ();
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::update_boundary_values()
+  {
+    /*
+     * The mesh is only refined globally, so no other constraint depends on
+     * a top boundary dof and close() has nothing to propagate: setting the
+     * inhomogeneities is enough.
+     */
+    const double top_value=
+      parameters.theta * new_surface_temperature +
+      (1-parameters.theta) * old_surface_temperature;
+    for (unsigned int i=0; i<top_boundary_dofs.size(); ++i)
+      constraints.set_inhomogeneity(top_boundary_dofs[i],top_value);
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::assemble_system_temperature()
+  {
+    switch (top_boundary_condition)
+      {
+      case first_type_top:
+	assemble_system_temperature<first_type_top>();
+	break;
+      case second_type_top:
+	assemble_system_temperature<second_type_top>();
+	break;
+      case third_type_top:
+	assemble_system_temperature<third_type_top>();
+	break;
+      }
+  }
+
+  template <int dim>
+  template <TopBoundaryCondition top_condition>
+  void Heat_Pipe_MPI<dim>::assemble_system_temperature()
+  {
+    TimerOutput::Scope t(computing_timer, "assembly");
+
+    system_matrix = 0;
+    system_rhs    = 0;
+
+    FEValues<dim> fe_values(fe, quadrature_formula,
+			    update_values | update_gradients |
+			    update_quadrature_points | update_JxW_values);
+    FEFaceValues<dim> fe_face_values(fe, face_quadrature_formula,
+				     update_values | update_quadrature_points |
+				     update_JxW_values);
+
+    const unsigned int dofs_per_cell   = fe.dofs_per_cell;
+    const unsigned int n_q_points      = quadrature_formula.size();
+
+    FullMatrix<double> cell_mass_matrix    (dofs_per_cell,dofs_per_cell);
+    FullMatrix<double> cell_laplace_matrix (dofs_per_cell,dofs_per_cell);
+    FullMatrix<double> cell_matrix         (dofs_per_cell,dofs_per_cell);
+    Vector<double>     cell_rhs            (dofs_per_cell);
+    Vector<double>     old_temperature_values (dofs_per_cell);
+
+    std::vector<types::global_dof_index> local_dof_indices (dofs_per_cell);
+    std::vector<double> old_function_values       (n_q_points);
+    std::vector<double> new_function_values       (n_q_points);
+    std::vector<double> average_cell_temperatures (n_q_points);
+    std::vector<double> thermal_conductivities    (n_q_points);
+    std::vector<double> heat_capacities           (n_q_points);
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      if (cell->is_locally_owned())
+	{
+	  cell_mass_matrix    = 0;
+	  cell_laplace_matrix = 0;
+	  cell_rhs            = 0;
+	  fe_values.reinit (cell);
+	  fe_values.get_function_values(old_solution,old_function_values);
+	  fe_values.get_function_values(    solution,new_function_values);
+	  cell->get_dof_values(old_solution,old_temperature_values);
+
+	  for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	    average_cell_temperatures[q_point]=
+	      (   theta_temperature)*new_function_values[q_point]+
+	      (1.-theta_temperature)*old_function_values[q_point];
+
+	  physics.template cell_terms<general_theta> (fe_values,cell->center()[dim-1],
+						      average_cell_temperatures,
+						      theta_temperature,time_step,
+						      old_room_temperature,new_room_temperature,
+						      true,
+						      thermal_conductivities,heat_capacities,
+						      cell_mass_matrix,cell_laplace_matrix,cell_rhs);
+
+	  for (unsigned int face=0; face<GeometryInfo<dim>::faces_per_cell; ++face)
+	    if (cell->face(face)->at_boundary())
+	      {
+		if (cell->face(face)->boundary_id()==top_boundary_id &&
+		    top_condition!=first_type_top)
+		  {
+		    fe_face_values.reinit (cell, face);
+		    physics.template top_face_terms<general_theta,top_condition>
+		    (fe_face_values,theta_temperature,time_step,
+		     old_surface_temperature,new_surface_temperature,
+		     cell_laplace_matrix,cell_rhs);
+		  }
+		else if (cell->face(face)->boundary_id()==lateral_boundary_id &&
+			 parameters.lateral_heat_transfer_coefficient>0.)
+		  {
+		    fe_face_values.reinit (cell, face);
+		    physics.template lateral_face_terms<general_theta>
+		    (fe_face_values,theta_temperature,time_step,
+		     old_room_temperature,new_room_temperature,
+		     cell_laplace_matrix,cell_rhs);
+		  }
+	      }
+	  /*
+	   * The explicit part of the theta scheme is computed cell-wise so
+	   * that matrix and right hand side can be condensed together with
+	   * the constraints.
+	   */
+	  physics.template theta_system<general_theta> (cell_mass_matrix,cell_laplace_matrix,
+							old_temperature_values,
+							theta_temperature,time_step,
+							cell_matrix,cell_rhs);
+
+	  cell->get_dof_indices (local_dof_indices);
+	  constraints.distribute_local_to_global (cell_matrix,
+						  cell_rhs,
+						  local_dof_indices,
+						  system_matrix,
+						  system_rhs);
+	}
+
+    /*
+     * The point sources go through the constraints like the cell
+     * contributions, so that a source in a cell with hanging nodes is
+     * distributed to the nodes those are constrained to.
+     */
+    std::vector<types::global_dof_index> source_dof_indices;
+    Vector<double>                       source_rhs;
+    for (unsigned int s=0; s<point_source_weights.size(); ++s)
+      {
+	const double magnitude=
+	  (old_point_source_magnitudes[s]*(1.-theta_temperature)*time_step
+	   +new_point_source_magnitudes[s]*(   theta_temperature)*time_step);
+	source_dof_indices.resize (point_source_weights[s].size());
+	source_rhs.reinit (point_source_weights[s].size());
+	for (unsigned int k=0; k<point_source_weights[s].size(); ++k)
+	  {
+	    source_dof_indices[k]=point_source_weights[s][k].first;
+	    source_rhs(k)=magnitude*point_source_weights[s][k].second;
+	  }
+	constraints.distribute_local_to_global (source_rhs,
+						source_dof_indices,
+						system_rhs);
+      }
+
+    system_matrix.compress (VectorOperation::add);
+    system_rhs.compress (VectorOperation::add);
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe_MPI<dim>::solve_temperature()
+  {
+    TimerOutput::Scope t(computing_timer, "solve");
+
+    /*
+     * The floor keeps the tolerance positive when the right hand side
+     * vanishes (e.g. a column at rest with homogeneous boundary values).
+     */
+    SolverControl solver_control (dof_handler.n_dofs(),
+				  std::max(1e-8*system_rhs.l2_norm (),1e-12));
+    TrilinosWrappers::SolverCG cg (solver_control);
+
+    /*
+     * The system matrix changes every Picard iteration (the coefficients
+     * depend on temperature), but slowly, so the hierarchy of an earlier
+     * matrix remains a good preconditioner for many solves.
+     */
+    const bool rebuilt=!preconditioner_valid;
+    if (!preconditioner_valid)
+      {
+	TrilinosWrappers::PreconditionAMG::AdditionalData amg_data;
+	amg_data.elliptic              = true;
+	amg_data.higher_order_elements = (fe.degree>1);
+	amg_data.aggregation_threshold = parameters.amg_aggregation_threshold;
+	amg_data.smoother_sweeps       = parameters.amg_smoother_sweeps;
+	preconditioner.initialize (system_matrix, amg_data);
+	preconditioner_valid=true;
+      }
+
+    cg.solve (system_matrix, distributed_solution, system_rhs,
+	      preconditioner);
+
+    if (rebuilt)
+      preconditioner_reference_iterations=solver_control.last_step();
+    else if (solver_control.last_step()>2*std::max(preconditioner_reference_iterations,1U))
+      preconditioner_valid=false;
+
+    constraints.distribute (distributed_solution);
+    solution = distributed_solution;
+
+    return solver_control.last_step();
+  }
+
+  template <int dim>
+  double Heat_Pipe_MPI<dim>::total_thermal_energy(const TrilinosWrappers::MPI::Vector &temperature) const
+  {
+    FEValues<dim> fe_values(fe, quadrature_formula,
+			    update_values | update_JxW_values);
+    const unsigned int n_q_points = quadrature_formula.size();
+    std::vector<double> temperature_values (n_q_points);
+
+    double energy=0.;
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      if (cell->is_locally_owned())
+	{
+	  fe_values.reinit (cell);
+	  fe_values.get_function_values(temperature,temperature_values);
+	  for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	    energy+=
+	      physics.thermal_energy(cell->center()[dim-1],temperature_values[q_point])*
+	      fe_values.JxW(q_point);
+	}
+    return Utilities::MPI::sum(energy,mpi_communicator);
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::compute_diagnostics()
+  {
+    TimerOutput::Scope t(computing_timer, "probes and diagnostics");
+    /*
+     * Energy balance of the step, with the same heat rates as the serial
+     * code (see Heat_Pipe::compute_diagnostics), integrated over the
+     * locally owned cells and summed over all processes.
+     */
+    const double theta=theta_temperature;
+
+    old_column_thermal_energy=column_thermal_energy;
+    column_thermal_energy    =total_thermal_energy(solution);
+
+    FEValues<dim> fe_values(fe, quadrature_formula,
+			    update_values | update_JxW_values);
+    FEFaceValues<dim> fe_face_values(fe, face_quadrature_formula,
+				     update_values | update_gradients |
+				     update_normal_vectors | update_JxW_values);
+    const unsigned int n_q_points      = quadrature_formula.size();
+    const unsigned int n_face_q_points = face_quadrature_formula.size();
+    std::vector<double>         old_values         (n_q_points);
+    std::vector<double>         new_values         (n_q_points);
+    std::vector<double>         old_face_values    (n_face_q_points);
+    std::vector<double>         new_face_values    (n_face_q_points);
+    std::vector<Tensor<1,dim> > old_face_gradients (n_face_q_points);
+    std::vector<Tensor<1,dim> > new_face_gradients (n_face_q_points);
+
+    /*
+     * top, bottom, lateral, point sources, heat losses
+     */
+    double local_rates[5]={0.,0.,0.,0.,0.};
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      if (cell->is_locally_owned())
+	{
+	  if (parameters.heat_loss_factor>0.)
+	    {
+	      fe_values.reinit (cell);
+	      fe_values.get_function_values(old_solution,old_values);
+	      fe_values.get_function_values(    solution,new_values);
+	      local_rates[4]+=
+		physics.cell_heat_loss_rate(fe_values,old_values,new_values,theta,
+					    old_room_temperature,new_room_temperature);
+	    }
+
+	  if (!cell->at_boundary())
+	    continue;
+
+	  for (unsigned int face=0; face<GeometryInfo<dim>::faces_per_cell; ++face)
+	    if (cell->face(face)->at_boundary())
+	      {
+		const types::boundary_id boundary_id=cell->face(face)->boundary_id();
+
+		fe_face_values.reinit (cell, face);
+		fe_face_values.get_function_values   (old_solution,old_face_values);
+		fe_face_values.get_function_values   (    solution,new_face_values);
+		fe_face_values.get_function_gradients(old_solution,old_face_gradients);
+		fe_face_values.get_function_gradients(    solution,new_face_gradients);
+
+		const double rate=
+		  physics.boundary_heat_rate(fe_face_values,boundary_id,
+					     top_boundary_condition,
+					     cell->center()[dim-1],theta,
+					     old_face_values,new_face_values,
+					     old_face_gradients,new_face_gradients,
+					     old_surface_temperature,new_surface_temperature,
+					     old_room_temperature,new_room_temperature);
+		if (boundary_id==top_boundary_id)
+		  local_rates[0]+=rate;
+		else if (boundary_id==bottom_boundary_id)
+		  local_rates[1]+=rate;
+		else if (boundary_id==lateral_boundary_id)
+		  local_rates[2]+=rate;
+	      }
+	}
+    /*
+     * Each point source is counted by the process that applies it.
+     */
+    for (unsigned int s=0; s<point_source_weights.size(); s++)
+      if (point_source_weights[s].size()!=0)
+	local_rates[3]+=
+	  theta*new_point_source_magnitudes[s]+
+	  (1.-theta)*old_point_source_magnitudes[s];
+
+    MPI_Allreduce (MPI_IN_PLACE, &local_rates[0], 5, MPI_DOUBLE, MPI_SUM,
+		   mpi_communicator);
+    heat_flux_top    =local_rates[0];
+    heat_flux_bottom =local_rates[1];
+    heat_flux_lateral=local_rates[2];
+    point_source_rate=local_rates[3];
+    heat_loss_rate   =local_rates[4];
+
+    energy_balance_error+=
+      (column_thermal_energy-old_column_thermal_energy)-
+      time_step*(heat_flux_top+heat_flux_bottom+heat_flux_lateral+
+		 point_source_rate+heat_loss_rate);
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::fill_output_vectors()
+  {
+    TimerOutput::Scope t(computing_timer, "probes and diagnostics");
+    /*
+     * Probe temperatures are evaluated by their owner and summed over all
+     * processes (the other processes contribute zero).
+     */
+    std::vector<double> temp_vector(depths_coordinates.size(),0.);
+    for (unsigned int i=0; i<probe_weights.size(); i++)
+      for (unsigned int k=0; k<probe_weights[i].size(); ++k)
+	temp_vector[i]+=
+	  probe_weights[i][k].second*solution(probe_weights[i][k].first);
+
+    if (temp_vector.size()>0)
+      MPI_Allreduce (MPI_IN_PLACE, &temp_vector[0], temp_vector.size(),
+		     MPI_DOUBLE, MPI_SUM, mpi_communicator);
+
+    if (Utilities::MPI::this_mpi_process(mpi_communicator)==0)
+      {
+	ColumnPhysics<dim>::write_output_line (output_file,parameters.output_precision,
+					       timestep_number,timestep_number*time_step,
+					       temp_vector,column_thermal_energy,
+					       heat_flux_top,heat_flux_bottom,heat_flux_lateral,
+					       point_source_rate,heat_loss_rate,
+					       energy_balance_error);
+	output_file.flush();
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::output_results()
+  {
+    TimerOutput::Scope t(computing_timer, "output");
+
+    DataOut<dim> data_out;
+    data_out.attach_dof_handler(dof_handler);
+    data_out.add_data_vector(solution,"solution");
+
+    Vector<float> subdomain (triangulation.n_active_cells());
+    for (unsigned int i=0; i<subdomain.size(); ++i)
+      subdomain(i) = triangulation.locally_owned_subdomain();
+    data_out.add_data_vector (subdomain, "subdomain");
+    data_out.build_patches();
+
+    std::stringstream t_str;
+    t_str << timestep_number;
+
+    std::stringstream d;
+    d << dim;
+
+    const std::string basename = "solution_"
+      + d.str() + "d_time_"
+      + t_str.str();
+    const std::string filename = parameters.output_directory + "/" + basename
+      + "." + Utilities::int_to_string(triangulation.locally_owned_subdomain(), 4)
+      + ".vtu";
+
+    std::ofstream output (filename.c_str());
+    data_out.write_vtu (output);
+
+    if (Utilities::MPI::this_mpi_process(mpi_communicator) == 0)
+      {
+	std::vector<std::string> filenames;
+	for (unsigned int i=0; i<Utilities::MPI::n_mpi_processes(mpi_communicator); ++i)
+	  filenames.push_back (basename + "." + Utilities::int_to_string (i, 4)
+			       + ".vtu");
+
+	std::ofstream master_output ((parameters.output_directory + "/" + basename + ".pvtu").c_str());
+	data_out.write_pvtu_record (master_output, filenames);
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::update_met_data ()
+  {
+    /*
+     * Forcing at the start and the end of the step, as in the serial code
+     * (see ColumnPhysics).
+     */
+    if (top_boundary_condition==first_type_top ||
+	top_boundary_condition==third_type_top)
+      {
+	old_room_temperature    = physics.room_temperature   (time          );
+	new_room_temperature    = physics.room_temperature   (time+time_step);
+	old_surface_temperature = physics.surface_temperature(time          );
+	new_surface_temperature = physics.surface_temperature(time+time_step);
+      }
+
+    if (parameters.point_source==true)
+      for (unsigned int s=0; s<parameters.point_source_files.size(); ++s)
+	{
+	  old_point_source_magnitudes[s]=physics.point_source_magnitude(s,time          );
+	  new_point_source_magnitudes[s]=physics.point_source_magnitude(s,time+time_step);
+	}
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::initial_condition_temperature()
+  {
+    std::vector< std::string > filenames;
+    filenames.push_back(parameters.initial_condition_file);
+
+    std::vector< std::vector<double> > initial_condition;
+    DataTools data_tools;
+    data_tools.read_data(filenames,
+			 initial_condition);
+
+    std::vector< std::pair<double,double> > initial_condition_table;
+    for (unsigned int i=0; i<initial_condition.size(); i++)
+      initial_condition_table
+	.push_back(std::make_pair(initial_condition[i][0],
+				  initial_condition[i][1]));
+
+    pcout << "Available initial condition entries: "
+	  << initial_condition.size() << std::endl;
+    /*
+     * The serial code projects the initial condition. Here it is
+     * interpolated, which does not need a (distributed) mass matrix solve.
+     */
+    VectorTools::interpolate (dof_handler,
+			      VerticalProfile<dim>(initial_condition_table),
+			      distributed_solution);
+    old_solution=distributed_solution;
+    solution=distributed_solution;
+  }
+
+  template <int dim>
+  void Heat_Pipe_MPI<dim>::run()
+  {
+    read_grid_temperature();
+    setup_system_temperature();
+    initial_condition_temperature();
+    column_thermal_energy=total_thermal_energy(solution);
+
+    int output_count=0;
+    for (timestep_number=1;
+	 timestep_number<=timestep_number_max;
+	 ++timestep_number)
+      {
+	update_met_data();
+	update_boundary_values();
+
+	int iteration=0;
+	unsigned int linear_iterations=0;
+	double total_error =1.E10;
+	double solution_l1_norm_previous_iteration;
+	double solution_l1_norm_current_iteration;
+	do
+	  {
+	    assemble_system_temperature();
+	    solution_l1_norm_previous_iteration=distributed_solution.l2_norm();
+	    linear_iterations+=solve_temperature();
+	    solution_l1_norm_current_iteration=distributed_solution.l2_norm();
+	    total_error=
+	      1.-std::fabs(solution_l1_norm_previous_iteration/solution_l1_norm_current_iteration);
+	    iteration++;
+	  }while (std::fabs(total_error)>5E-4);
+
+	time+=time_step;
+
+	if (parameters.output_data_in_terminal==true)
+	  pcout << "Time step " << timestep_number << "\ttime: " << time/60 << " min\tDt: "
+		<< time_step << " s\t#it: " << iteration
+		<< "\t#linear it: " << linear_iterations
+		<< "\n";
+
+	if (parameters.output_frequency!=0 &&
+	    time>output_count*parameters.output_frequency)
+	  {
+	    output_results();
+	    output_count++;
+	  }
+	compute_diagnostics();
+	fill_output_vectors();
+	old_solution=solution;
+      }
+    if (Utilities::MPI::this_mpi_process(mpi_communicator)==0)
+      output_file.close();
+    pcout << "\t Job Done!!"
+	  << std::endl;
+  }
+}
+
+int main (int argc, char *argv[])
+{
+  try
+    {
+      using namespace TRL;
+      using namespace dealii;
+
+      Utilities::MPI::MPI_InitFinalize mpi_initialization (argc, argv, 1);
+      {
+	deallog.depth_console (0);
+
+	unsigned int dimension=0;
+	if (argc==2)
+	  {
+	    ParameterHandler prm;
+	    Parameters::AllParameters<2>::declare_parameters (prm);
+	    std::ifstream inFile;
+	    inFile.open(argv[1]);
+	    prm.parse_input(inFile,argv[1]);
+	    prm.enter_subsection("geometric data");
+	    dimension=prm.get_integer("dimension");
+	    prm.leave_subsection();
+	  }
+
+	if (dimension==3)
+	  {
+	    Heat_Pipe_MPI<3> laplace_problem(argc,argv);
+	    laplace_problem.run();
+	  }
+	else if (dimension==2 || argc!=2)
+	  {
+	    Heat_Pipe_MPI<2> laplace_problem(argc,argv);
+	    laplace_problem.run();
+	  }
+	else
+	  {
+	    std::cerr << "The distributed version of the code needs "
+		      << "'dimension' to be 2 or 3.\n";
+	    return 1;
+	  }
+      }
+    }
+  catch (std::exception &exc)
+    {
+      std::cerr << std::endl << std::endl
+		<< "----------------------------------------------------"
+		<< std::endl;
+      std::cerr << "Exception on processing: " << std::endl
+		<< exc.what() << std::endl
+		<< "Aborting!" << std::endl
+		<< "----------------------------------------------------"
+		<< std::endl;
+
+      return 1;
+    }
+  catch (...)
+    {
+      std::cerr << std::endl << std::endl
+		<< "----------------------------------------------------"
+		<< std::endl;
+      std::cerr << "Unknown exception!" << std::endl
+		<< "Aborting!" << std::endl
+		<< "----------------------------------------------------"
+		<< std::endl;
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,4093 @@
+#include "heat_pipe.h"
+
+namespace TRL
+{
+  template <int dim>
+  Parameters::AllParameters<dim>
+  Heat_Pipe<dim>::read_parameters(int argc, char *argv[])
+  {
+    if (argc!=2)
+      {
+	std::cout << "Wrong number of input arguments.\n"
+		  << "Number of arguments passed: " << argc << "\n"
+		  << "Number of arguments expected: 2\n"
+		  << "Missing input file?\n" << std::endl;
+	throw 1;
+      }
+
+    const std::string input_filename = argv[1];
+
+    ParameterHandler prm;
+    Parameters::AllParameters<dim>::declare_parameters (prm);
+
+    std::ifstream inFile;
+    inFile.open(input_filename.c_str());
+    
+    //prm.read_input(input_filename);
+    prm.parse_input(inFile,input_filename);
+    
+    Parameters::AllParameters<dim> parameters;
+    parameters.parse_parameters (prm);
+    return parameters;
+  }
+
+  /*
+   * The finite element and the quadrature depend on the parameters, so the
+   * parameter file is read before anything else is constructed.
+   */
+  template <int dim>
+  Heat_Pipe<dim>::Heat_Pipe(int argc, char *argv[])
+    :
+    Heat_Pipe(read_parameters(argc,argv),
+	      std::vector< std::vector<double> >())
+  {
+    if (logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "parameter file: " << argv[1] << "\n";
+
+    /*
+      We want to read the file containing the coordinates
+      of the points we are interested in. We will store
+      them in a vector and use them later to extract data
+      from the solution vector and do some calculations
+      (e.g. stored thermal energy).
+    */
+    std::vector< std::vector<int> >    dummy_matrix;
+    std::vector< std::string >         filenames;
+    filenames.push_back(parameters.depths_file);
+
+    DataTools data_tools;
+    data_tools.read_data (filenames,
+			  depths_coordinates);
+
+    if (logger.is_enabled(Logging::Logger::normal))
+      {
+	logger.stream() << "Available depth coordinate entries: "
+			<< depths_coordinates.size() << "\n"
+			<< "Depth coordinates (m):\n"
+			<< "\tX\tY\tZ\n";
+	for (unsigned int i=0; i<depths_coordinates.size(); i++)
+	  {
+	    for (unsigned int j=0; j<depths_coordinates[i].size(); j++)
+	      logger.stream() << "\t" << depths_coordinates[i][j];
+	    logger.stream() << "\n";
+	  }
+      }
+
+    std::string output_filename=parameters.output_file;
+    remove(output_filename.c_str());
+    output_file.open(output_filename.c_str(),std::ios::app);
+    if (!output_file.is_open()) //some error with the file
+      {
+	std::cout << "Error opening output data file\n";
+	throw 1;
+      }
+    setup_output_aggregators();
+    setup_monitor();
+  }
+
+  template <int dim>
+  Heat_Pipe<dim>::Heat_Pipe(const Parameters::AllParameters<dim> &parameters_,
+			    const std::vector< std::vector<double> > &probe_coordinates)
+    :
+    dof_handler(triangulation),
+    fe(parameters_.fe_degree),
+    quadrature_formula(parameters_.fe_degree+2),
+    face_quadrature_formula(parameters_.fe_degree+2),
+    parameters(parameters_),
+    depths_coordinates(probe_coordinates)
+  {
+    setup_parameters();
+  }
+
+  /*
+   * Everything that only depends on the parameters, shared by both
+   * constructors.
+   */
+  template <int dim>
+  void Heat_Pipe<dim>::setup_parameters()
+  {
+    logger.set_verbosity (Logging::Logger::level_from_string(parameters.verbosity));
+    if (parameters.output_data_in_terminal==false &&
+	logger.is_enabled(Logging::Logger::steps))
+      logger.set_verbosity (Logging::Logger::normal);
+    logger.set_rate_limit (parameters.log_every_n_steps,
+			   parameters.log_every_seconds);
+    logger.set_file (parameters.log_file);
+
+    theta_temperature   = parameters.theta;
+    timestep_number_max = parameters.timestep_number_max;
+    time_step           = parameters.time_step;
+    time_max            = time_step*timestep_number_max;
+
+    thermal_conductivity_liquids   = parameters.thermal_conductivity_liquids;
+    thermal_conductivity_air       = parameters.thermal_conductivity_air;
+
+    single_precision_solver=(parameters.linear_solver_precision.compare("float")==0);
+
+    top_boundary_condition=
+      top_boundary_condition_type(parameters.boundary_condition_top);
+
+    if (parameters.time_integrator.compare("bdf2")==0)
+      time_integrator=bdf2;
+    else if (parameters.time_integrator.compare("sdirk2")==0)
+      time_integrator=sdirk2;
+    else
+      time_integrator=theta_method;
+    if (time_integrator!=theta_method)
+      theta_temperature=1.;
+
+    if (parameters.reduced_model_mode.compare("train")==0)
+      reduced_model_mode=reduced_model_train;
+    else if (parameters.reduced_model_mode.compare("online")==0)
+      reduced_model_mode=reduced_model_online;
+    else if (parameters.reduced_model_mode.compare("validate")==0)
+      reduced_model_mode=reduced_model_validate;
+    else
+      reduced_model_mode=reduced_model_off;
+
+    /*
+     * The calibration differentiates the time loop as it is, without
+     * lagged coefficients or linear steps.
+     */
+    if (parameters.calibration_mode.compare("gradient")==0)
+      calibration_mode=calibration_gradient;
+    else if (parameters.calibration_mode.compare("optimize")==0)
+      calibration_mode=calibration_optimize;
+    else
+      calibration_mode=calibration_off;
+    if (calibration_mode!=calibration_off)
+      {
+	parameters.coefficient_update_tolerance=0.;
+	parameters.linear_fast_path=false;
+      }
+
+    if (theta_temperature==1.)
+      theta_scheme=backward_euler;
+    else if (theta_temperature==0.5)
+      theta_scheme=crank_nicolson;
+    else
+      theta_scheme=general_theta;
+
+    old_room_temperature       = 0.;
+    new_room_temperature       = 0.;
+    old_surface_temperature    = 0.;
+    new_surface_temperature    = 0.;
+    old_point_source_magnitudes.assign(parameters.point_source_depths.size(),0.);
+    new_point_source_magnitudes.assign(parameters.point_source_depths.size(),0.);
+    time=0.;
+    timestep_number=0;
+    column_thermal_energy    =0.;
+    old_column_thermal_energy=0.;
+    heat_flux_top            =0.;
+    heat_flux_bottom         =0.;
+    heat_flux_lateral        =0.;
+    heat_loss_rate           =0.;
+    point_source_rate        =0.;
+    energy_balance_error     =0.;
+    older_time_step          =0.;
+    time_error               =0.;
+    max_time_error           =0.;
+    linear_operators_valid   =false;
+    linear_direct_solve      =false;
+    linear_time_step         =0.;
+    reduced_model_max_error   =0.;
+    reduced_model_square_error=0.;
+    reduced_model_wall_time   =0.;
+
+    physics.reinit (parameters,
+		    (logger.is_enabled(Logging::Logger::normal) ?
+		     &logger.stream() : 0));
+
+    profiler.set_enabled(parameters.profiling);
+    profiler.add_section(mesh_setup_section,             "mesh setup");
+    profiler.add_section(initial_condition_section,      "initial condition");
+    profiler.add_section(forcing_section,                "forcing update");
+    profiler.add_section(assembly_section,               "assembly");
+    profiler.add_section(boundary_conditions_section,    "boundary conditions");
+    profiler.add_section(linear_solve_section,           "linear solve");
+    profiler.add_section(probe_extraction_section,       "probe extraction");
+    profiler.add_section(diagnostics_section,            "diagnostics");
+    profiler.add_section(vtu_output_section,             "vtu output");
+    profiler.add_counter(time_steps_counter,             "time steps");
+    profiler.add_counter(picard_iterations_counter,      "picard iterations");
+    profiler.add_counter(linear_iterations_counter,      "linear iterations");
+    profiler.add_counter(coefficient_evaluations_counter,"coefficient evaluations");
+    profiler.add_counter(coefficient_reuses_counter,     "coefficient reuses");
+    profiler.add_counter(linear_steps_counter,           "linear regime steps");
+  }
+
+  template <int dim>
+  Heat_Pipe<dim>::~Heat_Pipe ()
+  {
+    dof_handler.clear ();
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::read_grid_temperature()
+  {
+    if (dim==1)
+      GridGenerator::hyper_cube (triangulation,-1.*parameters.domain_size, 0);
+    else
+      {
+	/*
+	 * The domain spans [-width/2,width/2] in the horizontal directions
+	 * and [-domain_size,0] in the vertical one. The coarse mesh is
+	 * subdivided so that its cells are as close to square as possible.
+	 */
+	Point<dim> bottom_corner;
+	Point<dim> top_corner;
+	std::vector<unsigned int> repetitions(dim,1);
+	const double coarse_cell_size=
+	  std::min(parameters.domain_width,parameters.domain_size);
+	for (unsigned int d=0; d<dim-1; ++d)
+	  {
+	    bottom_corner[d]=-0.5*parameters.domain_width;
+	    top_corner[d]   = 0.5*parameters.domain_width;
+	    repetitions[d]  =
+	      std::max(1,(int)std::floor(parameters.domain_width/coarse_cell_size+0.5));
+	  }
+	bottom_corner[dim-1]=-1.*parameters.domain_size;
+	top_corner[dim-1]   = 0.;
+	repetitions[dim-1]  =
+	  std::max(1,(int)std::floor(parameters.domain_size/coarse_cell_size+0.5));
+
+	GridGenerator::subdivided_hyper_rectangle (triangulation,repetitions,
+						   bottom_corner,top_corner);
+      }
+    /*
+     * Identify top, bottom and lateral boundaries once, so that the rest of
+     * the code only needs to look at boundary indicators.
+     */
+    const double tolerance=1.E-8*parameters.domain_size;
+    typename Triangulation<dim>::active_cell_iterator
+      cell = triangulation.begin_active(),
+      endc = triangulation.end();
+    for (; cell!=endc; ++cell)
+      for (unsigned int face=0; face<GeometryInfo<dim>::faces_per_cell; ++face)
+	if (cell->face(face)->at_boundary())
+	  {
+	    const double z=cell->face(face)->center()[dim-1];
+	    if (std::fabs(z)<tolerance)
+	      cell->face(face)->set_boundary_id(top_boundary_id);
+	    else if (std::fabs(z+parameters.domain_size)<tolerance)
+	      cell->face(face)->set_boundary_id(bottom_boundary_id);
+	    else
+	      cell->face(face)->set_boundary_id(lateral_boundary_id);
+	  }
+
+    triangulation.refine_global (parameters.refinement_level);
+    dof_handler.distribute_dofs (fe);
+  }
+
+  template <int dim>
+  Point<dim> Heat_Pipe<dim>::probe_point(const std::vector<double> &coordinates) const
+  {
+    /*
+     * Coordinates are given as X, Y and depth (positive downwards). In 1D
+     * only the depth is used, in 2D the X and depth, and in 3D all of them.
+     */
+    Point<dim> p;
+    for (unsigned int d=0; d<dim-1; ++d)
+      p[d]=coordinates[d];
+    p[dim-1]=-1.*coordinates[2];
+    return p;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_system_temperature()
+  {
+    hanging_node_constraints.clear ();
+    DoFTools::make_hanging_node_constraints (dof_handler,
+					     hanging_node_constraints);
+    hanging_node_constraints.close ();
+
+    DynamicSparsityPattern csp(dof_handler.n_dofs(),
+			       dof_handler.n_dofs());
+
+    DoFTools::make_sparsity_pattern (dof_handler, csp,
+				     hanging_node_constraints,
+				     /*keep_constrained_dofs = */ true);
+    sparsity_pattern.copy_from (csp);
+    system_matrix.reinit (sparsity_pattern);
+    system_rhs.reinit (dof_handler.n_dofs());
+
+    for (unsigned int b=0; b<2; b++)
+      {
+	std::set<types::boundary_id> boundary_ids;
+	boundary_ids.insert(b==0 ? bottom_boundary_id : top_boundary_id);
+	std::vector<bool> boundary_dof_flags (dof_handler.n_dofs(),false);
+	DoFTools::extract_boundary_dofs (dof_handler, ComponentMask(),
+					 boundary_dof_flags, boundary_ids);
+
+	std::vector<types::global_dof_index> &boundary_dofs=
+	  (b==0 ? bottom_boundary_dofs : top_boundary_dofs);
+	boundary_dofs.clear();
+	for (unsigned int i=0; i<boundary_dof_flags.size(); i++)
+	  if (boundary_dof_flags[i]==true &&
+	      !hanging_node_constraints.is_constrained(i))
+	    boundary_dofs.push_back(i);
+      }
+
+    amg_preconditioner.clear ();
+    solver_amg_preconditioner.clear ();
+    if (single_precision_solver)
+      {
+	solver_matrix.reinit (sparsity_pattern);
+	solver_rhs.reinit (dof_handler.n_dofs());
+	solver_correction.reinit (dof_handler.n_dofs());
+	refinement_residual.reinit (dof_handler.n_dofs());
+	inner_linear_solver.reset (new SolverCG<Vector<float> > (inner_solver_control));
+      }
+    linear_solver.reset (new SolverCG<> (linear_solver_control));
+    linear_operators_valid=false;
+    scratch.reset (new Scratch (fe,quadrature_formula,face_quadrature_formula));
+
+    setup_point_sources ();
+    setup_probes ();
+    setup_boundary_faces ();
+    setup_batched_assembly ();
+    setup_sum_factorization ();
+
+    coefficient_cache.reinit (triangulation.n_active_cells(),
+			      quadrature_formula.size(),
+			      fe.dofs_per_cell,
+			      parameters.coefficient_update_tolerance,
+			      parameters.freezing_point,
+			      parameters.coefficient_freezing_band);
+  }
+
+  template <int dim>
+  Heat_Pipe<dim>::Scratch::Scratch (const FiniteElement<dim> &fe,
+				    const Quadrature<dim>    &quadrature,
+				    const Quadrature<dim-1>  &face_quadrature)
+    :
+    fe_values (fe, quadrature,
+	       update_values | update_gradients |
+	       update_quadrature_points | update_JxW_values),
+    value_fe_values (fe, quadrature,
+		     update_values | update_JxW_values),
+    fe_face_values (fe, face_quadrature,
+		    update_values | update_gradients | update_normal_vectors |
+		    update_quadrature_points | update_JxW_values),
+    cell_mass_matrix        (fe.dofs_per_cell,fe.dofs_per_cell),
+    cell_laplace_matrix     (fe.dofs_per_cell,fe.dofs_per_cell),
+    cell_system_matrix      (fe.dofs_per_cell,fe.dofs_per_cell),
+    cell_rhs                (fe.dofs_per_cell),
+    old_temperature_values  (fe.dofs_per_cell),
+    local_dof_indices       (fe.dofs_per_cell),
+    old_dof_values          (fe.dofs_per_cell),
+    new_dof_values          (fe.dofs_per_cell),
+    heat_loss_rhs           (fe.dofs_per_cell),
+    old_function_values       (quadrature.size()),
+    new_function_values       (quadrature.size()),
+    average_cell_temperatures (quadrature.size()),
+    thermal_conductivities    (quadrature.size()),
+    heat_capacities           (quadrature.size()),
+    heat_loss_values          (quadrature.size()),
+    JxW                       (quadrature.size()),
+    temperature_values        (quadrature.size()),
+    old_face_values    (face_quadrature.size()),
+    new_face_values    (face_quadrature.size()),
+    old_face_gradients (face_quadrature.size()),
+    new_face_gradients (face_quadrature.size())
+  {}
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_batched_assembly()
+  {
+    batched_assembly=false;
+    batch_cell_size=0.;
+    batch_dof_indices.clear();
+    batch_matrix_entries.clear();
+    batch_cell_centers.clear();
+
+    if (dim!=1 || fe.degree!=1 || parameters.batched_assembly==false ||
+	hanging_node_constraints.n_constraints()!=0)
+      return;
+
+    std::vector<types::global_dof_index> local_dof_indices (fe.dofs_per_cell);
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    batch_cell_size=cell->diameter();
+    for (; cell!=endc; ++cell)
+      {
+	if (fabs(cell->diameter()-batch_cell_size)>1.E-12*batch_cell_size)
+	  {
+	    batch_dof_indices.clear();
+	    batch_matrix_entries.clear();
+	    batch_cell_centers.clear();
+	    return;
+	  }
+	cell->get_dof_indices (local_dof_indices);
+	for (unsigned int i=0; i<2; ++i)
+	  batch_dof_indices.push_back(local_dof_indices[i]);
+	for (unsigned int i=0; i<2; ++i)
+	  for (unsigned int j=0; j<2; ++j)
+	    batch_matrix_entries.push_back(sparsity_pattern(local_dof_indices[i],
+							    local_dof_indices[j]));
+	batch_cell_centers.push_back(cell->center()[dim-1]);
+      }
+    /*
+     * Shape values and gradients and JxW values of the reference cell
+     * scaled by the cell size, the same for all cells.
+     */
+    const unsigned int n_q_points=quadrature_formula.size();
+    for (unsigned int i=0; i<2; ++i)
+      {
+	batch_shape_values[i].resize(n_q_points);
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    Point<dim> p;
+	    p[0]=quadrature_formula.point(q_point)[0];
+	    batch_shape_values[i][q_point]=fe.shape_value(i,p);
+	  }
+	batch_shape_grads[i]=fe.shape_grad(i,Point<dim>())[0]/batch_cell_size;
+      }
+    batch_JxW.resize(n_q_points);
+    for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+      batch_JxW[q_point]=quadrature_formula.weight(q_point)*batch_cell_size;
+    batched_assembly=true;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_sum_factorization()
+  {
+    /*
+     * The tensor product kernels need cells that are boxes aligned with
+     * the coordinate axes, i.e. every vertex coordinate is either the one
+     * of the first or the one of the last vertex of the cell.
+     */
+    sum_factorized_assembly=false;
+    if (dim==1 || parameters.sum_factorization==false)
+      return;
+
+    const unsigned int last_vertex=GeometryInfo<dim>::vertices_per_cell-1;
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	const double tolerance=1.E-12*cell->diameter();
+	for (unsigned int v=0; v<GeometryInfo<dim>::vertices_per_cell; ++v)
+	  for (unsigned int d=0; d<dim; ++d)
+	    {
+	      const double expected=
+		((v>>d)&1) ? cell->vertex(last_vertex)[d] : cell->vertex(0)[d];
+	      if (fabs(cell->vertex(v)[d]-expected)>tolerance)
+		return;
+	    }
+      }
+
+    sum_factorization.reinit (fe,QGauss<1>(fe.degree+2));
+    sum_factorized_assembly=true;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_boundary_faces()
+  {
+    boundary_faces.clear();
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      if (cell->at_boundary())
+	for (unsigned int face=0; face<GeometryInfo<dim>::faces_per_cell; ++face)
+	  if (cell->face(face)->at_boundary())
+	    {
+	      const types::boundary_id boundary_id=
+		cell->face(face)->boundary_id();
+	      if ((boundary_id==top_boundary_id &&
+		   top_boundary_condition!=first_type_top) ||
+		  (boundary_id==lateral_boundary_id &&
+		   parameters.lateral_heat_transfer_coefficient>0.))
+		{
+		  BoundaryFace boundary_face;
+		  boundary_face.cell       =cell;
+		  boundary_face.face       =face;
+		  boundary_face.boundary_id=boundary_id;
+		  boundary_faces.push_back(boundary_face);
+		}
+	    }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_point_sources()
+  {
+    /*
+     * This is what 'create_point_source_vector' in deal.ii does, but
+     * we keep only the nonzero entries so that adding the sources to the
+     * rhs costs dofs_per_cell operations per source.
+     * */
+    point_source_weights.clear();
+    if (parameters.point_source==false)
+      return;
+
+    point_source_weights.resize(parameters.point_source_depths.size());
+    for (unsigned int s=0; s<parameters.point_source_depths.size(); s++)
+      {
+	Point<dim> p;
+	p[dim-1]=-1.*parameters.point_source_depths[s];
+
+	const std::pair<typename DoFHandler<dim>::active_cell_iterator,Point<dim> >
+	  cell_point=GridTools::find_active_cell_around_point (StaticMappingQ1<dim>::mapping,
+							       dof_handler,p);
+	std::vector<types::global_dof_index> local_dof_indices (fe.dofs_per_cell);
+	cell_point.first->get_dof_indices (local_dof_indices);
+	for (unsigned int i=0; i<fe.dofs_per_cell; i++)
+	  point_source_weights[s].push_back(std::make_pair(local_dof_indices[i],
+							   fe.shape_value(i,cell_point.second)));
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_probes()
+  {
+    /*
+     * Same as VectorTools::point_value, but the cell around each probe is
+     * only searched for once.
+     * */
+    probe_weights.clear();
+    probe_weights.resize(depths_coordinates.size());
+    probe_values.assign(depths_coordinates.size(),0.);
+    for (unsigned int i=0; i<depths_coordinates.size(); i++)
+      {
+	const std::pair<typename DoFHandler<dim>::active_cell_iterator,Point<dim> >
+	  cell_point=GridTools::find_active_cell_around_point (StaticMappingQ1<dim>::mapping,
+							       dof_handler,
+							       probe_point(depths_coordinates[i]));
+	std::vector<types::global_dof_index> local_dof_indices (fe.dofs_per_cell);
+	cell_point.first->get_dof_indices (local_dof_indices);
+	for (unsigned int j=0; j<fe.dofs_per_cell; j++)
+	  probe_weights[i].push_back(std::make_pair(local_dof_indices[j],
+						    fe.shape_value(j,cell_point.second)));
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::assemble_system_temperature()
+  {
+    Profiling::Profiler::Scope scope(profiler,assembly_section);
+
+    system_rhs    = 0.;
+    system_matrix = 0.;
+    /*
+     * The top boundary condition type and the theta value are fixed for
+     * the whole run. Dispatch once to the kernels specialised for them so
+     * that no string comparisons or theta multiplications by zero are left
+     * inside the loops.
+     */
+    switch (theta_scheme)
+      {
+      case backward_euler:
+	assemble_domain<backward_euler>();
+	break;
+      case crank_nicolson:
+	assemble_domain<crank_nicolson>();
+	break;
+      default:
+	assemble_domain<general_theta>();
+	break;
+      }
+
+    /*
+     * This is the section where the point sources are included.
+     * The unit source vectors were computed in setup_point_sources()
+     * */
+    for (unsigned int s=0; s<point_source_weights.size(); s++)
+      {
+	const double magnitude=
+	  old_point_source_magnitudes[s]*(1.-theta_temperature)*time_step
+	  +new_point_source_magnitudes[s]*(   theta_temperature)*time_step;// (W/m3)
+	for (unsigned int k=0; k<point_source_weights[s].size(); k++)
+	  system_rhs(point_source_weights[s][k].first)+=
+	    magnitude*point_source_weights[s][k].second;
+      }
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void Heat_Pipe<dim>::assemble_domain()
+  {
+    if (parameters.check_batched_assembly &&
+	(batched_assembly || sum_factorized_assembly))
+      check_batched_assembly<scheme>();
+
+    if (batched_assembly)
+      assemble_cells_batched<scheme>();
+    else if (sum_factorized_assembly)
+      assemble_cells_sum_factorized<scheme>();
+    else
+      assemble_cells<scheme>();
+
+    assemble_boundary_faces<scheme>();
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void Heat_Pipe<dim>::assemble_cells()
+  {
+    const double theta=theta_value<scheme>(theta_temperature);
+
+    FEValues<dim> &fe_values=scratch->fe_values;
+
+    const unsigned int n_q_points      = quadrature_formula.size();
+
+    FullMatrix<double> &cell_mass_matrix   =scratch->cell_mass_matrix;
+    FullMatrix<double> &cell_laplace_matrix=scratch->cell_laplace_matrix;
+    FullMatrix<double> &cell_system_matrix =scratch->cell_system_matrix;
+    Vector<double>     &cell_rhs           =scratch->cell_rhs;
+
+    Vector<double> &old_temperature_values=scratch->old_temperature_values;
+
+    std::vector<types::global_dof_index> &local_dof_indices=scratch->local_dof_indices;
+    std::vector<double> &old_function_values      =scratch->old_function_values;
+    std::vector<double> &new_function_values      =scratch->new_function_values;
+    std::vector<double> &average_cell_temperatures=scratch->average_cell_temperatures;
+    std::vector<double> &thermal_conductivities   =scratch->thermal_conductivities;
+    std::vector<double> &heat_capacities          =scratch->heat_capacities;
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	cell_mass_matrix    = 0;
+	cell_laplace_matrix = 0;
+	cell_rhs            = 0;
+	fe_values.reinit (cell);
+	fe_values.get_function_values(old_solution,old_function_values);
+	fe_values.get_function_values(    solution,new_function_values);
+
+	cell->get_dof_values(old_solution,old_temperature_values);
+
+	const unsigned int cell_index=cell->active_cell_index();
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  average_cell_temperatures[q_point]=
+	    (   theta)*new_function_values[q_point]+
+	    (1.-theta)*old_function_values[q_point];
+	/*
+	 * With lagged coefficients, a cell whose temperatures are all close
+	 * to those at the last evaluation reuses its stored cell matrices.
+	 */
+	const bool reuse_coefficients=
+	  coefficient_cache.enabled() &&
+	  coefficient_cache.cell_is_current(cell_index,average_cell_temperatures);
+	if (reuse_coefficients)
+	  {
+	    coefficient_cache.get_cell_matrices(cell_index,cell_mass_matrix,
+						cell_laplace_matrix);
+	    profiler.count(coefficient_reuses_counter,n_q_points);
+	  }
+	else
+	  profiler.count(coefficient_evaluations_counter,n_q_points);
+
+	physics.template cell_terms<scheme> (fe_values,cell->center()[dim-1],
+					     average_cell_temperatures,
+					     theta_temperature,time_step,
+					     old_room_temperature,new_room_temperature,
+					     !reuse_coefficients,
+					     thermal_conductivities,heat_capacities,
+					     cell_mass_matrix,cell_laplace_matrix,cell_rhs);
+	if (coefficient_cache.enabled() && !reuse_coefficients)
+	  {
+	    for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	      coefficient_cache.store(cell_index,q_point,average_cell_temperatures[q_point],
+				      thermal_conductivities[q_point],
+				      heat_capacities[q_point]);
+	    coefficient_cache.store_cell_matrices(cell_index,cell_mass_matrix,
+						  cell_laplace_matrix);
+	  }
+
+	physics.template theta_system<scheme> (cell_mass_matrix,cell_laplace_matrix,
+					       old_temperature_values,
+					       theta_temperature,time_step,
+					       cell_system_matrix,cell_rhs);
+
+	cell->get_dof_indices (local_dof_indices);
+	hanging_node_constraints.distribute_local_to_global (cell_system_matrix,
+							     cell_rhs,
+							     local_dof_indices,
+							     system_matrix,
+							     system_rhs);
+      }
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void Heat_Pipe<dim>::assemble_cells_batched()
+  {
+    /*
+     * Cell assembly for a uniform 1D mesh with linear elements. All cells
+     * have the same size, so the shape values, gradients and JxW values of
+     * the reference cell scaled by h are the same for every cell and no
+     * FEValues object is needed. Cells are processed in batches of
+     * VectorizedArray<double>::n_array_elements, one cell per lane. The
+     * material properties are still evaluated cell by cell (they come from
+     * PorousMaterial) and gathered into the lanes. The 2x2 cell matrices
+     * are added directly to the stored positions of the tridiagonal
+     * entries in the system matrix.
+     */
+    typedef VectorizedArray<double> vector_t;
+    const unsigned int n_lanes=vector_t::n_array_elements;
+    const unsigned int n_cells=batch_cell_centers.size();
+    const double theta=theta_value<scheme>(theta_temperature);
+
+    const unsigned int n_q_points=quadrature_formula.size();
+
+    const std::vector<double> (&shape_values)[2]=batch_shape_values;
+    const double              (&shape_grads)[2] =batch_shape_grads;
+    const std::vector<double> &JxW=batch_JxW;
+
+    for (unsigned int first_cell=0; first_cell<n_cells; first_cell+=n_lanes)
+      {
+	const unsigned int n_filled=std::min(n_lanes,n_cells-first_cell);
+
+	vector_t old_values[2], new_values[2];
+	for (unsigned int v=0; v<n_lanes; ++v)
+	  {
+	    const unsigned int c=first_cell+std::min(v,n_filled-1);
+	    for (unsigned int i=0; i<2; ++i)
+	      {
+		old_values[i][v]=old_solution(batch_dof_indices[2*c+i]);
+		new_values[i][v]=    solution(batch_dof_indices[2*c+i]);
+	      }
+	  }
+
+	vector_t cell_mass_matrix[2][2], cell_laplace_matrix[2][2], cell_rhs[2];
+	for (unsigned int i=0; i<2; ++i)
+	  {
+	    cell_rhs[i]=0.;
+	    for (unsigned int j=0; j<2; ++j)
+	      {
+		cell_mass_matrix[i][j]   =0.;
+		cell_laplace_matrix[i][j]=0.;
+	      }
+	  }
+
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    const vector_t average_cell_temperature=
+	      (   theta)*(shape_values[0][q_point]*new_values[0]+shape_values[1][q_point]*new_values[1])+
+	      (1.-theta)*(shape_values[0][q_point]*old_values[0]+shape_values[1][q_point]*old_values[1]);
+
+	    vector_t thermal_conductivity, total_volumetric_heat_capacity, heat_source;
+	    thermal_conductivity=0.;
+	    total_volumetric_heat_capacity=0.;
+	    heat_source=0.;
+	    for (unsigned int v=0; v<n_filled; ++v)
+	      {
+		const unsigned int c=first_cell+v;
+		const double cell_center=batch_cell_centers[c];
+		const double temperature=average_cell_temperature[v];
+		if (coefficient_cache.enabled() &&
+		    coefficient_cache.is_current(c,q_point,temperature))
+		  {
+		    thermal_conductivity[v]          =coefficient_cache.thermal_conductivity(c,q_point);
+		    total_volumetric_heat_capacity[v]=coefficient_cache.heat_capacity(c,q_point);
+		    profiler.count(coefficient_reuses_counter);
+		  }
+		else
+		  {
+		    double cell_thermal_conductivity          = -1.E10;
+		    double cell_total_volumetric_heat_capacity= -1.E10;
+		    double cell_ice_saturation                = -1.E10;
+		    physics.material_data(cell_center,temperature,
+					  cell_thermal_conductivity,cell_total_volumetric_heat_capacity,
+					  cell_ice_saturation);
+		    thermal_conductivity[v]          =cell_thermal_conductivity;
+		    total_volumetric_heat_capacity[v]=cell_total_volumetric_heat_capacity;
+		    if (coefficient_cache.enabled())
+		      coefficient_cache.store(c,q_point,temperature,
+					      cell_thermal_conductivity,
+					      cell_total_volumetric_heat_capacity);
+		    profiler.count(coefficient_evaluations_counter);
+		  }
+
+		heat_source[v]=
+		  physics.thermal_losses(average_cell_temperature[v]-new_room_temperature)*theta*time_step;
+		if (scheme!=backward_euler)
+		  heat_source[v]+=
+		    physics.thermal_losses(average_cell_temperature[v]-old_room_temperature)*(1.-theta)*time_step;
+	      }
+
+	    for (unsigned int i=0; i<2; ++i)
+	      {
+		for (unsigned int j=0; j<2; ++j)
+		  {
+		    cell_mass_matrix[i][j]+=
+		      total_volumetric_heat_capacity*
+		      (shape_values[i][q_point]*shape_values[j][q_point]*JxW[q_point]);
+		    cell_laplace_matrix[i][j]+=
+		      thermal_conductivity*
+		      (shape_grads[i]*shape_grads[j]*JxW[q_point]);
+		  }
+		cell_rhs[i]+=
+		  heat_source*(shape_values[i][q_point]*JxW[q_point]);
+	      }
+	  }
+
+	vector_t cell_system_matrix[2][2];
+	for (unsigned int i=0; i<2; ++i)
+	  for (unsigned int j=0; j<2; ++j)
+	    {
+	      cell_system_matrix[i][j]=
+		cell_mass_matrix[i][j]+(theta*time_step)*cell_laplace_matrix[i][j];
+	      if (scheme!=backward_euler)
+		cell_rhs[i]+=
+		  (cell_mass_matrix[i][j]-((1.-theta)*time_step)*cell_laplace_matrix[i][j])*
+		  old_values[j];
+	      else
+		cell_rhs[i]+=
+		  cell_mass_matrix[i][j]*old_values[j];
+	    }
+
+	for (unsigned int v=0; v<n_filled; ++v)
+	  {
+	    const unsigned int c=first_cell+v;
+	    for (unsigned int i=0; i<2; ++i)
+	      {
+		for (unsigned int j=0; j<2; ++j)
+		  system_matrix.global_entry(batch_matrix_entries[4*c+2*i+j])+=
+		    cell_system_matrix[i][j][v];
+		system_rhs(batch_dof_indices[2*c+i])+=cell_rhs[i][v];
+	      }
+	  }
+      }
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void Heat_Pipe<dim>::assemble_cells_sum_factorized()
+  {
+    /*
+     * Same terms as assemble_cells(), for 2D and 3D meshes of axis aligned
+     * boxes. Temperatures at the quadrature points, the heat loss rhs and
+     * the cell mass and laplace matrices are computed with the tensor
+     * product kernels in sum_factorization instead of FEValues. The
+     * quadrature is the same, so the results agree with assemble_cells()
+     * up to round-off.
+     */
+    const double theta=theta_value<scheme>(theta_temperature);
+
+    const unsigned int dofs_per_cell   = fe.dofs_per_cell;
+    const unsigned int n_q_points      = quadrature_formula.size();
+    const std::vector<unsigned int> &lexicographic_numbering=
+      sum_factorization.lexicographic_numbering;
+
+    FullMatrix<double> &cell_mass_matrix        =scratch->cell_mass_matrix;
+    FullMatrix<double> &cell_laplace_matrix     =scratch->cell_laplace_matrix;
+    FullMatrix<double> &cell_system_matrix      =scratch->cell_system_matrix;
+    Vector<double>     &cell_rhs                =scratch->cell_rhs;
+
+    std::vector<types::global_dof_index> &local_dof_indices=scratch->local_dof_indices;
+    std::vector<double> &old_dof_values           =scratch->old_dof_values;
+    std::vector<double> &new_dof_values           =scratch->new_dof_values;
+    std::vector<double> &heat_loss_rhs            =scratch->heat_loss_rhs;
+    std::vector<double> &old_function_values      =scratch->old_function_values;
+    std::vector<double> &new_function_values      =scratch->new_function_values;
+    std::vector<double> &average_cell_temperatures=scratch->average_cell_temperatures;
+    std::vector<double> &thermal_conductivities   =scratch->thermal_conductivities;
+    std::vector<double> &heat_capacities          =scratch->heat_capacities;
+    std::vector<double> &heat_loss_values         =scratch->heat_loss_values;
+    std::vector<double> &JxW                      =scratch->JxW;
+
+    const unsigned int last_vertex=GeometryInfo<dim>::vertices_per_cell-1;
+    Tensor<1,dim> cell_size;
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	cell->get_dof_indices (local_dof_indices);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  {
+	    const types::global_dof_index dof=
+	      local_dof_indices[lexicographic_numbering[i]];
+	    old_dof_values[i]=old_solution(dof);
+	    new_dof_values[i]=    solution(dof);
+	  }
+	sum_factorization.evaluate (old_dof_values,old_function_values);
+	sum_factorization.evaluate (new_dof_values,new_function_values);
+
+	for (unsigned int d=0; d<dim; ++d)
+	  cell_size[d]=cell->vertex(last_vertex)[d]-cell->vertex(0)[d];
+	sum_factorization.JxW_values (cell_size,JxW);
+
+	const unsigned int cell_index=cell->active_cell_index();
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  average_cell_temperatures[q_point]=
+	    (   theta)*new_function_values[q_point]+
+	    (1.-theta)*old_function_values[q_point];
+
+	const bool reuse_coefficients=
+	  coefficient_cache.enabled() &&
+	  coefficient_cache.cell_is_current(cell_index,average_cell_temperatures);
+	if (reuse_coefficients)
+	  {
+	    coefficient_cache.get_cell_matrices(cell_index,cell_mass_matrix,
+						cell_laplace_matrix);
+	    profiler.count(coefficient_reuses_counter,n_q_points);
+	  }
+	else
+	  profiler.count(coefficient_evaluations_counter,n_q_points);
+
+	double cell_ice_saturation=-1.E10;
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    const double average_cell_temperature=average_cell_temperatures[q_point];
+
+	    double heat_loss=
+	      physics.thermal_losses(average_cell_temperature-new_room_temperature)*theta;
+	    if (scheme!=backward_euler)
+	      heat_loss+=
+		physics.thermal_losses(average_cell_temperature-old_room_temperature)*(1.-theta);
+	    heat_loss_values[q_point]=heat_loss*time_step*JxW[q_point];
+
+	    if (!reuse_coefficients)
+	      {
+		physics.material_data(cell->center()[dim-1],average_cell_temperature,
+				      thermal_conductivities[q_point],heat_capacities[q_point],
+				      cell_ice_saturation);
+		if (coefficient_cache.enabled())
+		  coefficient_cache.store(cell_index,q_point,average_cell_temperature,
+					  thermal_conductivities[q_point],
+					  heat_capacities[q_point]);
+	      }
+	  }
+	if (!reuse_coefficients)
+	  {
+	    sum_factorization.cell_matrices (cell_size,heat_capacities,
+					     thermal_conductivities,
+					     cell_mass_matrix,cell_laplace_matrix);
+	    if (coefficient_cache.enabled())
+	      coefficient_cache.store_cell_matrices(cell_index,cell_mass_matrix,
+						    cell_laplace_matrix);
+	  }
+	sum_factorization.integrate (heat_loss_values,heat_loss_rhs);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  cell_rhs(lexicographic_numbering[i])=heat_loss_rhs[i];
+
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  for (unsigned int j=0; j<dofs_per_cell; ++j)
+	    {
+	      const double old_value=old_solution(local_dof_indices[j]);
+	      cell_system_matrix(i,j)=
+		cell_mass_matrix(i,j)+
+		theta*time_step*cell_laplace_matrix(i,j);
+	      if (scheme!=backward_euler)
+		cell_rhs(i)+=
+		  (cell_mass_matrix(i,j)-
+		   (1.-theta)*time_step*cell_laplace_matrix(i,j))*old_value;
+	      else
+		cell_rhs(i)+=
+		  cell_mass_matrix(i,j)*old_value;
+	    }
+
+	hanging_node_constraints.distribute_local_to_global (cell_system_matrix,
+							     cell_rhs,
+							     local_dof_indices,
+							     system_matrix,
+							     system_rhs);
+      }
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void Heat_Pipe<dim>::check_batched_assembly()
+  {
+    /*
+     * Assemble the cell terms with the generic and the batched (or sum
+     * factorized) kernel and compare. Only used when 'check batched
+     * assembly' is set, the system is reset afterwards. Lagged
+     * coefficients are evaluated afresh for both.
+     */
+    system_matrix=0.;
+    system_rhs   =0.;
+    coefficient_cache.invalidate();
+    assemble_cells<scheme>();
+    SparseMatrix<double> reference_matrix (sparsity_pattern);
+    reference_matrix.copy_from (system_matrix);
+    Vector<double> reference_rhs (system_rhs);
+
+    system_matrix=0.;
+    system_rhs   =0.;
+    coefficient_cache.invalidate();
+    if (batched_assembly)
+      assemble_cells_batched<scheme>();
+    else
+      assemble_cells_sum_factorized<scheme>();
+
+    const double matrix_norm=reference_matrix.frobenius_norm();
+    const double rhs_norm   =reference_rhs.l2_norm();
+    reference_matrix.add (-1.,system_matrix);
+    reference_rhs.add    (-1.,system_rhs);
+    const double matrix_error=
+      reference_matrix.frobenius_norm()/(matrix_norm>0. ? matrix_norm : 1.);
+    const double rhs_error=
+      reference_rhs.l2_norm()/(rhs_norm>0. ? rhs_norm : 1.);
+
+    if (logger.is_enabled(Logging::Logger::debug))
+      logger.stream() << "\tfast assembly relative differences: matrix "
+		      << matrix_error << "\trhs " << rhs_error << "\n";
+    if (matrix_error>1.E-12 || rhs_error>1.E-12)
+      {
+	std::cout << "Error, batched or sum factorized assembly differs from "
+		  << "the generic assembly\n";
+	throw 1;
+      }
+
+    system_matrix=0.;
+    system_rhs   =0.;
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme>
+  void Heat_Pipe<dim>::assemble_boundary_faces()
+  {
+    switch (top_boundary_condition)
+      {
+      case first_type_top:
+	assemble_face_terms<scheme,first_type_top>();
+	break;
+      case second_type_top:
+	assemble_face_terms<scheme,second_type_top>();
+	break;
+      case third_type_top:
+	assemble_face_terms<scheme,third_type_top>();
+	break;
+      }
+  }
+
+  template <int dim>
+  template <ThetaScheme scheme, TopBoundaryCondition top_condition>
+  void Heat_Pipe<dim>::assemble_face_terms()
+  {
+    /*
+     * Face terms. Only the faces collected in setup_boundary_faces() are
+     * visited, interior cells are never touched here.
+     */
+    if (boundary_faces.size()==0)
+      return;
+
+    const double theta=theta_value<scheme>(theta_temperature);
+
+    FEFaceValues<dim> &fe_face_values=scratch->fe_face_values;
+
+    const unsigned int dofs_per_cell   = fe.dofs_per_cell;
+
+    FullMatrix<double> &cell_laplace_matrix=scratch->cell_laplace_matrix;
+    FullMatrix<double> &cell_system_matrix =scratch->cell_system_matrix;
+    Vector<double>     &cell_rhs           =scratch->cell_rhs;
+
+    Vector<double> &old_temperature_values=scratch->old_temperature_values;
+
+    std::vector<types::global_dof_index> &local_dof_indices=scratch->local_dof_indices;
+
+    for (unsigned int f=0; f<boundary_faces.size(); ++f)
+      {
+	const typename DoFHandler<dim>::active_cell_iterator cell=
+	  boundary_faces[f].cell;
+	const unsigned int face=boundary_faces[f].face;
+
+	cell_laplace_matrix = 0;
+	cell_rhs            = 0;
+	bool matrix_changed=false;
+
+	fe_face_values.reinit (cell, face);
+
+	if (boundary_faces[f].boundary_id==top_boundary_id)
+	  matrix_changed=
+	    physics.template top_face_terms<scheme,top_condition>
+	    (fe_face_values,theta_temperature,time_step,
+	     old_surface_temperature,new_surface_temperature,
+	     cell_laplace_matrix,cell_rhs);
+	else if (boundary_faces[f].boundary_id==lateral_boundary_id)
+	  {
+	    /*
+	     * Heat exchange with the room through the lateral boundaries (only
+	     * present in 2D and 3D).
+	     */
+	    physics.template lateral_face_terms<scheme>
+	    (fe_face_values,theta_temperature,time_step,
+	     old_room_temperature,new_room_temperature,
+	     cell_laplace_matrix,cell_rhs);
+	    matrix_changed=true;
+	  }
+
+	cell->get_dof_indices (local_dof_indices);
+	if (matrix_changed)
+	  {
+	    cell->get_dof_values(old_solution,old_temperature_values);
+	    for (unsigned int i=0; i<dofs_per_cell; ++i)
+	      for (unsigned int j=0; j<dofs_per_cell; ++j)
+		{
+		  cell_system_matrix(i,j)=
+		    theta*time_step*cell_laplace_matrix(i,j);
+		  if (scheme!=backward_euler)
+		    cell_rhs(i)-=
+		      (1.-theta)*time_step*cell_laplace_matrix(i,j)*
+		      old_temperature_values(j);
+		}
+	    hanging_node_constraints.distribute_local_to_global (cell_system_matrix,
+								 cell_rhs,
+								 local_dof_indices,
+								 system_matrix,
+								 system_rhs);
+	  }
+	else
+	  hanging_node_constraints.distribute_local_to_global (cell_rhs,
+							       local_dof_indices,
+							       system_rhs);
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::apply_boundary_conditions()
+  {
+    Profiling::Profiler::Scope scope(profiler,boundary_conditions_section);
+
+    /*
+     * Hanging node constraints are already taken care of by
+     * distribute_local_to_global() during assembly.
+     */
+    const double top_value=
+      theta_temperature * new_surface_temperature +
+      (1-theta_temperature) * old_surface_temperature;
+    eliminate_dirichlet_rows_and_columns (system_matrix,&system_rhs,
+					  parameters.bottom_fixed_value,top_value);
+    if (parameters.fixed_at_bottom)
+      for (unsigned int k=0; k<bottom_boundary_dofs.size(); k++)
+	solution(bottom_boundary_dofs[k])=parameters.bottom_fixed_value;
+    if (top_boundary_condition==first_type_top)
+      for (unsigned int k=0; k<top_boundary_dofs.size(); k++)
+	solution(top_boundary_dofs[k])=top_value;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::eliminate_dirichlet_rows_and_columns(SparseMatrix<double> &matrix,
+							    Vector<double>       *rhs,
+							    const double          bottom_value,
+							    const double          top_value)
+  {
+    /*
+     * Same as MatrixTools::apply_boundary_values with eliminate_columns=true,
+     * but working on the cached lists of Dirichlet dofs (bottom if fixed,
+     * top with a first type condition). The row and the column of each of
+     * them are reduced to the diagonal. If 'rhs' is given, the column
+     * entries times the boundary value are moved to it, and its entry at
+     * the dof is set to the diagonal times the boundary value. The column
+     * entries are found through the row of the dof and the symmetric
+     * sparsity pattern, and their values are taken from the row: nonzero
+     * boundary values need a symmetric matrix. The updates of the Newton
+     * type solves (adjoint, steady state) have zero boundary values.
+     */
+    for (unsigned int b=0; b<2; b++)
+      {
+	if ((b==0 && !parameters.fixed_at_bottom) ||
+	    (b==1 && top_boundary_condition!=first_type_top))
+	  continue;
+	const std::vector<types::global_dof_index> &boundary_dofs=
+	  (b==0 ? bottom_boundary_dofs : top_boundary_dofs);
+	const double boundary_value=(b==0 ? bottom_value : top_value);
+	for (unsigned int k=0; k<boundary_dofs.size(); k++)
+	  {
+	    const types::global_dof_index i=boundary_dofs[k];
+	    for (SparseMatrix<double>::iterator entry=matrix.begin(i);
+		 entry!=matrix.end(i); ++entry)
+	      if (entry->column()!=i)
+		{
+		  if (rhs!=0)
+		    (*rhs)(entry->column())-=entry->value()*boundary_value;
+		  matrix.set(entry->column(),i,0.);
+		  entry->value()=0.;
+		}
+	    if (rhs!=0)
+	      (*rhs)(i)=matrix.diag_element(i)*boundary_value;
+	  }
+      }
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::solve_temperature()
+  {
+    Profiling::Profiler::Scope scope(profiler,linear_solve_section);
+
+    if (single_precision_solver)
+      return solve_temperature_mixed_precision();
+
+    SolverControl &solver_control=linear_solver_control;
+    solver_control.set_max_steps (solution.size());
+    solver_control.set_tolerance (1e-8*system_rhs.l2_norm ());
+    SolverCG<> &cg=*linear_solver;
+
+    if (parameters.preconditioner.compare("amg")==0)
+      {
+	/*
+	 * The system matrix changes every Picard iteration (the heat
+	 * capacity depends on temperature) but its sparsity pattern does
+	 * not. The built-in AMG keeps its aggregates and only recomputes
+	 * the coarse operators, Trilinos' AMG is rebuilt.
+	 */
+#ifdef DEAL_II_WITH_TRILINOS
+	TrilinosWrappers::PreconditionAMG::AdditionalData amg_data;
+	amg_data.elliptic              = true;
+	amg_data.higher_order_elements = (fe.degree>1);
+	amg_data.aggregation_threshold = parameters.amg_aggregation_threshold;
+	amg_data.smoother_sweeps       = parameters.amg_smoother_sweeps;
+	amg_preconditioner.initialize (system_matrix, amg_data);
+#else
+	if (amg_preconditioner.n_levels()==0)
+	  {
+	    LinearSolvers::PreconditionSmoothedAggregation<double>::AdditionalData
+	      amg_data (parameters.amg_aggregation_threshold,
+			parameters.amg_smoother_sweeps);
+	    amg_preconditioner.initialize (system_matrix, amg_data);
+	    if (!amg_preconditioner.direct_coarse_solve() &&
+		logger.is_enabled(Logging::Logger::normal))
+	      logger.stream() << "Warning, AMG coarsening stopped at "
+			      << amg_preconditioner.coarse_size()
+			      << " unknowns, the coarsest level is smoothed with SSOR "
+			      << "instead of solved exactly\n";
+	  }
+	else
+	  amg_preconditioner.reinit_values (system_matrix);
+#endif
+	cg.solve (system_matrix, solution, system_rhs,
+		  amg_preconditioner);
+      }
+    else
+      {
+	ssor_preconditioner.initialize (system_matrix, 1.2);
+
+	cg.solve (system_matrix, solution, system_rhs,
+		  ssor_preconditioner);
+      }
+
+    hanging_node_constraints.distribute (solution);
+
+    return solver_control.last_step();
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::solve_temperature_mixed_precision()
+  {
+    /*
+     * Iterative refinement. The residual of the double precision system is
+     * computed in double precision, and the correction is found with CG on
+     * a single precision copy of the matrix, to the relative tolerance
+     * 'mixed precision inner tolerance'. The correction is added to the
+     * double precision solution, and the loop stops at the same residual
+     * as solve_temperature() does in double precision. Each step reduces
+     * the residual by about the inner tolerance, so a couple of steps are
+     * usually enough.
+     *
+     * The copy below reads the double precision matrix and writes the
+     * single precision one on every solve, and the copy adds half the
+     * memory of the system matrix. Each outer step also computes a double
+     * precision residual. This only pays off when the inner CG iterations
+     * dominate, i.e. large systems that need many iterations per solve;
+     * for small columns 'double' is faster.
+     */
+    const unsigned int max_refinement_steps=20;
+    const double tolerance=1e-8*system_rhs.l2_norm();
+
+    solver_matrix.copy_from (system_matrix);
+
+    PreconditionSSOR<SparseMatrix<float> > &ssor_preconditioner=solver_ssor_preconditioner;
+    const bool use_amg=(parameters.preconditioner.compare("amg")==0);
+    if (use_amg)
+      {
+	if (solver_amg_preconditioner.n_levels()==0)
+	  {
+	    LinearSolvers::PreconditionSmoothedAggregation<float>::AdditionalData
+	      amg_data (parameters.amg_aggregation_threshold,
+			parameters.amg_smoother_sweeps);
+	    solver_amg_preconditioner.initialize (solver_matrix, amg_data);
+	    if (!solver_amg_preconditioner.direct_coarse_solve() &&
+		logger.is_enabled(Logging::Logger::normal))
+	      logger.stream() << "Warning, AMG coarsening stopped at "
+			      << solver_amg_preconditioner.coarse_size()
+			      << " unknowns, the coarsest level is smoothed with SSOR "
+			      << "instead of solved exactly\n";
+	  }
+	else
+	  solver_amg_preconditioner.reinit_values (solver_matrix);
+      }
+    else
+      ssor_preconditioner.initialize (solver_matrix, 1.2);
+
+    unsigned int iterations=0;
+    for (unsigned int step=0; ; ++step)
+      {
+	const double residual_norm=
+	  system_matrix.residual (refinement_residual, solution, system_rhs);
+	if (residual_norm<=tolerance)
+	  break;
+	if (step==max_refinement_steps)
+	  {
+	    std::cout << "Error, iterative refinement did not converge. Residual: "
+		      << residual_norm << "\tTolerance: " << tolerance << "\n";
+	    throw 1;
+	  }
+
+	solver_rhs       =refinement_residual;
+	solver_correction=0.;
+	SolverControl &solver_control=inner_solver_control;
+	solver_control.set_max_steps (solution.size());
+	solver_control.set_tolerance (parameters.mixed_precision_inner_tolerance*residual_norm);
+	SolverCG<Vector<float> > &cg=*inner_linear_solver;
+	if (use_amg)
+	  cg.solve (solver_matrix, solver_correction, solver_rhs,
+		    solver_amg_preconditioner);
+	else
+	  cg.solve (solver_matrix, solver_correction, solver_rhs,
+		    ssor_preconditioner);
+	iterations+=solver_control.last_step();
+
+	for (unsigned int i=0; i<solution.size(); ++i)
+	  solution(i)+=solver_correction(i);
+      }
+
+    hanging_node_constraints.distribute (solution);
+
+    return iterations;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::total_thermal_energy(const Vector<double> &temperature)
+  {
+    FEValues<dim> &fe_values=scratch->value_fe_values;
+    const unsigned int n_q_points=quadrature_formula.size();
+    std::vector<double> &temperature_values=scratch->temperature_values;
+
+    double energy=0.;
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	fe_values.reinit (cell);
+	fe_values.get_function_values(temperature,temperature_values);
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  energy+=
+	    physics.thermal_energy(cell->center()[dim-1],temperature_values[q_point])*
+	    fe_values.JxW(q_point);
+      }
+    return energy;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::compute_diagnostics()
+  {
+    Profiling::Profiler::Scope scope(profiler,diagnostics_section);
+    /*
+     * Energy balance of the accepted time step, between the solutions at
+     * its start (old_solution) and its end. The heat rates are positive
+     * into the domain and were added by add_heat_rates() with the weights
+     * of the time integrator, so that
+     *   E(new)-E(old) = time_step*(top+bottom+lateral+point sources+losses)
+     * up to the discretization and Picard errors. The difference is
+     * accumulated in energy_balance_error.
+     */
+    old_column_thermal_energy=column_thermal_energy;
+    column_thermal_energy    =total_thermal_energy(solution);
+
+    energy_balance_error+=
+      (column_thermal_energy-old_column_thermal_energy)-
+      time_step*(heat_flux_top+heat_flux_bottom+heat_flux_lateral+
+		 point_source_rate+heat_loss_rate);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::reset_heat_rates()
+  {
+    heat_flux_top     =0.;
+    heat_flux_bottom  =0.;
+    heat_flux_lateral =0.;
+    heat_loss_rate    =0.;
+    point_source_rate =0.;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::add_heat_rates(const Vector<double> &old_temperature,
+				      const Vector<double> &new_temperature,
+				      const double          theta,
+				      const double          weight)
+  {
+    Profiling::Profiler::Scope scope(profiler,diagnostics_section);
+    /*
+     * Adds weight times the heat rates between old_temperature and
+     * new_temperature, theta weighted like the time discretization, with
+     * the current forcing values. The theta method adds those of the step
+     * (weight 1), bdf2 and sdirk2 those of each stage (theta 1) with the
+     * weight of the stage in the update of the solution.
+     */
+    FEValues<dim>     &fe_values     =scratch->value_fe_values;
+    FEFaceValues<dim> &fe_face_values=scratch->fe_face_values;
+
+    std::vector<double>         &old_values        =scratch->old_function_values;
+    std::vector<double>         &new_values        =scratch->new_function_values;
+    std::vector<double>         &old_face_values   =scratch->old_face_values;
+    std::vector<double>         &new_face_values   =scratch->new_face_values;
+    std::vector<Tensor<1,dim> > &old_face_gradients=scratch->old_face_gradients;
+    std::vector<Tensor<1,dim> > &new_face_gradients=scratch->new_face_gradients;
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	if (parameters.heat_loss_factor>0.)
+	  {
+	    fe_values.reinit (cell);
+	    fe_values.get_function_values(old_temperature,old_values);
+	    fe_values.get_function_values(new_temperature,new_values);
+	    heat_loss_rate+=
+	      weight*
+	      physics.cell_heat_loss_rate(fe_values,old_values,new_values,theta,
+					  old_room_temperature,new_room_temperature);
+	  }
+
+	if (!cell->at_boundary())
+	  continue;
+
+	for (unsigned int face=0; face<GeometryInfo<dim>::faces_per_cell; ++face)
+	  if (cell->face(face)->at_boundary())
+	    {
+	      const types::boundary_id boundary_id=cell->face(face)->boundary_id();
+
+	      fe_face_values.reinit (cell, face);
+	      fe_face_values.get_function_values   (old_temperature,old_face_values);
+	      fe_face_values.get_function_values   (new_temperature,new_face_values);
+	      fe_face_values.get_function_gradients(old_temperature,old_face_gradients);
+	      fe_face_values.get_function_gradients(new_temperature,new_face_gradients);
+
+	      const double rate=
+		weight*
+		physics.boundary_heat_rate(fe_face_values,boundary_id,
+					   top_boundary_condition,
+					   cell->center()[dim-1],theta,
+					   old_face_values,new_face_values,
+					   old_face_gradients,new_face_gradients,
+					   old_surface_temperature,new_surface_temperature,
+					   old_room_temperature,new_room_temperature);
+	      if (boundary_id==top_boundary_id)
+		heat_flux_top+=rate;
+	      else if (boundary_id==bottom_boundary_id)
+		heat_flux_bottom+=rate;
+	      else if (boundary_id==lateral_boundary_id)
+		heat_flux_lateral+=rate;
+	    }
+      }
+
+    for (unsigned int s=0; s<point_source_weights.size(); s++)
+      point_source_rate+=
+	weight*
+	(theta*new_point_source_magnitudes[s]+
+	 (1.-theta)*old_point_source_magnitudes[s]);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::fill_output_vectors()
+  {
+    Profiling::Profiler::Scope scope(profiler,probe_extraction_section);
+    /*
+     * Extract and save temperatures at selected coordinates.
+     **/
+    evaluate_probes();
+    /*
+     * Save them to some file.
+     */
+    record_output();
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_output_aggregators()
+  {
+    /*
+     * Each channel is given as 'name period'. Its file name is the one of
+     * the output file with 'name_' in front.
+     */
+    const std::string::size_type separator=parameters.output_file.rfind('/');
+    const std::string directory=
+      (separator==std::string::npos ? "" : parameters.output_file.substr(0,separator+1));
+    const std::string basename=
+      (separator==std::string::npos ? parameters.output_file :
+       parameters.output_file.substr(separator+1));
+
+    output_aggregators.clear();
+    for (unsigned int c=0; c<parameters.aggregated_output.size(); c++)
+      {
+	std::istringstream channel (parameters.aggregated_output[c]);
+	std::string name;
+	double period=0.;
+	if (!(channel >> name >> period))
+	  {
+	    std::cout << "Error, wrong aggregated output channel '"
+		      << parameters.aggregated_output[c]
+		      << "', expected 'name period'\n";
+	    throw 1;
+	  }
+	output_aggregators.push_back
+	  (std::unique_ptr<OutputAggregator>
+	   (new OutputAggregator(name,period,depths_coordinates.size(),
+				 parameters.freezing_point,
+				 directory+name+"_"+basename)));
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_monitor()
+  {
+    monitor.reset();
+    if (parameters.monitor_shared_memory.size()==0)
+      return;
+
+    monitor.reset(new Monitoring::Publisher(parameters.monitor_shared_memory,
+					    parameters.monitor_buffer_size,
+					    depths_coordinates.size()));
+    monitor_record.assign(monitor->record_size(),0.);
+    if (logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "Publishing time steps to shared memory "
+		      << parameters.monitor_shared_memory << " ("
+		      << parameters.monitor_buffer_size << " records)\n";
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::publish_monitor_record(const unsigned int picard_iterations,
+					      const unsigned int linear_iterations)
+  {
+    if (!monitor)
+      return;
+
+    monitor_record[Monitoring::step_field]             =timestep_number;
+    monitor_record[Monitoring::time_field]             =time;
+    monitor_record[Monitoring::time_step_field]        =time_step;
+    monitor_record[Monitoring::picard_iterations_field]=picard_iterations;
+    monitor_record[Monitoring::linear_iterations_field]=linear_iterations;
+    monitor_record[Monitoring::thermal_energy_field]   =column_thermal_energy;
+    monitor_record[Monitoring::heat_flux_top_field]    =heat_flux_top;
+    monitor_record[Monitoring::heat_flux_bottom_field] =heat_flux_bottom;
+    monitor_record[Monitoring::heat_flux_lateral_field]=heat_flux_lateral;
+    monitor_record[Monitoring::point_source_rate_field]=point_source_rate;
+    monitor_record[Monitoring::heat_loss_rate_field]   =heat_loss_rate;
+    monitor_record[Monitoring::balance_error_field]    =energy_balance_error;
+    for (unsigned int i=0; i<probe_values.size(); i++)
+      monitor_record[Monitoring::n_fields+i]=probe_values[i];
+    monitor->publish(monitor_record);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::record_output()
+  {
+    if (parameters.full_rate_output)
+      write_output_line(output_file);
+    for (unsigned int c=0; c<output_aggregators.size(); c++)
+      output_aggregators[c]->add(time,time_step,probe_values);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::finish_output_aggregators()
+  {
+    for (unsigned int c=0; c<output_aggregators.size(); c++)
+      {
+	output_aggregators[c]->finish();
+	if (logger.is_enabled(Logging::Logger::normal))
+	  {
+	    std::ostream &out=logger.stream();
+	    out << "Aggregated output '" << output_aggregators[c]->get_name() << "': "
+		<< output_aggregators[c]->n_windows() << " windows\n"
+		<< "\tfreeze-thaw windows per probe:";
+	    for (unsigned int i=0; i<output_aggregators[c]->freeze_thaw_windows().size(); i++)
+	      out << " " << output_aggregators[c]->freeze_thaw_windows()[i];
+	    out << "\n";
+	  }
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::write_output_line(std::ostream &out) const
+  {
+    ColumnPhysics<dim>::write_output_line (out,parameters.output_precision,
+					   timestep_number,timestep_number*time_step,
+					   probe_values,column_thermal_energy,
+					   heat_flux_top,heat_flux_bottom,heat_flux_lateral,
+					   point_source_rate,heat_loss_rate,
+					   energy_balance_error);
+    /*
+     * Lines are flushed one by one for those who follow the file while
+     * the program runs, unless the time steps are published in shared
+     * memory for that.
+     */
+    if (!monitor)
+      out.flush();
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::evaluate_probes()
+  {
+    for (unsigned int i=0; i<probe_weights.size(); i++)
+      {
+	double value=0.;
+	for (unsigned int j=0; j<probe_weights[i].size(); j++)
+	  value+=probe_weights[i][j].second*solution(probe_weights[i][j].first);
+	probe_values[i]=value;
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::output_results()
+  {
+    Profiling::Profiler::Scope scope(profiler,vtu_output_section);
+
+    FEValues<dim> fe_values(fe, quadrature_formula,
+			    update_values | update_gradients |
+			    update_quadrature_points | update_JxW_values);
+    const unsigned int n_q_points      = quadrature_formula.size();
+    std::vector<double> old_function_values     (n_q_points);
+    std::vector<double> new_function_values     (n_q_points);    
+    
+    std::vector<double> ice_saturation_int;
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	fe_values.reinit (cell);
+	fe_values.get_function_values(old_solution,old_function_values);
+	fe_values.get_function_values(    solution,new_function_values);
+	
+	double average_cell_temperature=0.;
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    average_cell_temperature+=
+	      (   theta_temperature)*new_function_values[q_point]+
+	      (1.-theta_temperature)*new_function_values[q_point];
+	  }
+	average_cell_temperature/=n_q_points;
+	
+	double cell_thermal_conductivity          = -1.E10;
+	double cell_total_volumetric_heat_capacity= -1.E10;
+	double cell_ice_saturation                = -1.E10;
+	physics.material_data(cell->center()[dim-1],average_cell_temperature,
+			      cell_thermal_conductivity,cell_total_volumetric_heat_capacity,
+			      cell_ice_saturation);
+	
+	ice_saturation_int.push_back(cell_ice_saturation);
+      }
+    const Vector<double> ice_saturation(ice_saturation_int.begin(),ice_saturation_int.end());
+
+    DataOut<dim> data_out;
+    data_out.attach_dof_handler(dof_handler);
+    data_out.add_data_vector(solution,"solution");
+    data_out.add_data_vector(ice_saturation,"ice_saturation");
+    data_out.build_patches(fe.degree);
+
+    std::stringstream t;
+    t << timestep_number;
+
+    std::stringstream d;
+    d << dim;
+
+    std::string filename = parameters.output_directory + "/solution_"
+      + d.str() + "d_time_"
+      + t.str() + ".vtu";
+
+    std::ofstream output (filename.c_str());
+    data_out.write_vtu (output);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::update_met_data ()
+  {
+    Profiling::Profiler::Scope scope(profiler,forcing_section);
+
+    /*
+     * Forcing at the start and the end of the step (see ColumnPhysics).
+     */
+    if (top_boundary_condition==first_type_top ||
+	top_boundary_condition==third_type_top)
+      {
+	old_room_temperature    = physics.room_temperature   (time          );
+	new_room_temperature    = physics.room_temperature   (time+time_step);
+	old_surface_temperature = physics.surface_temperature(time          );
+	new_surface_temperature = physics.surface_temperature(time+time_step);
+      }
+
+    if (parameters.point_source==true)
+      for (unsigned int s=0; s<parameters.point_source_files.size(); s++)
+	{
+	  old_point_source_magnitudes[s]=physics.point_source_magnitude(s,time          );
+	  new_point_source_magnitudes[s]=physics.point_source_magnitude(s,time+time_step);
+	}
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::initial_condition_temperature()
+  {
+    Profiling::Profiler::Scope scope(profiler,initial_condition_section);
+    if (parameters.initial_condition.compare("steady state")==0)
+      {
+	steady_state_initial_condition();
+	return;
+      }
+    /*
+      Here the vectors containing the name of the file with 
+      the initial condition is defined
+    */
+    std::vector< std::string > filenames;
+    filenames.push_back(parameters.initial_condition_file);
+    /*
+      And the vector containing the actual data (depth and
+      temperature). Note that it is actually a vector of
+      vector so, rather, a matrix.
+      We use an external function to read the data and fill
+      the initial condition matrix.
+    */
+    std::vector< std::vector<int> > dummy_matrix;
+
+    std::vector< std::vector<double> > initial_condition;
+    DataTools data_tools;
+    data_tools.read_data(filenames,
+			 initial_condition);
+    /*
+      The format of the matrix need to be changed from:
+
+      ' std::vector< std::vector<double> > '
+      to
+      ' std::vector< std::pair<double,double> > '
+
+      this is because the function that interpolates the 
+      depths from the provided file takes this kind of
+      format. Note that it is assumed that the matrix
+      has two elements per row. If more are provided
+      they will be ignored.
+    */
+    std::vector< std::pair<double,double> > initial_condition_table;
+    for (unsigned int i=0; i<initial_condition.size(); i++)
+      initial_condition_table
+	.push_back(std::make_pair(initial_condition[i][0],
+				  initial_condition[i][1]));
+    /*
+      Print number of lines available in the initial
+      condition file and the actual data read.
+      Currently it is expected a file with the following 
+      format:
+      Depth (m) \t Temperature (C)  <-- this line is not expected in the file
+
+      0.0             T0
+      d1              T1
+      ...             ...
+      dN              TN
+
+      Note that the file starts with the temperature at x=0 m.
+      If other depth is provided in the first line, the program
+      will probalbly throw a not very informative error. Also,
+      all depth values are positive.
+    */
+    if (logger.is_enabled(Logging::Logger::normal))
+      {
+	logger.stream() << "Available initial condition entries: "
+			<< initial_condition.size()    << "\n"
+			<< "Initial condition: \n\tDepth\tTemperature (C)\n";
+	for (unsigned int i=0; i<initial_condition.size(); i++)
+	  logger.stream() << "\t" << initial_condition[i][0] << "\t" << initial_condition[i][1] << "\n";
+      }
+
+    project_initial_condition (initial_condition_table);
+
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::project_initial_condition(const std::vector< std::pair<double,double> > &initial_condition_table)
+  {
+    VectorTools::project (dof_handler,
+			  hanging_node_constraints,
+			  QGauss<dim>(fe.degree+1),
+			  VerticalProfile<dim>(initial_condition_table),
+			  old_solution);
+
+    // VectorTools::project (dof_handler,
+    // 			  hanging_node_constraints,
+    // 			  QGauss<dim>(3),
+    // 			  InitialValue<dim>(10.),
+    // 			  old_solution);
+    solution=old_solution;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::steady_state_initial_condition()
+  {
+    /*
+     * Steady state of the column for the time average of the forcing: the
+     * mean surface and room temperatures (of the file or of the sinusoid),
+     * the fixed bottom value and the fixed top heat flux. The point sources
+     * are left out, their daily modulation averages to zero. The residual
+     * of the stationary equation (see assemble_cells() and
+     * assemble_face_terms() for the terms) is
+     *
+     *   R(T) = K T + H (T-T_room) + boundary terms
+     *
+     * The thermal conductivity of the material model does not depend on
+     * the temperature (see ColumnPhysics::material_data()), so the problem
+     * is linear and a single solve of (K+H+boundary terms) dT = -R(T_0),
+     * with dT=0 on the Dirichlet dofs, gives the steady state from a
+     * uniform guess T_0 with the Dirichlet values set.
+     */
+    if (!parameters.fixed_at_bottom &&
+	top_boundary_condition!=first_type_top &&
+	top_boundary_condition!=third_type_top &&
+	parameters.heat_loss_factor==0. &&
+	(dim==1 || parameters.lateral_heat_transfer_coefficient==0.))
+      {
+	std::cout << "Error, the steady state initial condition needs a fixed "
+		  << "temperature or a heat exchange at some boundary, or heat "
+		  << "losses\n";
+	throw 1;
+      }
+
+    double surface_temperature=0.;
+    double room_temperature   =0.;
+    if (top_boundary_condition==first_type_top ||
+	top_boundary_condition==third_type_top)
+      {
+	surface_temperature=physics.mean_surface_temperature();
+	room_temperature   =physics.mean_room_temperature();
+      }
+
+    FEValues<dim> fe_values(fe, quadrature_formula,
+			    update_values | update_gradients | update_JxW_values);
+    FEFaceValues<dim> fe_face_values(fe, face_quadrature_formula,
+				     update_values | update_JxW_values);
+
+    const unsigned int dofs_per_cell   = fe.dofs_per_cell;
+    const unsigned int n_q_points      = quadrature_formula.size();
+    const unsigned int n_face_q_points = face_quadrature_formula.size();
+
+    FullMatrix<double> cell_matrix (dofs_per_cell,dofs_per_cell);
+    Vector<double>     cell_rhs    (dofs_per_cell);
+    std::vector<types::global_dof_index> local_dof_indices (dofs_per_cell);
+    std::vector<double>         values    (n_q_points);
+    std::vector<Tensor<1,dim> > gradients (n_q_points);
+    std::vector<double>         face_values (n_face_q_points);
+    Vector<double> update (dof_handler.n_dofs());
+
+    if (top_boundary_condition==first_type_top)
+      solution=surface_temperature;
+    else if (parameters.fixed_at_bottom)
+      solution=parameters.bottom_fixed_value;
+    else
+      solution=room_temperature;
+    if (parameters.fixed_at_bottom)
+      for (unsigned int k=0; k<bottom_boundary_dofs.size(); k++)
+	solution(bottom_boundary_dofs[k])=parameters.bottom_fixed_value;
+    if (top_boundary_condition==first_type_top)
+      for (unsigned int k=0; k<top_boundary_dofs.size(); k++)
+	solution(top_boundary_dofs[k])=surface_temperature;
+
+    if (logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "Steady state initial condition: mean surface temperature "
+		      << surface_temperature << " C, mean room temperature "
+		      << room_temperature << " C\n";
+
+    system_matrix=0.;
+    system_rhs   =0.;
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	cell_matrix=0;
+	cell_rhs   =0;
+	fe_values.reinit (cell);
+	fe_values.get_function_values   (solution,values);
+	fe_values.get_function_gradients(solution,gradients);
+
+	const double cell_center=cell->center()[dim-1];
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    double thermal_conductivity          =0.;
+	    double total_volumetric_heat_capacity=0.;
+	    double ice_saturation                =0.;
+	    physics.material_data(cell_center,values[q_point],
+				  thermal_conductivity,total_volumetric_heat_capacity,
+				  ice_saturation);
+
+	    for (unsigned int i=0; i<dofs_per_cell; ++i)
+	      {
+		for (unsigned int j=0; j<dofs_per_cell; ++j)
+		  cell_matrix(i,j)+=
+		    (parameters.heat_loss_factor*
+		     fe_values.shape_value(i,q_point)*
+		     fe_values.shape_value(j,q_point)+
+		     thermal_conductivity*
+		     (fe_values.shape_grad(i,q_point)*
+		      fe_values.shape_grad(j,q_point)))*
+		    fe_values.JxW(q_point);
+		cell_rhs(i)-=
+		  (parameters.heat_loss_factor*(values[q_point]-room_temperature)*
+		   fe_values.shape_value(i,q_point)+
+		   thermal_conductivity*
+		   (gradients[q_point]*fe_values.shape_grad(i,q_point)))*
+		  fe_values.JxW(q_point);
+	      }
+	  }
+	cell->get_dof_indices (local_dof_indices);
+	hanging_node_constraints.distribute_local_to_global (cell_matrix,
+							     cell_rhs,
+							     local_dof_indices,
+							     system_matrix,
+							     system_rhs);
+      }
+
+    /*
+     * Heat exchange h (T-T_ext) on the top (third type) and lateral
+     * faces, and the fixed inbound heat flux on the top (second type).
+     */
+    for (unsigned int f=0; f<boundary_faces.size(); ++f)
+      {
+	double h=0.;
+	double exterior_temperature=0.;
+	double inbound_heat_flux=0.;
+	if (boundary_faces[f].boundary_id==top_boundary_id &&
+	    top_boundary_condition==third_type_top)
+	  {
+	    h=top_convective_coefficient;
+	    exterior_temperature=surface_temperature;
+	  }
+	else if (boundary_faces[f].boundary_id==top_boundary_id &&
+		 top_boundary_condition==second_type_top)
+	  inbound_heat_flux=top_fixed_heat_flux;
+	else if (boundary_faces[f].boundary_id==lateral_boundary_id)
+	  {
+	    h=parameters.lateral_heat_transfer_coefficient;
+	    exterior_temperature=room_temperature;
+	  }
+	if (h==0. && inbound_heat_flux==0.)
+	  continue;
+
+	cell_matrix=0;
+	cell_rhs   =0;
+	fe_face_values.reinit (boundary_faces[f].cell,boundary_faces[f].face);
+	fe_face_values.get_function_values (solution,face_values);
+	for (unsigned int q_face_point=0; q_face_point<n_face_q_points; ++q_face_point)
+	  for (unsigned int i=0; i<dofs_per_cell; ++i)
+	    {
+	      for (unsigned int j=0; j<dofs_per_cell; ++j)
+		cell_matrix(i,j)+=
+		  h*
+		  fe_face_values.shape_value (i,q_face_point) *
+		  fe_face_values.shape_value (j,q_face_point) *
+		  fe_face_values.JxW         (q_face_point);
+	      cell_rhs(i)+=
+		(inbound_heat_flux-
+		 h*(face_values[q_face_point]-exterior_temperature))*
+		fe_face_values.shape_value (i,q_face_point) *
+		fe_face_values.JxW         (q_face_point);
+	    }
+	boundary_faces[f].cell->get_dof_indices (local_dof_indices);
+	hanging_node_constraints.distribute_local_to_global (cell_matrix,
+							     cell_rhs,
+							     local_dof_indices,
+							     system_matrix,
+							     system_rhs);
+      }
+
+    /*
+     * No update on the Dirichlet dofs.
+     */
+    eliminate_dirichlet_rows_and_columns (system_matrix,&system_rhs);
+
+    update=0.;
+    if (system_rhs.l2_norm()>0.)
+      {
+	Profiling::Profiler::Scope scope(profiler,linear_solve_section);
+	SolverControl solver_control (std::max<unsigned int>(1000,update.size()),
+				      1e-12*system_rhs.l2_norm ());
+	SolverCG<> cg (solver_control);
+	PreconditionSSOR<> preconditioner;
+	preconditioner.initialize (system_matrix, 1.2);
+	cg.solve (system_matrix, update, system_rhs,
+		  preconditioner);
+	hanging_node_constraints.distribute (update);
+      }
+    solution+=update;
+    old_solution=solution;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_problem()
+  {
+    {
+      Profiling::Profiler::Scope scope(profiler,mesh_setup_section);
+      read_grid_temperature();
+      setup_system_temperature();
+      solution.reinit (dof_handler.n_dofs());
+      old_solution.reinit (dof_handler.n_dofs());
+      if (time_integrator!=theta_method)
+	{
+	  stage_history.reinit (dof_handler.n_dofs());
+	  stage_solution.reinit (dof_handler.n_dofs());
+	}
+    }
+    profiler.set_info("dimension",dim);
+    profiler.set_info("n_active_cells",triangulation.n_active_cells());
+    profiler.set_info("n_dofs",dof_handler.n_dofs());
+    profiler.set_info("mixed_precision_solver",single_precision_solver);
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::solve_time_step(unsigned int &linear_iterations)
+  {
+    /*
+     * Time step from time to time+time_step, with the forcing values
+     * already set. On return the time is advanced and the diagnostics are
+     * updated, old_solution and older_solution are left untouched.
+     * Returns the number of Picard iterations of all stages.
+     */
+    unsigned int iterations=0;
+    reset_heat_rates();
+    if (time_integrator==bdf2 && older_solution.size()==solution.size())
+      iterations=solve_bdf2_step(linear_iterations);
+    else if (time_integrator!=theta_method)
+      iterations=solve_sdirk2_step(linear_iterations);
+    else
+      {
+	/*
+	 * Away from the freezing point a single linear solve is enough. If
+	 * the step ends in the phase change band it is repeated with Picard
+	 * iterations from the old solution.
+	 */
+	if (parameters.linear_fast_path &&
+	    linear_regime(old_solution) &&
+	    solve_linear_step(linear_iterations))
+	  profiler.count(linear_steps_counter);
+	else
+	  iterations=solve_picard(linear_iterations);
+	add_heat_rates(old_solution,solution,theta_temperature,1.);
+      }
+    compute_diagnostics();
+
+    profiler.count(time_steps_counter);
+    profiler.count(picard_iterations_counter,iterations);
+    profiler.count(linear_iterations_counter,linear_iterations);
+
+    time+=time_step;
+    return iterations;
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::solve_picard(unsigned int &linear_iterations)
+  {
+    unsigned int iteration=0;
+    double total_error =1.E10;
+    double solution_l1_norm_previous_iteration;
+    double solution_l1_norm_current_iteration;
+    do
+      {
+	assemble_system_temperature();
+	apply_boundary_conditions();
+	solution_l1_norm_previous_iteration=solution.l2_norm();
+	linear_iterations+=solve_temperature();
+	solution_l1_norm_current_iteration=solution.l2_norm();
+	total_error=
+	  1.-std::fabs(solution_l1_norm_previous_iteration/solution_l1_norm_current_iteration);
+	iteration++;
+      }while (std::fabs(total_error)>5E-4);
+
+    return iteration;
+  }
+
+  template <int dim>
+  bool Heat_Pipe<dim>::linear_regime(const Vector<double> &temperature) const
+  {
+    /*
+     * Nodal temperatures bound the temperatures inside linear cells. For
+     * higher degrees the band gives some room for overshoots.
+     */
+    if (time_integrator!=theta_method ||
+	hanging_node_constraints.n_constraints()!=0)
+      return false;
+    const double lowest_temperature=
+      parameters.freezing_point+parameters.coefficient_freezing_band;
+    for (unsigned int i=0; i<temperature.size(); i++)
+      if (temperature(i)<=lowest_temperature)
+	return false;
+    return true;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_linear_operators()
+  {
+    /*
+     * Same terms as assemble_cells() and assemble_face_terms(), with the
+     * material properties at the old temperatures, and with the heat
+     * losses (linear in the temperature) moved from the rhs to the
+     * matrices:
+     *   A = K + R + c M0
+     * with K the conductivity matrix, R the top (third type) and lateral
+     * exchange terms and c M0 the heat loss factor times the unweighted
+     * mass matrix. Then
+     *   linear_system_matrix  =M + theta dt A
+     *   linear_explicit_matrix=M - (1-theta) dt A
+     */
+    Profiling::Profiler::Scope scope(profiler,assembly_section);
+
+    const double theta=theta_temperature;
+    const double loss_factor=parameters.heat_loss_factor;
+
+    linear_system_matrix.reinit (sparsity_pattern);
+    linear_explicit_matrix.reinit (sparsity_pattern);
+    linear_solver_matrix.reinit (sparsity_pattern);
+    linear_top_load.reinit (dof_handler.n_dofs());
+    linear_room_load.reinit (dof_handler.n_dofs());
+    linear_boundary_values.reinit (dof_handler.n_dofs());
+
+    FEValues<dim>     &fe_values     =scratch->fe_values;
+    FEFaceValues<dim> &fe_face_values=scratch->fe_face_values;
+    const unsigned int dofs_per_cell   = fe.dofs_per_cell;
+    const unsigned int n_q_points      = quadrature_formula.size();
+    const unsigned int n_face_q_points = face_quadrature_formula.size();
+
+    FullMatrix<double> &cell_mass_matrix  =scratch->cell_mass_matrix;
+    FullMatrix<double> &cell_matrix       =scratch->cell_laplace_matrix;
+    FullMatrix<double> &cell_system_matrix=scratch->cell_system_matrix;
+    Vector<double>     &cell_room_load    =scratch->cell_rhs;
+    Vector<double>     &cell_top_load     =scratch->old_temperature_values;
+    std::vector<types::global_dof_index> &local_dof_indices=scratch->local_dof_indices;
+    std::vector<double> &temperature_values=scratch->old_function_values;
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	cell_mass_matrix = 0;
+	cell_matrix      = 0;
+	cell_room_load   = 0;
+	fe_values.reinit (cell);
+	fe_values.get_function_values(old_solution,temperature_values);
+
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    double thermal_conductivity          = -1.E10;
+	    double total_volumetric_heat_capacity= -1.E10;
+	    double ice_saturation                = -1.E10;
+	    physics.material_data(cell->center()[dim-1],temperature_values[q_point],
+				  thermal_conductivity,total_volumetric_heat_capacity,
+				  ice_saturation);
+	    for (unsigned int i=0; i<dofs_per_cell; ++i)
+	      {
+		for (unsigned int j=0; j<dofs_per_cell; ++j)
+		  {
+		    cell_mass_matrix(i,j)+=
+		      total_volumetric_heat_capacity*
+		      fe_values.shape_value(i,q_point) *
+		      fe_values.shape_value(j,q_point) *
+		      fe_values.JxW(q_point);
+		    cell_matrix(i,j)+=
+		      (thermal_conductivity *
+		       fe_values.shape_grad(i,q_point) *
+		       fe_values.shape_grad(j,q_point) +
+		       loss_factor *
+		       fe_values.shape_value(i,q_point) *
+		       fe_values.shape_value(j,q_point)) *
+		      fe_values.JxW(q_point);
+		  }
+		cell_room_load(i)+=
+		  loss_factor *
+		  fe_values.shape_value(i,q_point) *
+		  fe_values.JxW(q_point);
+	      }
+	  }
+
+	cell->get_dof_indices (local_dof_indices);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  for (unsigned int j=0; j<dofs_per_cell; ++j)
+	    cell_system_matrix(i,j)=
+	      cell_mass_matrix(i,j)+theta*time_step*cell_matrix(i,j);
+	linear_system_matrix.add (local_dof_indices,cell_system_matrix);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  for (unsigned int j=0; j<dofs_per_cell; ++j)
+	    cell_system_matrix(i,j)=
+	      cell_mass_matrix(i,j)-(1.-theta)*time_step*cell_matrix(i,j);
+	linear_explicit_matrix.add (local_dof_indices,cell_system_matrix);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  linear_room_load(local_dof_indices[i])+=cell_room_load(i);
+      }
+
+    for (unsigned int f=0; f<boundary_faces.size(); ++f)
+      {
+	const typename DoFHandler<dim>::active_cell_iterator face_cell=
+	  boundary_faces[f].cell;
+	cell_matrix    = 0;
+	cell_room_load = 0;
+	cell_top_load  = 0;
+	fe_face_values.reinit (face_cell, boundary_faces[f].face);
+
+	double exchange_coefficient=0.;
+	if (boundary_faces[f].boundary_id==top_boundary_id &&
+	    top_boundary_condition==third_type_top)
+	  exchange_coefficient=top_convective_coefficient;
+	else if (boundary_faces[f].boundary_id==lateral_boundary_id)
+	  exchange_coefficient=parameters.lateral_heat_transfer_coefficient;
+
+	for (unsigned int q_face_point=0; q_face_point<n_face_q_points; ++q_face_point)
+	  for (unsigned int i=0; i<dofs_per_cell; ++i)
+	    {
+	      for (unsigned int j=0; j<dofs_per_cell; ++j)
+		cell_matrix(i,j)+=
+		  exchange_coefficient *
+		  fe_face_values.shape_value (i,q_face_point) *
+		  fe_face_values.shape_value (j,q_face_point) *
+		  fe_face_values.JxW         (q_face_point);
+	      if (boundary_faces[f].boundary_id==top_boundary_id)
+		cell_top_load(i)+=
+		  fe_face_values.shape_value(i,q_face_point) *
+		  fe_face_values.JxW(q_face_point);
+	      else if (boundary_faces[f].boundary_id==lateral_boundary_id)
+		cell_room_load(i)+=
+		  exchange_coefficient *
+		  fe_face_values.shape_value(i,q_face_point) *
+		  fe_face_values.JxW(q_face_point);
+	    }
+
+	face_cell->get_dof_indices (local_dof_indices);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  for (unsigned int j=0; j<dofs_per_cell; ++j)
+	    cell_system_matrix(i,j)=theta*time_step*cell_matrix(i,j);
+	linear_system_matrix.add (local_dof_indices,cell_system_matrix);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  for (unsigned int j=0; j<dofs_per_cell; ++j)
+	    cell_system_matrix(i,j)=-(1.-theta)*time_step*cell_matrix(i,j);
+	linear_explicit_matrix.add (local_dof_indices,cell_system_matrix);
+	for (unsigned int i=0; i<dofs_per_cell; ++i)
+	  {
+	    linear_room_load(local_dof_indices[i])+=cell_room_load(i);
+	    linear_top_load (local_dof_indices[i])+=cell_top_load(i);
+	  }
+      }
+
+    /*
+     * Dirichlet dofs: rows and columns reduced to the diagonal. The column
+     * entries are moved to the rhs in solve_linear_step() with the
+     * unreduced linear_system_matrix.
+     */
+    linear_solver_matrix.copy_from (linear_system_matrix);
+    eliminate_dirichlet_rows_and_columns (linear_solver_matrix,0);
+
+    /*
+     * The profile factor is used unless it would take much more memory
+     * than the matrix (large 3D meshes), then the linear steps use CG with
+     * a fixed preconditioner.
+     */
+    linear_direct_solve=
+      (linear_factorization.envelope_size(linear_solver_matrix)<=
+       50*linear_solver_matrix.n_nonzero_elements());
+    if (linear_direct_solve)
+      linear_factorization.factorize (linear_solver_matrix);
+    else
+      linear_preconditioner.initialize (linear_solver_matrix, 1.2);
+
+    linear_time_step      =time_step;
+    linear_operators_valid=true;
+
+    if (logger.is_enabled(Logging::Logger::debug))
+      {
+	logger.stream() << "\tLinear regime operators for time step " << time_step << " s: ";
+	if (linear_direct_solve)
+	  logger.stream() << "profile Cholesky factor with "
+			  << linear_factorization.n_entries() << " entries\n";
+	else
+	  logger.stream() << "CG\n";
+      }
+  }
+
+  template <int dim>
+  bool Heat_Pipe<dim>::solve_linear_step(unsigned int &linear_iterations)
+  {
+    /*
+     * One step of the linear problem (see setup_linear_operators()) with
+     * the forcing at the start and the end of the step. Returns false,
+     * with the solution reset to the old one, if the new temperatures are
+     * in the phase change band: the step is then not linear.
+     */
+    if (!linear_operators_valid || linear_time_step!=time_step)
+      setup_linear_operators();
+
+    const double theta=theta_temperature;
+    {
+      Profiling::Profiler::Scope scope(profiler,assembly_section);
+      linear_explicit_matrix.vmult (system_rhs,old_solution);
+      system_rhs.add (time_step*
+		      (theta*new_room_temperature+(1.-theta)*old_room_temperature),
+		      linear_room_load);
+      if (top_boundary_condition==second_type_top)
+	system_rhs.add (time_step*top_fixed_heat_flux,linear_top_load);
+      else if (top_boundary_condition==third_type_top)
+	system_rhs.add (time_step*top_convective_coefficient*
+			(theta*new_surface_temperature+(1.-theta)*old_surface_temperature),
+			linear_top_load);
+      for (unsigned int s=0; s<point_source_weights.size(); s++)
+	{
+	  const double magnitude=
+	    old_point_source_magnitudes[s]*(1.-theta)*time_step
+	    +new_point_source_magnitudes[s]*(   theta)*time_step;
+	  for (unsigned int k=0; k<point_source_weights[s].size(); k++)
+	    system_rhs(point_source_weights[s][k].first)+=
+	      magnitude*point_source_weights[s][k].second;
+	}
+    }
+
+    {
+      /*
+       * rhs -= S g with g the Dirichlet values (zero elsewhere), then the
+       * Dirichlet rows are set to diag*g.
+       */
+      Profiling::Profiler::Scope scope(profiler,boundary_conditions_section);
+      const double top_value=
+	theta*new_surface_temperature+(1.-theta)*old_surface_temperature;
+      if (parameters.fixed_at_bottom)
+	for (unsigned int k=0; k<bottom_boundary_dofs.size(); k++)
+	  linear_boundary_values(bottom_boundary_dofs[k])=-parameters.bottom_fixed_value;
+      if (top_boundary_condition==first_type_top)
+	for (unsigned int k=0; k<top_boundary_dofs.size(); k++)
+	  linear_boundary_values(top_boundary_dofs[k])=-top_value;
+      linear_system_matrix.vmult_add (system_rhs,linear_boundary_values);
+      if (parameters.fixed_at_bottom)
+	for (unsigned int k=0; k<bottom_boundary_dofs.size(); k++)
+	  {
+	    const types::global_dof_index i=bottom_boundary_dofs[k];
+	    system_rhs(i)=linear_solver_matrix.diag_element(i)*parameters.bottom_fixed_value;
+	    solution(i)  =parameters.bottom_fixed_value;
+	  }
+      if (top_boundary_condition==first_type_top)
+	for (unsigned int k=0; k<top_boundary_dofs.size(); k++)
+	  {
+	    const types::global_dof_index i=top_boundary_dofs[k];
+	    system_rhs(i)=linear_solver_matrix.diag_element(i)*top_value;
+	    solution(i)  =top_value;
+	  }
+    }
+
+    {
+      Profiling::Profiler::Scope scope(profiler,linear_solve_section);
+      if (linear_direct_solve)
+	{
+	  solution=system_rhs;
+	  linear_factorization.solve (solution);
+	}
+      else
+	{
+	  linear_solver_control.set_max_steps (solution.size());
+	  linear_solver_control.set_tolerance (1e-8*system_rhs.l2_norm ());
+	  linear_solver->solve (linear_solver_matrix, solution, system_rhs,
+				linear_preconditioner);
+	  linear_iterations+=linear_solver_control.last_step();
+	}
+    }
+
+    if (!linear_regime(solution))
+      {
+	solution=old_solution;
+	return false;
+      }
+    return true;
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::solve_stage(const double stage_time_step,
+					   const double stage_fraction,
+					   const double stage_weight,
+					   unsigned int &linear_iterations)
+  {
+    /*
+     * Backward Euler solve
+     *   M(Y) (Y - stage_history) = stage_time_step F(Y)
+     * with the forcing at time+stage_fraction*time_step, linearly
+     * interpolated between the values at the start and the end of the
+     * step. stage_history takes the place of old_solution during the
+     * solve, both are swapped back on return. The heat rates of the stage
+     * solution are added with stage_weight, its weight in the average of
+     * the heat rates over the step.
+     */
+    const double step                  =time_step;
+    const double surface_temperature   =new_surface_temperature;
+    const double room_temperature      =new_room_temperature;
+    stage_point_source_magnitudes=new_point_source_magnitudes;
+    const std::vector<double> &point_source_magnitudes_end=stage_point_source_magnitudes;
+
+    new_surface_temperature=
+      old_surface_temperature+stage_fraction*(surface_temperature-old_surface_temperature);
+    new_room_temperature=
+      old_room_temperature+stage_fraction*(room_temperature-old_room_temperature);
+    for (unsigned int s=0; s<new_point_source_magnitudes.size(); s++)
+      new_point_source_magnitudes[s]=
+	old_point_source_magnitudes[s]+
+	stage_fraction*(point_source_magnitudes_end[s]-old_point_source_magnitudes[s]);
+    time_step=stage_time_step;
+    old_solution.swap(stage_history);
+
+    const unsigned int iterations=solve_picard(linear_iterations);
+    add_heat_rates(solution,solution,1.,stage_weight);
+
+    old_solution.swap(stage_history);
+    time_step                  =step;
+    new_surface_temperature    =surface_temperature;
+    new_room_temperature       =room_temperature;
+    new_point_source_magnitudes=point_source_magnitudes_end;
+
+    return iterations;
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::solve_bdf2_step(unsigned int &linear_iterations)
+  {
+    /*
+     * Variable step BDF2 with w=time_step/older_time_step:
+     *   T_new - dt (1+w)/(1+2w) F(T_new) =
+     *     (1+w)^2/(1+2w) T_old - w^2/(1+2w) T_older
+     * i.e. a single backward Euler solve with a shorter time step and a
+     * combination of the two previous solutions as old solution. The heat
+     * rates of the step are those of T_new, a second order approximation
+     * of their average over the step.
+     */
+    const double w=time_step/older_time_step;
+    stage_history=old_solution;
+    stage_history.sadd((1.+w)*(1.+w)/(1.+2.*w),-w*w/(1.+2.*w),older_solution);
+
+    time_error=0.;
+    return solve_stage(time_step*(1.+w)/(1.+2.*w),1.,1.,linear_iterations);
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::solve_sdirk2_step(unsigned int &linear_iterations)
+  {
+    /*
+     * Two stage, L-stable, stiffly accurate SDIRK with g=1-1/sqrt(2):
+     *   Y1 = T_old + g dt F(Y1)                    (at time+g dt)
+     *   Y2 = T_old + (1-g) dt F(Y1) + g dt F(Y2)   (at time+dt)
+     * and T_new=Y2. Using dt F(Y1)=(Y1-T_old)/g, the second stage is a
+     * backward Euler solve with old solution T_old+(1-g)/g (Y1-T_old).
+     * The embedded first order solution with weights (1/2,1/2) gives the
+     * error estimate dt (1/2-g) (F(Y1)-F(Y2)). The heat rates of the step
+     * are those of the stages with the weights (1-g,g) of the update.
+     */
+    const double g=1.-std::sqrt(0.5);
+    unsigned int iterations=0;
+
+    stage_history=old_solution;
+    iterations+=solve_stage(g*time_step,g,1.-g,linear_iterations);
+    stage_solution=solution;
+
+    stage_history.sadd(1.-(1.-g)/g,(1.-g)/g,stage_solution);
+    iterations+=solve_stage(g*time_step,1.,g,linear_iterations);
+
+    /*
+     * (Y1-T_old)-(Y2-stage_history) is g dt (F(Y1)-F(Y2)). Values on
+     * Dirichlet boundaries are prescribed, not integrated, and left out.
+     */
+    stage_solution-=old_solution;
+    stage_solution-=solution;
+    stage_solution+=stage_history;
+    if (parameters.fixed_at_bottom)
+      for (unsigned int k=0; k<bottom_boundary_dofs.size(); k++)
+	stage_solution(bottom_boundary_dofs[k])=0.;
+    if (top_boundary_condition==first_type_top)
+      for (unsigned int k=0; k<top_boundary_dofs.size(); k++)
+	stage_solution(top_boundary_dofs[k])=0.;
+    time_error    =std::fabs(0.5-g)/g*stage_solution.linfty_norm();
+    max_time_error=std::max(max_time_error,time_error);
+
+    return iterations;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::run()
+  {
+    setup_problem();
+
+    initial_condition_temperature();
+    column_thermal_energy=total_thermal_energy(solution);
+    if (logger.is_enabled(Logging::Logger::normal))
+    {
+      double k=0.;
+      double Cp=0.;
+      double Si=0.;
+      physics.material_data(-parameters.material_0_depth-0.5*parameters.material_0_thickness,
+			    25.,k,Cp,Si);
+	    
+      std::ostream &out=logger.stream();
+      const std::ios::fmtflags flags=out.flags();
+      const std::streamsize    precision=out.precision();
+      out.setf( std::ios::fixed);
+      out.precision(3);
+      out << "\tPosition of material layers:\n"
+	  << "\t\tLayer 1: from "
+	  << parameters.material_0_depth << " to "
+	  << parameters.material_0_depth+parameters.material_0_thickness << "\t"
+	  << "k(@25C) :" << k << " W/mK\t"
+	  << "Cp(@25C):" << Cp/1.E6 << " MJ/m3K\n";
+
+      physics.material_data(-parameters.material_1_depth-0.5*parameters.material_1_thickness,
+			    25.,k,Cp,Si);
+      out << "\t\tLayer 2: from "
+	  << parameters.material_1_depth << " to "
+	  << parameters.material_1_depth+parameters.material_1_thickness << "\t"
+	  << "k(@25C) :" << k << " W/mK\t"
+	  << "Cp(@25C):" << Cp/1.E6 << " MJ/m3K\n";
+	    
+      physics.material_data(-parameters.material_2_depth-0.5*parameters.material_2_thickness,
+			    25.,k,Cp,Si);
+      out << "\t\tLayer 3: from "
+	  << parameters.material_2_depth << " to "
+	  << parameters.material_2_depth+parameters.material_2_thickness << "\t"
+	  << "k(@25C) :" << k << " W/mK\t"
+	  << "Cp(@25C):" << Cp/1.E6 << "MJ/m3K\n";
+
+      physics.material_data(-parameters.material_3_depth-0.5*parameters.material_3_thickness,
+			    25.,k,Cp,Si);
+      out << "\t\tLayer 4: from "
+	  << parameters.material_3_depth << " to "
+	  << parameters.material_3_depth+parameters.material_3_thickness << "\t"
+	  << "k(@25C) :" << k << " W/mK\t"
+	  << "Cp(@25C):" << Cp/1.E6 << "MJ/m3K\n";
+
+      physics.material_data(-parameters.material_4_depth-0.5*parameters.material_4_thickness,
+			    25.,k,Cp,Si);
+      out << "\t\tLayer 5: from "
+	  << parameters.material_4_depth << " to "
+	  << parameters.material_4_depth+parameters.material_4_thickness << "\t"
+	  << "k(@25C) :" << k << " W/mK\t"
+	  << "Cp(@25C):" << Cp/1.E6 << "MJ/m3K\n";
+      out.flags(flags);
+      out.precision(precision);
+    }
+    if (reduced_model_mode!=reduced_model_off)
+      check_reduced_model_support();
+    if (parameters.parareal_time_slices>1 && output_aggregators.size()!=0)
+      {
+	std::cout << "Error, aggregated output is not available with parareal "
+		  << "time slices\n";
+	throw 1;
+      }
+    if (parameters.parareal_time_slices>1 && time_integrator==bdf2)
+      {
+	/*
+	 * The coarse propagator is a one step method, it cannot correct
+	 * the bdf2 history at the slice boundaries.
+	 */
+	std::cout << "Error, parareal time slices are not available with the "
+		  << "bdf2 integrator\n";
+	throw 1;
+      }
+    if ((parameters.parareal_time_slices>1 || calibration_mode!=calibration_off) &&
+	monitor)
+      {
+	std::cout << "Error, the shared memory monitor is not available with "
+		  << "parareal time slices or calibration\n";
+	throw 1;
+      }
+    if (reduced_model_mode==reduced_model_train)
+      collect_snapshot();
+    else if (reduced_model_mode==reduced_model_validate)
+      setup_reduced_model();
+
+    if (calibration_mode!=calibration_off)
+      run_calibration();
+    else if (reduced_model_mode==reduced_model_online)
+      run_reduced_model();
+    else if (parameters.parareal_time_slices>1)
+      run_parareal();
+    else
+      {
+	/*
+	 * With TRL_COUNT_ALLOCATIONS, every time step after the first few
+	 * (where the solver memory pools, the history vectors and the
+	 * forcing series are filled) must not allocate memory. Logging and
+	 * vtu output are left out of the count, as are the reduced model
+	 * modes, which store snapshots or evaluate the reduced model.
+	 */
+	const unsigned int allocation_warm_up_steps=3;
+	AllocationCounter::Section step_allocations;
+
+	int output_count=0;
+	for (timestep_number=1;//,time=time_step;
+	     timestep_number<=timestep_number_max;//time<=time_max;
+	     ++timestep_number)//time+=time_step
+	  {
+	    step_allocations.start();
+	    update_met_data();
+
+	    unsigned int linear_iterations=0;
+	    const unsigned int iteration=solve_time_step(linear_iterations);
+	    step_allocations.stop();
+
+	    if (logger.step_due(timestep_number))
+	      {
+		logger.stream() << "Time step " << timestep_number << "\ttime: " << time/60 << " min\tDt: "
+				<< time_step << " s\t#it: " << iteration
+				<< "\t#linear it: " << linear_iterations
+				<< "\tflux top: " << heat_flux_top
+				<< "\tflux bottom: " << heat_flux_bottom
+				<< "\tbalance error: " << energy_balance_error;
+		if (time_integrator==sdirk2)
+		  logger.stream() << "\ttime error: " << time_error;
+		logger.stream() << "\n";
+	      }
+	
+	    if (parameters.output_frequency!=0 &&
+		time>output_count*parameters.output_frequency)
+	      {
+		output_results();
+		output_count++;
+	      }
+	    step_allocations.start();
+	    fill_output_vectors();
+	    publish_monitor_record(iteration,linear_iterations);
+	    step_allocations.stop();
+
+	    if (reduced_model_mode==reduced_model_train &&
+		timestep_number%parameters.reduced_model_snapshot_interval==0)
+	      collect_snapshot();
+	    else if (reduced_model_mode==reduced_model_validate)
+	      {
+		advance_reduced_model();
+		std::vector<double> reduced_probe_values;
+		reduced_model.probe_temperatures(reduced_coordinates,new_surface_temperature,
+						 parameters.fixed_at_bottom ? parameters.bottom_fixed_value : 0.,
+						 reduced_probe_values);
+		for (unsigned int i=0; i<probe_values.size(); i++)
+		  {
+		    const double error=std::fabs(reduced_probe_values[i]-probe_values[i]);
+		    reduced_model_max_error    =std::max(reduced_model_max_error,error);
+		    reduced_model_square_error+=error*error;
+		  }
+	      }
+
+	    step_allocations.start();
+	    if (time_integrator==bdf2)
+	      {
+		older_solution =old_solution;
+		older_time_step=time_step;
+	      }
+	    old_solution=solution;
+	    step_allocations.stop();
+
+	    const unsigned long allocations=step_allocations.take();
+	    if (AllocationCounter::enabled &&
+		reduced_model_mode==reduced_model_off &&
+		timestep_number>allocation_warm_up_steps &&
+		allocations!=0)
+	      {
+		std::cout << "Error, time step " << timestep_number << " made "
+			  << allocations << " heap allocations\n";
+		throw 1;
+	      }
+	  }
+
+	if (reduced_model_mode==reduced_model_train)
+	  build_reduced_model();
+	else if (reduced_model_mode==reduced_model_validate)
+	  {
+	    const double rms_error=
+	      std::sqrt(reduced_model_square_error/
+			std::max(1ul,(unsigned long)timestep_number_max*probe_values.size()));
+	    profiler.set_info("reduced_model_max_error",reduced_model_max_error);
+	    profiler.set_info("reduced_model_rms_error",rms_error);
+	    profiler.set_info("reduced_model_microseconds_per_step",
+			      1e6*reduced_model_wall_time/std::max(1u,timestep_number_max));
+	    if (logger.is_enabled(Logging::Logger::normal))
+	      logger.stream() << "Reduced model validation: " << reduced_model.size()
+			      << " basis functions, probe error max " << reduced_model_max_error
+			      << " C, rms " << rms_error << " C, "
+			      << 1e6*reduced_model_wall_time/std::max(1u,timestep_number_max)
+			      << " microseconds per time step\n";
+	  }
+      }
+    finish_output_aggregators();
+    if (monitor)
+      monitor->finish();
+    output_file.close();
+    if (time_integrator==sdirk2)
+      profiler.set_info("max_time_error",max_time_error);
+
+    if (logger.is_enabled(Logging::Logger::normal))
+      profiler.print_summary(logger.stream());
+    if (parameters.profiling && parameters.profiling_output_file.size()!=0)
+      profiler.write_json(parameters.profiling_output_file);
+
+    if (logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "\t Job Done!!\n";
+    logger.flush();
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::propagate(const State &start,
+				 const unsigned int n_steps,
+				 const double dt,
+				 State &end,
+				 std::ostream *output)
+  {
+    /*
+     * n_steps time steps of size dt from 'start', with the forcing read as
+     * in run(). If 'output' is given, a line of the output data file is
+     * written to it after every step.
+     */
+    restore(start);
+    time_step=dt;
+    for (unsigned int step=0; step<n_steps; ++step)
+      {
+	timestep_number++;
+	update_met_data();
+
+	unsigned int linear_iterations=0;
+	solve_time_step(linear_iterations);
+	if (output)
+	  {
+	    evaluate_probes();
+	    write_output_line(*output);
+	  }
+	if (time_integrator==bdf2)
+	  {
+	    older_solution =old_solution;
+	    older_time_step=time_step;
+	  }
+	old_solution=solution;
+      }
+    evaluate_probes();
+    snapshot(end);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::run_parareal()
+  {
+    /*
+     * Parareal: the time steps are split into slices. With U_n the state
+     * at the start of slice n, F the fine propagator (the usual time
+     * stepping over the slice) and G a coarse one (backward Euler with a
+     * longer time step and lagged coefficients), each iteration computes
+     * F(U_n) for all slices concurrently and then corrects serially
+     *   U_n+1 <- G(U_n) + F(U_n,old) - G(U_n,old)
+     * After k iterations the first k slices are exact, so slices before
+     * the current iteration number are not computed again. Each slice has
+     * its own Heat_Pipe object, since they are not thread safe.
+     */
+    const unsigned int n_slices=
+      std::min(parameters.parareal_time_slices,timestep_number_max);
+    unsigned int n_threads=parameters.parareal_threads;
+    if (n_threads==0)
+      n_threads=MultithreadInfo::n_threads();
+
+    std::vector<unsigned int> slice_begin (n_slices+1);
+    for (unsigned int n=0; n<=n_slices; ++n)
+      slice_begin[n]=(n*timestep_number_max)/n_slices;
+
+    Parameters::AllParameters<dim> fine_parameters=parameters;
+    fine_parameters.verbosity            ="quiet";
+    fine_parameters.log_file             ="";
+    fine_parameters.profiling            =false;
+    fine_parameters.parareal_time_slices =0;
+
+    Parameters::AllParameters<dim> coarse_parameters=fine_parameters;
+    coarse_parameters.theta                       =1.;
+    coarse_parameters.time_integrator             ="theta";
+    coarse_parameters.coefficient_update_tolerance=
+      parameters.parareal_coarse_coefficient_tolerance;
+
+    std::vector<std::unique_ptr<Heat_Pipe<dim> > > fine (n_slices);
+    for (unsigned int n=0; n<n_slices; ++n)
+      {
+	fine[n].reset(new Heat_Pipe<dim>(fine_parameters,depths_coordinates));
+	fine[n]->setup_problem();
+      }
+    Heat_Pipe<dim> coarse (coarse_parameters,depths_coordinates);
+    coarse.setup_problem();
+
+    std::vector<State> U (n_slices+1);
+    std::vector<State> F (n_slices);
+    std::vector<State> G (n_slices);
+    std::vector<std::string> slice_output (n_slices);
+    State G_new;
+
+    evaluate_probes();
+    snapshot(U[0]);
+
+    /*
+     * Coarse propagation of slice n from U[n] into 'end'. The step
+     * counter of the coarse object counts coarse steps, the one of the
+     * result is set to that of the fine steps.
+     */
+    const auto coarse_propagate=[&](const unsigned int n, State &end)
+      {
+	const unsigned int n_fine  =slice_begin[n+1]-slice_begin[n];
+	const unsigned int n_coarse=
+	  std::max(1u,(n_fine+parameters.parareal_coarse_factor/2)/parameters.parareal_coarse_factor);
+	coarse.propagate(U[n],n_coarse,n_fine*time_step/n_coarse,end,0);
+	end.timestep_number=slice_begin[n+1];
+	end.time           =slice_begin[n+1]*time_step;
+      };
+
+    for (unsigned int n=0; n<n_slices; ++n)
+      {
+	coarse_propagate(n,G[n]);
+	U[n+1]=G[n];
+      }
+
+    /*
+     * Fine propagation of the slices from 'first' on, as many at the same
+     * time as there are threads, keeping the output lines of each slice.
+     */
+    const auto fine_propagate=[&](const unsigned int first)
+      {
+	std::atomic<unsigned int> next_slice (first);
+	std::atomic<bool>         failed (false);
+	const auto fine_worker=[&]()
+	  {
+	    unsigned int n;
+	    while ((n=next_slice++)<n_slices)
+	      {
+		std::ostringstream output;
+		try
+		  {
+		    fine[n]->propagate(U[n],slice_begin[n+1]-slice_begin[n],time_step,
+				       F[n],&output);
+		  }
+		catch (...)
+		  {
+		    failed=true;
+		  }
+		slice_output[n]=output.str();
+	      }
+	  };
+	std::vector<std::thread> threads;
+	for (unsigned int t=1; t<std::min(n_threads,n_slices-first); ++t)
+	  threads.push_back(std::thread(fine_worker));
+	fine_worker();
+	for (unsigned int t=0; t<threads.size(); ++t)
+	  threads[t].join();
+	if (failed)
+	  {
+	    std::cout << "Error, fine propagation of a parareal slice failed\n";
+	    throw 1;
+	  }
+      };
+
+    unsigned int iteration=0;
+    double       change   =0.;
+    do
+      {
+	fine_propagate(iteration);
+
+	/*
+	 * Serial correction sweep. The start of slice 'iteration' did not
+	 * change, so its end is the fine result. Otherwise the correction
+	 * is applied to the temperatures and to the diagnostics (heat rates
+	 * and balance error). The probe values are linear in the
+	 * temperatures and corrected the same way, the thermal energy is
+	 * not and is evaluated for the corrected temperatures, so that the
+	 * next balance starts from the energy of the state it starts from.
+	 */
+	change=0.;
+	for (unsigned int n=iteration; n<n_slices; ++n)
+	  {
+	    const Vector<double> previous=U[n+1].solution;
+	    if (n==iteration)
+	      U[n+1]=F[n];
+	    else
+	      {
+		coarse_propagate(n,G_new);
+		State &corrected=U[n+1];
+		corrected=F[n];
+		corrected.solution =G_new.solution;
+		corrected.solution+=F[n].solution;
+		corrected.solution-=G[n].solution;
+		for (unsigned int i=0; i<corrected.probe_values.size(); ++i)
+		  corrected.probe_values[i]+=
+		    G_new.probe_values[i]-G[n].probe_values[i];
+		corrected.heat_flux_top    +=G_new.heat_flux_top    -G[n].heat_flux_top;
+		corrected.heat_flux_bottom +=G_new.heat_flux_bottom -G[n].heat_flux_bottom;
+		corrected.heat_flux_lateral+=G_new.heat_flux_lateral-G[n].heat_flux_lateral;
+		corrected.heat_loss_rate   +=G_new.heat_loss_rate   -G[n].heat_loss_rate;
+		corrected.point_source_rate+=G_new.point_source_rate-G[n].point_source_rate;
+		corrected.energy_balance_error+=
+		  G_new.energy_balance_error-G[n].energy_balance_error;
+		corrected.column_thermal_energy=total_thermal_energy(corrected.solution);
+		G[n]=G_new;
+	      }
+	    Vector<double> difference=U[n+1].solution;
+	    difference-=previous;
+	    change=std::max(change,difference.linfty_norm());
+	  }
+	iteration++;
+
+	if (logger.is_enabled(Logging::Logger::steps))
+	  logger.stream() << "Parareal iteration " << iteration
+			  << "\tslice boundary change: " << change << " C\n";
+      }
+    while (change>parameters.parareal_tolerance &&
+	   iteration<n_slices &&
+	   iteration<parameters.parareal_max_iterations);
+
+    if (change>parameters.parareal_tolerance &&
+	logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "Warning, parareal did not converge in "
+		      << iteration << " iterations\n";
+
+    /*
+     * The fine results of the slices after 'iteration' were computed from
+     * starts that the last sweep corrected. They are computed once more
+     * from the final starts, so that the output file and the final state
+     * come from fine propagations of the converged trajectory.
+     */
+    if (iteration<n_slices)
+      fine_propagate(iteration);
+
+    if (parameters.full_rate_output)
+      for (unsigned int n=0; n<n_slices; ++n)
+	output_file << slice_output[n];
+    restore(F[n_slices-1]);
+
+    profiler.count(time_steps_counter,timestep_number_max);
+    profiler.set_info("parareal_slices",n_slices);
+    profiler.set_info("parareal_iterations",iteration);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::check_reduced_model_support() const
+  {
+    if (top_boundary_condition!=first_type_top ||
+	parameters.point_source ||
+	parameters.heat_loss_factor>0. ||
+	(dim>1 && parameters.lateral_heat_transfer_coefficient>0.) ||
+	parameters.parareal_time_slices>1)
+      {
+	std::cout << "Error, the reduced model needs a first type top condition "
+		  << "and no point sources, heat losses, lateral heat exchange "
+		  << "or parareal time slices\n";
+	throw 1;
+      }
+    /*
+     * The snapshots and the reduced time steps are backward Euler.
+     */
+    if (time_integrator!=theta_method || theta_scheme!=backward_euler)
+      {
+	std::cout << "Error, the reduced model needs backward Euler (theta "
+		  << "method with theta=1)\n";
+	throw 1;
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::collect_snapshot()
+  {
+    /*
+     * The snapshot of the solution is its part with zero Dirichlet
+     * values, the coefficients are evaluated as in assemble_cells() with
+     * theta=1.
+     */
+    Vector<double> snapshot=solution;
+    for (unsigned int k=0; k<top_boundary_dofs.size(); k++)
+      snapshot(top_boundary_dofs[k])=0.;
+    if (parameters.fixed_at_bottom)
+      for (unsigned int k=0; k<bottom_boundary_dofs.size(); k++)
+	snapshot(bottom_boundary_dofs[k])=0.;
+    solution_snapshots.push_back(snapshot);
+
+    FEValues<dim> fe_values(fe, quadrature_formula, update_values);
+    const unsigned int n_q_points=quadrature_formula.size();
+    std::vector<double> temperature_values (n_q_points);
+
+    Vector<double> heat_capacities (triangulation.n_active_cells()*n_q_points);
+    Vector<double> conductivities  (triangulation.n_active_cells()*n_q_points);
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	fe_values.reinit (cell);
+	fe_values.get_function_values(solution,temperature_values);
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    const unsigned int index=cell->active_cell_index()*n_q_points+q_point;
+	    double ice_saturation=0.;
+	    physics.material_data(cell->center()[dim-1],temperature_values[q_point],
+				  conductivities(index),heat_capacities(index),
+				  ice_saturation);
+	  }
+      }
+    heat_capacity_snapshots.push_back(heat_capacities);
+    conductivity_snapshots.push_back(conductivities);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::build_reduced_field(const std::vector<Vector<double> > &snapshots,
+					   const bool                          mass,
+					   const Vector<double>               &lift_top,
+					   const Vector<double>               &lift_bottom,
+					   ReducedModel::Field                &field)
+  {
+    /*
+     * DEIM basis and points of a coefficient field, and for each basis
+     * function u_j the reduced matrix V^T M[u_j] V (mass) or V^T K[u_j] V
+     * (laplace) and the same with the lifting functions on the right.
+     * The basis functions of V and the lifting functions are evaluated
+     * at the quadrature points as finite element functions.
+     */
+    std::vector<Vector<double> > coefficient_basis;
+    ReducedModel::pod(snapshots,parameters.reduced_model_tolerance,
+		      parameters.reduced_model_max_points,coefficient_basis);
+    std::vector<unsigned int> points;
+    ReducedModel::deim_points(coefficient_basis,points);
+
+    const unsigned int r=reduced_model.size();
+    const unsigned int p=points.size();
+    field.reinit(p,r);
+    std::map<unsigned int,unsigned int> point_of_index;
+    for (unsigned int j=0; j<p; ++j)
+      {
+	point_of_index[points[j]]=j;
+	for (unsigned int i=0; i<p; ++i)
+	  field.interpolation(i,j)=coefficient_basis[j](points[i]);
+      }
+    field.interpolation.gauss_jordan();
+
+    FEValues<dim> fe_values(fe, quadrature_formula,
+			    update_values | update_gradients | update_JxW_values);
+    const unsigned int dofs_per_cell=fe.dofs_per_cell;
+    const unsigned int n_q_points   =quadrature_formula.size();
+    std::vector<types::global_dof_index> local_dof_indices (dofs_per_cell);
+
+    std::vector<double>         values (r+2);
+    std::vector<Tensor<1,dim> > gradients (r+2);
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	fe_values.reinit (cell);
+	cell->get_dof_indices (local_dof_indices);
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    /*
+	     * values[0..r-1] are the reduced basis functions, values[r] and
+	     * values[r+1] the top and bottom lifting functions.
+	     */
+	    for (unsigned int m=0; m<r+2; ++m)
+	      {
+		values[m]   =0.;
+		gradients[m]=Tensor<1,dim>();
+	      }
+	    for (unsigned int i=0; i<dofs_per_cell; ++i)
+	      {
+		const types::global_dof_index dof=local_dof_indices[i];
+		const double         phi     =fe_values.shape_value(i,q_point);
+		const Tensor<1,dim> &grad_phi=fe_values.shape_grad(i,q_point);
+		for (unsigned int m=0; m<r; ++m)
+		  if (reduced_model.basis(dof,m)!=0.)
+		    {
+		      values[m]   +=reduced_model.basis(dof,m)*phi;
+		      gradients[m]+=reduced_model.basis(dof,m)*grad_phi;
+		    }
+		values[r]     +=lift_top(dof)*phi;
+		gradients[r]  +=lift_top(dof)*grad_phi;
+		values[r+1]   +=lift_bottom(dof)*phi;
+		gradients[r+1]+=lift_bottom(dof)*grad_phi;
+	      }
+
+	    const unsigned int index=cell->active_cell_index()*n_q_points+q_point;
+	    const std::map<unsigned int,unsigned int>::const_iterator
+	      point=point_of_index.find(index);
+	    if (point!=point_of_index.end())
+	      {
+		const unsigned int j=point->second;
+		field.depths[j]=cell->center()[dim-1];
+		for (unsigned int m=0; m<r; ++m)
+		  field.point_values(j,m)=values[m];
+		field.point_lift_top[j]   =values[r];
+		field.point_lift_bottom[j]=values[r+1];
+	      }
+
+	    for (unsigned int j=0; j<p; ++j)
+	      {
+		const double weight=coefficient_basis[j](index)*fe_values.JxW(q_point);
+		if (weight==0.)
+		  continue;
+		for (unsigned int m=0; m<r; ++m)
+		  {
+		    for (unsigned int n=0; n<r; ++n)
+		      field.matrices[j](m,n)+=weight*
+			(mass ? values[m]*values[n] : gradients[m]*gradients[n]);
+		    field.lift_top[j](m)+=weight*
+		      (mass ? values[m]*values[r] : gradients[m]*gradients[r]);
+		    field.lift_bottom[j](m)+=weight*
+		      (mass ? values[m]*values[r+1] : gradients[m]*gradients[r+1]);
+		  }
+	      }
+	  }
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::build_reduced_model()
+  {
+    std::vector<Vector<double> > basis;
+    ReducedModel::pod(solution_snapshots,parameters.reduced_model_tolerance,
+		      parameters.reduced_model_max_basis_size,basis);
+    if (basis.size()==0)
+      {
+	std::cout << "Error, no snapshots to build the reduced model from\n";
+	throw 1;
+      }
+
+    const unsigned int r=basis.size();
+    reduced_model.basis.reinit(dof_handler.n_dofs(),r);
+    for (unsigned int m=0; m<r; ++m)
+      for (unsigned int i=0; i<dof_handler.n_dofs(); ++i)
+	reduced_model.basis(i,m)=basis[m](i);
+
+    Vector<double> lift_top    (dof_handler.n_dofs());
+    Vector<double> lift_bottom (dof_handler.n_dofs());
+    for (unsigned int k=0; k<top_boundary_dofs.size(); k++)
+      lift_top(top_boundary_dofs[k])=1.;
+    if (parameters.fixed_at_bottom)
+      for (unsigned int k=0; k<bottom_boundary_dofs.size(); k++)
+	lift_bottom(bottom_boundary_dofs[k])=1.;
+
+    build_reduced_field(heat_capacity_snapshots,true,lift_top,lift_bottom,
+			reduced_model.heat_capacity);
+    build_reduced_field(conductivity_snapshots,false,lift_top,lift_bottom,
+			reduced_model.conductivity);
+
+    reduced_model.probe_values.reinit(probe_weights.size(),r);
+    reduced_model.probe_lift_top.assign(probe_weights.size(),0.);
+    reduced_model.probe_lift_bottom.assign(probe_weights.size(),0.);
+    for (unsigned int i=0; i<probe_weights.size(); i++)
+      for (unsigned int j=0; j<probe_weights[i].size(); j++)
+	{
+	  const types::global_dof_index dof=probe_weights[i][j].first;
+	  const double weight=probe_weights[i][j].second;
+	  for (unsigned int m=0; m<r; ++m)
+	    reduced_model.probe_values(i,m)+=weight*reduced_model.basis(dof,m);
+	  reduced_model.probe_lift_top[i]   +=weight*lift_top(dof);
+	  reduced_model.probe_lift_bottom[i]+=weight*lift_bottom(dof);
+	}
+
+    reduced_model.write(parameters.reduced_model_file);
+    if (logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "Reduced model written to " << parameters.reduced_model_file
+		      << ": " << r << " basis functions from "
+		      << solution_snapshots.size() << " snapshots, "
+		      << reduced_model.heat_capacity.n_points() << " heat capacity and "
+		      << reduced_model.conductivity.n_points() << " conductivity points\n";
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_reduced_model()
+  {
+    reduced_model.read(parameters.reduced_model_file);
+    reduced_model.reduce(solution,reduced_coordinates);
+    if (reduced_model.probe_values.m()!=probe_values.size())
+      {
+	std::cout << "Error, the reduced model was built for "
+		  << reduced_model.probe_values.m() << " probes\n";
+	throw 1;
+      }
+    reduced_model_max_error   =0.;
+    reduced_model_square_error=0.;
+    reduced_model_wall_time   =0.;
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::advance_reduced_model()
+  {
+    /*
+     * One step of the reduced model with the forcing of the current time
+     * step. The wall time is accumulated in reduced_model_wall_time.
+     */
+    const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    const unsigned int iterations=
+      reduced_model.advance(reduced_coordinates,
+			    old_surface_temperature,new_surface_temperature,
+			    parameters.fixed_at_bottom ? parameters.bottom_fixed_value : 0.,
+			    time_step,
+			    [this](const double depth, const double temperature,
+				   double &conductivity, double &heat_capacity)
+			    {
+			      double ice_saturation=0.;
+			      physics.material_data(depth,temperature,conductivity,
+						    heat_capacity,ice_saturation);
+			    });
+    reduced_model_wall_time+=
+      std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    return iterations;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::run_reduced_model()
+  {
+    /*
+     * Same time loop as run() with the reduced model. Only the probe
+     * temperatures are computed, the energy diagnostics in the output
+     * file are zero.
+     */
+    setup_reduced_model();
+    column_thermal_energy=0.;
+
+    for (timestep_number=1;
+	 timestep_number<=timestep_number_max;
+	 ++timestep_number)
+      {
+	update_met_data();
+	const unsigned int iterations=advance_reduced_model();
+	time+=time_step;
+
+	reduced_model.probe_temperatures(reduced_coordinates,new_surface_temperature,
+					 parameters.fixed_at_bottom ? parameters.bottom_fixed_value : 0.,
+					 probe_values);
+	if (logger.step_due(timestep_number))
+	  logger.stream() << "Time step " << timestep_number << "\ttime: " << time/60 << " min\tDt: "
+			  << time_step << " s\t#it: " << iterations << "\n";
+	record_output();
+	publish_monitor_record(iterations,0);
+	profiler.count(time_steps_counter);
+	profiler.count(picard_iterations_counter,iterations);
+      }
+
+    profiler.set_info("reduced_model_size",reduced_model.size());
+    profiler.set_info("reduced_model_microseconds_per_step",
+		      1e6*reduced_model_wall_time/std::max(1u,timestep_number_max));
+    if (logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "Reduced model: " << reduced_model.size() << " basis functions, "
+		      << 1e6*reduced_model_wall_time/std::max(1u,timestep_number_max)
+		      << " microseconds per time step\n";
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::setup_calibration()
+  {
+    if (time_integrator!=theta_method || theta_scheme!=backward_euler ||
+	parameters.parareal_time_slices>1 ||
+	reduced_model_mode!=reduced_model_off)
+      {
+	std::cout << "Error, the calibration needs backward Euler (theta method "
+		  << "with theta=1) and no parareal time slices or reduced model\n";
+	throw 1;
+      }
+    /*
+     * A steady state initial condition depends on the calibrated
+     * parameters, but it is computed once and the gradient has no term
+     * for it.
+     */
+    if (parameters.initial_condition.compare("steady state")==0)
+      {
+	std::cout << "Error, the calibration needs the initial condition from "
+		  << "a file, not a steady state\n";
+	throw 1;
+      }
+
+    calibration_parameters.clear();
+    for (unsigned int k=0; k<parameters.calibration_parameters.size(); k++)
+      {
+	const std::string &name=parameters.calibration_parameters[k];
+	CalibrationParameter parameter;
+	parameter.name =name;
+	parameter.layer=0;
+	if (name.compare("heat loss factor")==0)
+	  parameter.type=heat_loss_parameter;
+	else if (name.compare(0,9,"porosity ")==0)
+	  {
+	    parameter.type =porosity_parameter;
+	    parameter.layer=Utilities::string_to_int(name.substr(9));
+	  }
+	else if (name.compare(0,21,"degree of saturation ")==0)
+	  {
+	    parameter.type =saturation_parameter;
+	    parameter.layer=Utilities::string_to_int(name.substr(21));
+	  }
+	else
+	  {
+	    std::cout << "Error, unknown calibration parameter: " << name << "\n";
+	    throw 1;
+	  }
+	if (parameter.layer>=physics.layer_data.size())
+	  {
+	    std::cout << "Error, calibration parameter of a layer that does not "
+		      << "exist: " << name << "\n";
+	    throw 1;
+	  }
+	calibration_parameters.push_back(parameter);
+      }
+    if (calibration_parameters.size()==0)
+      {
+	std::cout << "Error, no calibration parameters given\n";
+	throw 1;
+      }
+
+    DataTools data_tools;
+    std::vector<std::string> filenames;
+    filenames.push_back(parameters.calibration_measurements_file);
+    data_tools.read_data (filenames,
+			  measured_temperatures);
+
+    /*
+     * Each line of measurements is used at the end of the nearest time
+     * step.
+     */
+    unsigned int n_measurements=0;
+    measurement_rows.assign(timestep_number_max+1,-1);
+    for (unsigned int r=0; r<measured_temperatures.size(); r++)
+      {
+	if (measured_temperatures[r].size()!=probe_values.size()+1)
+	  {
+	    std::cout << "Error, line " << r << " of the measurements file has "
+		      << measured_temperatures[r].size() << " columns, expected "
+		      << probe_values.size()+1 << " (time and one per probe)\n";
+	    throw 1;
+	  }
+	const double step=std::floor(measured_temperatures[r][0]/time_step+0.5);
+	if (step>=1. && step<=timestep_number_max)
+	  {
+	    measurement_rows[(unsigned int)step]=r;
+	    n_measurements++;
+	  }
+      }
+    if (n_measurements==0)
+      {
+	std::cout << "Error, no measurement falls inside the simulated time\n";
+	throw 1;
+      }
+
+    adjoint_matrix.reinit (sparsity_pattern);
+    adjoint_rhs.reinit (dof_handler.n_dofs());
+
+    if (logger.is_enabled(Logging::Logger::normal))
+      logger.stream() << "\tCalibration: " << calibration_parameters.size()
+		      << " parameters, " << n_measurements
+		      << " measurement times\n";
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::calibration_parameter(const unsigned int k) const
+  {
+    const CalibrationParameter &parameter=calibration_parameters[k];
+    if (parameter.type==porosity_parameter)
+      return std::get<1>(physics.layer_data[parameter.layer]);
+    else if (parameter.type==saturation_parameter)
+      return std::get<2>(physics.layer_data[parameter.layer]);
+    else
+      return parameters.heat_loss_factor;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::set_calibration_parameter(const unsigned int k,
+						 const double value)
+  {
+    const CalibrationParameter &parameter=calibration_parameters[k];
+    if (parameter.type==porosity_parameter)
+      std::get<1>(physics.layer_data[parameter.layer])=value;
+    else if (parameter.type==saturation_parameter)
+      std::get<2>(physics.layer_data[parameter.layer])=value;
+    else
+      parameters.heat_loss_factor=value;
+    if (parameter.type!=heat_loss_parameter)
+      physics.update_layer_material(parameter.layer);
+    linear_operators_valid=false;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::forward_misfit(std::vector<State> &checkpoints,
+					const bool          write_output)
+  {
+    /*
+     * Time loop from the initial state with the current parameters.
+     * Returns the misfit J=1/2 sum (T_probe-T_measured)^2 over all
+     * measurements. The initial state and the state every 'checkpoint
+     * interval' steps are stored in 'checkpoints' for the adjoint. If
+     * write_output is true, the probe temperatures are written to the
+     * output files after every step.
+     */
+    restore(calibration_initial_state);
+    checkpoints.resize(1);
+    checkpoints[0]=calibration_initial_state;
+
+    double misfit=0.;
+    for (unsigned int step=1; step<=timestep_number_max; ++step)
+      {
+	timestep_number++;
+	update_met_data();
+
+	unsigned int linear_iterations=0;
+	solve_time_step(linear_iterations);
+	evaluate_probes();
+	if (measurement_rows[step]>=0)
+	  {
+	    const std::vector<double> &measured=
+	      measured_temperatures[measurement_rows[step]];
+	    for (unsigned int i=0; i<probe_values.size(); i++)
+	      misfit+=0.5*(probe_values[i]-measured[i+1])*(probe_values[i]-measured[i+1]);
+	  }
+	if (write_output)
+	  record_output();
+	old_solution=solution;
+
+	if (step%parameters.calibration_checkpoint_interval==0 &&
+	    step<timestep_number_max)
+	  {
+	    checkpoints.push_back(State());
+	    snapshot(checkpoints.back());
+	  }
+      }
+    return misfit;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::adjoint_gradient(const std::vector<State> &checkpoints,
+					std::vector<double>      &gradient)
+  {
+    /*
+     * Reverse sweep of the discrete adjoint, one checkpoint interval at a
+     * time from the last one: the states of the interval are recomputed
+     * from its checkpoint (the same Picard iterations as in the forward
+     * run, the coefficient cache is off) and the adjoint steps are done
+     * backwards through them.
+     */
+    const unsigned int n_dofs=dof_handler.n_dofs();
+    Vector<double> adjoint      (n_dofs);
+    Vector<double> mass_adjoint (n_dofs);
+    std::vector<Vector<double> > interval_solutions;
+
+    /*
+     * The parameters do not change during the sweep, so the perturbed
+     * materials are built here once. Forward differences, backwards if
+     * the parameter would go over 1.
+     */
+    const double parameter_perturbation=1.E-6;
+    perturbed_materials.resize(calibration_parameters.size());
+    parameter_perturbations.assign(calibration_parameters.size(),0.);
+    for (unsigned int k=0; k<calibration_parameters.size(); k++)
+      {
+	const CalibrationParameter &parameter=calibration_parameters[k];
+	perturbed_materials[k].reset();
+	if (parameter.type==heat_loss_parameter)
+	  continue;
+	const double value=calibration_parameter(k);
+	parameter_perturbations[k]=
+	  (value+parameter_perturbation>1. ? -parameter_perturbation :
+	   parameter_perturbation);
+	std::tuple<std::string,double,double,std::string> perturbed_layer=
+	  physics.layer_data[parameter.layer];
+	if (parameter.type==porosity_parameter)
+	  std::get<1>(perturbed_layer)+=parameter_perturbations[k];
+	else
+	  std::get<2>(perturbed_layer)+=parameter_perturbations[k];
+	perturbed_materials[k].reset(new PorousMaterial(std::get<0>(perturbed_layer),
+							std::get<1>(perturbed_layer),
+							std::get<2>(perturbed_layer)));
+      }
+
+    gradient.assign(calibration_parameters.size(),0.);
+    for (int c=checkpoints.size()-1; c>=0; --c)
+      {
+	const unsigned int first_step=checkpoints[c].timestep_number;
+	const unsigned int last_step =
+	  std::min(first_step+parameters.calibration_checkpoint_interval,
+		   timestep_number_max);
+
+	restore(checkpoints[c]);
+	interval_solutions.resize(last_step-first_step+1);
+	interval_solutions[0]=solution;
+	for (unsigned int step=first_step+1; step<=last_step; ++step)
+	  {
+	    timestep_number++;
+	    update_met_data();
+
+	    unsigned int linear_iterations=0;
+	    solve_time_step(linear_iterations);
+	    old_solution=solution;
+	    interval_solutions[step-first_step]=solution;
+	  }
+
+	for (unsigned int step=last_step; step>first_step; --step)
+	  {
+	    timestep_number=step;
+	    time           =(step-1)*time_step;
+	    update_met_data();
+	    adjoint_step(step,
+			 interval_solutions[step-first_step],
+			 interval_solutions[step-first_step-1],
+			 adjoint,mass_adjoint,gradient);
+	  }
+      }
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::adjoint_step(const unsigned int    step,
+				    const Vector<double> &new_temperature,
+				    const Vector<double> &old_temperature,
+				    Vector<double>       &adjoint,
+				    Vector<double>       &mass_adjoint,
+				    std::vector<double>  &gradient)
+  {
+    /*
+     * Adjoint of time step 'step', with the forcing of that step set. The
+     * residual of the step (backward Euler, see assemble_cells()) is
+     *
+     *   R_n = M(T_n) (T_n-T_{n-1}) + dt K(T_n) T_n + dt H (T_n-T_room)
+     *         + boundary and source terms
+     *
+     * with T_n fixed on the Dirichlet dofs, and the adjoint l_n solves
+     *
+     *   (dR_n/dT_n)^T l_n = dJ/dT_n + M(T_{n+1}) l_{n+1}
+     *
+     * with l_n=0 on the Dirichlet dofs. On entry mass_adjoint is
+     * M(T_{n+1}) l_{n+1} (zero before the last step) and on return it is
+     * M(T_n) l_n. -l_n^T dR_n/dp is added to the gradient. The derivatives
+     * of the material data with respect to the temperature and to the
+     * layer parameters are finite differences at each quadrature point.
+     */
+    const double temperature_perturbation=1.E-4;
+
+    FEValues<dim> fe_values(fe, quadrature_formula,
+			    update_values | update_gradients | update_JxW_values);
+    FEFaceValues<dim> fe_face_values(fe, face_quadrature_formula,
+				     update_values | update_JxW_values);
+
+    const unsigned int dofs_per_cell   = fe.dofs_per_cell;
+    const unsigned int n_q_points      = quadrature_formula.size();
+    const unsigned int n_face_q_points = face_quadrature_formula.size();
+
+    FullMatrix<double> cell_matrix  (dofs_per_cell,dofs_per_cell);
+    Vector<double>     cell_vector  (dofs_per_cell);
+    Vector<double>     cell_adjoint (dofs_per_cell);
+    std::vector<types::global_dof_index> local_dof_indices (dofs_per_cell);
+    std::vector<double>         new_values    (n_q_points);
+    std::vector<double>         old_values    (n_q_points);
+    std::vector<Tensor<1,dim> > new_gradients (n_q_points);
+
+    adjoint_matrix=0.;
+    adjoint_rhs   =mass_adjoint;
+    if (measurement_rows[step]>=0)
+      {
+	const std::vector<double> &measured=
+	  measured_temperatures[measurement_rows[step]];
+	for (unsigned int i=0; i<probe_weights.size(); i++)
+	  {
+	    double value=0.;
+	    for (unsigned int j=0; j<probe_weights[i].size(); j++)
+	      value+=probe_weights[i][j].second*new_temperature(probe_weights[i][j].first);
+	    for (unsigned int j=0; j<probe_weights[i].size(); j++)
+	      adjoint_rhs(probe_weights[i][j].first)+=
+		(value-measured[i+1])*probe_weights[i][j].second;
+	  }
+      }
+
+    typename DoFHandler<dim>::active_cell_iterator
+      cell = dof_handler.begin_active(),
+      endc = dof_handler.end();
+    for (; cell!=endc; ++cell)
+      {
+	cell_matrix=0;
+	fe_values.reinit (cell);
+	fe_values.get_function_values   (new_temperature,new_values);
+	fe_values.get_function_values   (old_temperature,old_values);
+	fe_values.get_function_gradients(new_temperature,new_gradients);
+
+	const double cell_center=cell->center()[dim-1];
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    double thermal_conductivity          =0.;
+	    double total_volumetric_heat_capacity=0.;
+	    double perturbed_thermal_conductivity=0.;
+	    double perturbed_heat_capacity       =0.;
+	    double ice_saturation                =0.;
+	    physics.material_data(cell_center,new_values[q_point],
+				  thermal_conductivity,total_volumetric_heat_capacity,
+				  ice_saturation);
+	    physics.material_data(cell_center,new_values[q_point]+temperature_perturbation,
+				  perturbed_thermal_conductivity,perturbed_heat_capacity,
+				  ice_saturation);
+	    const double heat_capacity_derivative=
+	      (perturbed_heat_capacity-total_volumetric_heat_capacity)/temperature_perturbation;
+	    const double conductivity_derivative=
+	      (perturbed_thermal_conductivity-thermal_conductivity)/temperature_perturbation;
+	    /*
+	     * Mass, heat capacity derivative and heat loss terms multiply
+	     * the same shape values.
+	     */
+	    const double value_coefficient=
+	      total_volumetric_heat_capacity+
+	      heat_capacity_derivative*(new_values[q_point]-old_values[q_point])+
+	      time_step*parameters.heat_loss_factor;
+	    /*
+	     * The cell matrix is the transpose of the cell Jacobian: entry
+	     * (j,i) is dR_i/dT_j.
+	     */
+	    for (unsigned int i=0; i<dofs_per_cell; ++i)
+	      for (unsigned int j=0; j<dofs_per_cell; ++j)
+		cell_matrix(j,i)+=
+		  (value_coefficient*
+		   fe_values.shape_value(i,q_point)*
+		   fe_values.shape_value(j,q_point)+
+		   time_step*thermal_conductivity*
+		   (fe_values.shape_grad(i,q_point)*
+		    fe_values.shape_grad(j,q_point))+
+		   time_step*conductivity_derivative*
+		   fe_values.shape_value(j,q_point)*
+		   (new_gradients[q_point]*fe_values.shape_grad(i,q_point)))*
+		  fe_values.JxW(q_point);
+	  }
+	cell->get_dof_indices (local_dof_indices);
+	hanging_node_constraints.distribute_local_to_global (cell_matrix,
+							     local_dof_indices,
+							     adjoint_matrix);
+      }
+
+    for (unsigned int f=0; f<boundary_faces.size(); ++f)
+      {
+	double h=0.;
+	if (boundary_faces[f].boundary_id==top_boundary_id &&
+	    top_boundary_condition==third_type_top)
+	  h=top_convective_coefficient;
+	else if (boundary_faces[f].boundary_id==lateral_boundary_id)
+	  h=parameters.lateral_heat_transfer_coefficient;
+	if (h==0.)
+	  continue;
+
+	cell_matrix=0;
+	fe_face_values.reinit (boundary_faces[f].cell,boundary_faces[f].face);
+	for (unsigned int q_face_point=0; q_face_point<n_face_q_points; ++q_face_point)
+	  for (unsigned int i=0; i<dofs_per_cell; ++i)
+	    for (unsigned int j=0; j<dofs_per_cell; ++j)
+	      cell_matrix(i,j)+=
+		time_step*h*
+		fe_face_values.shape_value (i,q_face_point) *
+		fe_face_values.shape_value (j,q_face_point) *
+		fe_face_values.JxW         (q_face_point);
+	boundary_faces[f].cell->get_dof_indices (local_dof_indices);
+	hanging_node_constraints.distribute_local_to_global (cell_matrix,
+							     local_dof_indices,
+							     adjoint_matrix);
+      }
+
+    /*
+     * Zero adjoint on the Dirichlet dofs.
+     */
+    eliminate_dirichlet_rows_and_columns (adjoint_matrix,&adjoint_rhs);
+
+    adjoint=0.;
+    if (adjoint_rhs.l2_norm()>0.)
+      {
+	Profiling::Profiler::Scope scope(profiler,linear_solve_section);
+	SolverControl solver_control (std::max<unsigned int>(1000,adjoint.size()),
+				      1e-10*adjoint_rhs.l2_norm ());
+	SolverGMRES<> gmres (solver_control);
+	PreconditionSSOR<> preconditioner;
+	preconditioner.initialize (adjoint_matrix, 1.2);
+	gmres.solve (adjoint_matrix, adjoint, adjoint_rhs,
+		     preconditioner);
+	hanging_node_constraints.distribute (adjoint);
+      }
+
+    /*
+     * Gradient contributions and M(T_n) l_n.
+     */
+    mass_adjoint=0.;
+    for (cell=dof_handler.begin_active(); cell!=endc; ++cell)
+      {
+	cell_vector=0;
+	fe_values.reinit (cell);
+	fe_values.get_function_values   (new_temperature,new_values);
+	fe_values.get_function_values   (old_temperature,old_values);
+	fe_values.get_function_gradients(new_temperature,new_gradients);
+	cell->get_dof_values (adjoint,cell_adjoint);
+
+	const double cell_center=cell->center()[dim-1];
+	const unsigned int layer=physics.find_layer(cell_center);
+	for (unsigned int q_point=0; q_point<n_q_points; ++q_point)
+	  {
+	    double adjoint_value=0.;
+	    Tensor<1,dim> grad_adjoint;
+	    for (unsigned int i=0; i<dofs_per_cell; ++i)
+	      {
+		adjoint_value+=cell_adjoint(i)*fe_values.shape_value(i,q_point);
+		grad_adjoint +=cell_adjoint(i)*fe_values.shape_grad(i,q_point);
+	      }
+
+	    double thermal_conductivity          =0.;
+	    double total_volumetric_heat_capacity=0.;
+	    double ice_saturation                =0.;
+	    physics.material_data(cell_center,new_values[q_point],
+				  thermal_conductivity,total_volumetric_heat_capacity,
+				  ice_saturation);
+	    for (unsigned int i=0; i<dofs_per_cell; ++i)
+	      cell_vector(i)+=
+		total_volumetric_heat_capacity*adjoint_value*
+		fe_values.shape_value(i,q_point)*
+		fe_values.JxW(q_point);
+
+	    for (unsigned int k=0; k<calibration_parameters.size(); k++)
+	      {
+		const CalibrationParameter &parameter=calibration_parameters[k];
+		if (parameter.type==heat_loss_parameter)
+		  {
+		    gradient[k]-=
+		      time_step*(new_values[q_point]-new_room_temperature)*
+		      adjoint_value*fe_values.JxW(q_point);
+		    continue;
+		  }
+		if (parameter.layer!=layer)
+		  continue;
+
+		const double perturbation=parameter_perturbations[k];
+		PorousMaterial &perturbed_material=*perturbed_materials[k];
+		const double perturbed_thermal_conductivity=
+		  perturbed_material.thermal_conductivity(std::get<3>(physics.layer_data[layer]));
+		const double perturbed_heat_capacity=
+		  perturbed_material.volumetric_heat_capacity(new_values[q_point]);
+
+		gradient[k]-=
+		  ((perturbed_heat_capacity-total_volumetric_heat_capacity)/perturbation*
+		   (new_values[q_point]-old_values[q_point])*adjoint_value+
+		   time_step*(perturbed_thermal_conductivity-thermal_conductivity)/perturbation*
+		   (new_gradients[q_point]*grad_adjoint))*
+		  fe_values.JxW(q_point);
+	      }
+	  }
+	cell->get_dof_indices (local_dof_indices);
+	hanging_node_constraints.distribute_local_to_global (cell_vector,
+							     local_dof_indices,
+							     mass_adjoint);
+      }
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::misfit_and_gradient(const std::vector<double> &values,
+					     std::vector<double>       &gradient)
+  {
+    /*
+     * One forward run and one adjoint run (plus the recomputation of the
+     * states between checkpoints).
+     */
+    for (unsigned int k=0; k<calibration_parameters.size(); k++)
+      set_calibration_parameter(k,values[k]);
+
+    std::vector<State> checkpoints;
+    const double misfit=forward_misfit(checkpoints,false);
+    adjoint_gradient(checkpoints,gradient);
+    return misfit;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::run_calibration()
+  {
+    setup_calibration();
+    snapshot(calibration_initial_state);
+
+    const unsigned int n_parameters=calibration_parameters.size();
+    std::vector<double> values   (n_parameters,0.);
+    std::vector<double> gradient (n_parameters,0.);
+    for (unsigned int k=0; k<n_parameters; k++)
+      values[k]=calibration_parameter(k);
+
+    double misfit=0.;
+    unsigned int iterations=0;
+    if (calibration_mode==calibration_gradient)
+      {
+	misfit=misfit_and_gradient(values,gradient);
+
+	std::vector<double> difference_gradient;
+	if (parameters.calibration_check_gradient)
+	  {
+	    std::vector<State> checkpoints;
+	    for (unsigned int k=0; k<n_parameters; k++)
+	      {
+		const double h=1.E-4*std::max(std::fabs(values[k]),1.E-2);
+		set_calibration_parameter(k,values[k]+h);
+		const double misfit_plus=forward_misfit(checkpoints,false);
+		set_calibration_parameter(k,values[k]-h);
+		const double misfit_minus=forward_misfit(checkpoints,false);
+		set_calibration_parameter(k,values[k]);
+		difference_gradient.push_back((misfit_plus-misfit_minus)/(2.*h));
+	      }
+	  }
+
+	if (logger.is_enabled(Logging::Logger::normal))
+	  {
+	    std::ostream &out=logger.stream();
+	    out << "Calibration misfit: " << misfit << " C2\n";
+	    for (unsigned int k=0; k<n_parameters; k++)
+	      {
+		out << "\t" << calibration_parameters[k].name << " = " << values[k]
+		    << "\tgradient: " << gradient[k];
+		if (difference_gradient.size()!=0)
+		  out << "\tfinite differences: " << difference_gradient[k];
+		out << "\n";
+	      }
+	  }
+      }
+    else
+      {
+	/*
+	 * L-BFGS in the variables p_k/s_k, with s_k the initial value of
+	 * the parameter (1 if it is zero), so that the first step changes
+	 * all parameters by at most 10%.
+	 */
+	std::vector<double> scales (n_parameters,1.);
+	std::vector<double> x      (n_parameters,0.);
+	std::vector<double> lower  (n_parameters,0.);
+	std::vector<double> upper  (n_parameters,0.);
+	for (unsigned int k=0; k<n_parameters; k++)
+	  {
+	    if (values[k]!=0.)
+	      scales[k]=std::fabs(values[k]);
+	    x[k]=values[k]/scales[k];
+	    if (calibration_parameters[k].type==porosity_parameter)
+	      {
+		lower[k]=1.E-3/scales[k];
+		upper[k]=0.999/scales[k];
+	      }
+	    else if (calibration_parameters[k].type==saturation_parameter)
+	      upper[k]=1./scales[k];
+	    else
+	      upper[k]=std::numeric_limits<double>::max();
+	  }
+
+	const auto scaled_misfit=[&](const std::vector<double> &scaled_values,
+				     std::vector<double>       &scaled_gradient)
+	  {
+	    std::vector<double> p (n_parameters,0.);
+	    for (unsigned int k=0; k<n_parameters; k++)
+	      p[k]=scaled_values[k]*scales[k];
+	    const double value=misfit_and_gradient(p,scaled_gradient);
+	    for (unsigned int k=0; k<n_parameters; k++)
+	      scaled_gradient[k]*=scales[k];
+	    return value;
+	  };
+
+	LBFGS lbfgs (parameters.calibration_history_size,
+		     parameters.calibration_max_iterations,
+		     parameters.calibration_gradient_tolerance);
+	iterations=lbfgs.minimize (x,lower,upper,scaled_misfit,misfit,
+				   logger.is_enabled(Logging::Logger::normal) ?
+				   &logger.stream() : 0);
+	for (unsigned int k=0; k<n_parameters; k++)
+	  {
+	    values[k]=x[k]*scales[k];
+	    set_calibration_parameter(k,values[k]);
+	  }
+
+	std::ofstream file (parameters.calibration_output_file.c_str());
+	file << std::setprecision(10);
+	for (unsigned int k=0; k<n_parameters; k++)
+	  file << calibration_parameters[k].name << "\t" << values[k] << "\n";
+
+	if (logger.is_enabled(Logging::Logger::normal))
+	  {
+	    std::ostream &out=logger.stream();
+	    out << "Calibration: " << iterations << " L-BFGS iterations, misfit "
+		<< misfit << " C2\n";
+	    for (unsigned int k=0; k<n_parameters; k++)
+	      out << "\t" << calibration_parameters[k].name << " = " << values[k] << "\n";
+	  }
+      }
+
+    /*
+     * Final run with the (calibrated) parameters for the output data file.
+     */
+    std::vector<State> checkpoints;
+    forward_misfit(checkpoints,true);
+
+    profiler.set_info("calibration_misfit",misfit);
+    profiler.set_info("calibration_iterations",iterations);
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::initialize(const std::vector< std::pair<double,double> > &temperature_profile)
+  {
+    setup_problem();
+    {
+      Profiling::Profiler::Scope scope(profiler,initial_condition_section);
+      project_initial_condition(temperature_profile);
+    }
+    column_thermal_energy=total_thermal_energy(solution);
+    evaluate_probes();
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::set_surface_temperature(const double temperature)
+  {
+    new_surface_temperature=temperature;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::set_room_temperature(const double temperature)
+  {
+    new_room_temperature=temperature;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::set_point_source_magnitude(const unsigned int source,
+						  const double magnitude)
+  {
+    if (source>=new_point_source_magnitudes.size())
+      {
+	std::cout << "Error, point source " << source << " not defined\n";
+	throw 1;
+      }
+    new_point_source_magnitudes[source]=magnitude;
+  }
+
+  template <int dim>
+  unsigned int Heat_Pipe<dim>::advance(const double dt)
+  {
+    /*
+     * Same as one time step of run() without reading forcing data or
+     * writing output. Returns the number of Picard iterations.
+     */
+    if (timestep_number==0)
+      {
+	old_surface_temperature    =new_surface_temperature;
+	old_room_temperature       =new_room_temperature;
+	old_point_source_magnitudes=new_point_source_magnitudes;
+      }
+
+    time_step=dt;
+    timestep_number++;
+
+    unsigned int linear_iterations=0;
+    const unsigned int iteration=solve_time_step(linear_iterations);
+    {
+      Profiling::Profiler::Scope scope(profiler,probe_extraction_section);
+      evaluate_probes();
+    }
+
+    if (time_integrator==bdf2)
+      {
+	older_solution         =old_solution;
+	older_time_step        =time_step;
+      }
+    old_solution               =solution;
+    old_surface_temperature    =new_surface_temperature;
+    old_room_temperature       =new_room_temperature;
+    old_point_source_magnitudes=new_point_source_magnitudes;
+
+    return iteration;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::snapshot(State &state) const
+  {
+    /*
+     * Between steps solution and old_solution are the same and the forcing
+     * values at the start of the next step are the old ones. The vectors in
+     * 'state' are reused if they already have the right size.
+     */
+    state.solution                =solution;
+    state.older_solution          =older_solution;
+    state.older_time_step         =older_time_step;
+    state.time                    =time;
+    state.timestep_number         =timestep_number;
+    state.surface_temperature     =old_surface_temperature;
+    state.room_temperature        =old_room_temperature;
+    state.point_source_magnitudes =old_point_source_magnitudes;
+    state.probe_values            =probe_values;
+    state.column_thermal_energy   =column_thermal_energy;
+    state.heat_flux_top           =heat_flux_top;
+    state.heat_flux_bottom        =heat_flux_bottom;
+    state.heat_flux_lateral       =heat_flux_lateral;
+    state.heat_loss_rate          =heat_loss_rate;
+    state.point_source_rate       =point_source_rate;
+    state.energy_balance_error    =energy_balance_error;
+  }
+
+  template <int dim>
+  void Heat_Pipe<dim>::restore(const State &state)
+  {
+    /*
+     * The lagged coefficients only depend on the temperature at each
+     * quadrature point, so the coefficient cache stays valid.
+     */
+    if (state.solution.size()!=dof_handler.n_dofs())
+      {
+	std::cout << "Error, state does not match the number of dofs\n";
+	throw 1;
+      }
+    solution                   =state.solution;
+    old_solution               =state.solution;
+    older_solution             =state.older_solution;
+    older_time_step            =state.older_time_step;
+    time                       =state.time;
+    timestep_number            =state.timestep_number;
+    old_surface_temperature    =state.surface_temperature;
+    new_surface_temperature    =state.surface_temperature;
+    old_room_temperature       =state.room_temperature;
+    new_room_temperature       =state.room_temperature;
+    old_point_source_magnitudes=state.point_source_magnitudes;
+    new_point_source_magnitudes=state.point_source_magnitudes;
+    probe_values               =state.probe_values;
+    column_thermal_energy      =state.column_thermal_energy;
+    physics.seek_forcing(time);
+    heat_flux_top              =state.heat_flux_top;
+    heat_flux_bottom           =state.heat_flux_bottom;
+    heat_flux_lateral          =state.heat_flux_lateral;
+    heat_loss_rate             =state.heat_loss_rate;
+    point_source_rate          =state.point_source_rate;
+    energy_balance_error       =state.energy_balance_error;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::current_time() const
+  {
+    return time;
+  }
+
+  template <int dim>
+  const std::vector<double> &Heat_Pipe<dim>::probe_temperatures() const
+  {
+    return probe_values;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::top_heat_flux() const
+  {
+    return heat_flux_top;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::bottom_heat_flux() const
+  {
+    return heat_flux_bottom;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::lateral_heat_flux() const
+  {
+    return heat_flux_lateral;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::thermal_energy() const
+  {
+    return column_thermal_energy;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::balance_error() const
+  {
+    return energy_balance_error;
+  }
+
+  template <int dim>
+  double Heat_Pipe<dim>::time_error_estimate() const
+  {
+    return time_error;
+  }
+
+  template class Heat_Pipe<1>;
+  template class Heat_Pipe<2>;
+  template class Heat_Pipe<3>;
+}
@@ -0,0 +1,621 @@
+#ifndef HEAT_PIPE_H
+#define HEAT_PIPE_H
+
+#include <deal.II/base/multithread_info.h>  
+#include <deal.II/base/parameter_handler.h>
+#include <deal.II/base/mpi.h>
+#include <deal.II/base/smartpointer.h>
+#include <deal.II/base/vectorization.h>
+
+#include <deal.II/dofs/dof_handler.h> 
+#include <deal.II/dofs/dof_tools.h>
+
+#include <deal.II/fe/fe_q.h>
+#include <deal.II/fe/fe_tools.h>
+#include <deal.II/fe/fe_values.h>
+#include <deal.II/fe/mapping_q1.h>
+
+#include <deal.II/grid/tria.h>
+#include <deal.II/grid/grid_generator.h>
+#include <deal.II/grid/grid_tools.h>
+
+#include <deal.II/lac/vector.h>
+#include <deal.II/lac/full_matrix.h>
+#include <deal.II/lac/dynamic_sparsity_pattern.h>
+#include <deal.II/lac/sparse_matrix.h>   
+#include <deal.II/lac/solver_cg.h>
+#include <deal.II/lac/solver_gmres.h>
+#include <deal.II/lac/precondition.h>
+#ifdef DEAL_II_WITH_TRILINOS
+#include <deal.II/lac/trilinos_precondition.h>
+#endif
+
+#include <deal.II/numerics/vector_tools.h>
+#include <deal.II/numerics/matrix_tools.h>
+#include <deal.II/numerics/data_out.h>
+
+#include <PorousMaterial.h>
+#include <DataTools.h>
+#include <Names.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <math.h>
+#include <memory>
+#include <new>
+#include <set>
+#include <sstream> 
+#include <string>
+#include <thread>
+#include <vector>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace TRL
+{
+  using namespace dealii;
+#include "InitialValue.h"
+#include "VerticalProfile.h"
+#include "parameters.h"
+#include "amg.h"
+#include "Profiler.h"
+#include "CoefficientCache.h"
+#include "Logger.h"
+#include "SumFactorization.h"
+#include "ReducedModel.h"
+#include "LBFGS.h"
+#include "ForcingSeries.h"
+#include "ColumnPhysics.h"
+#include "OutputAggregator.h"
+#include "AllocationCounter.h"
+#include "SharedMonitor.h"
+#include "ProfileCholesky.h"
+
+  /*
+   * Time integrators. bdf2 and sdirk2 are built from backward Euler
+   * solves (stages) with a modified time step and old solution, so they
+   * use the backward_euler assembly kernels.
+   */
+  enum TimeIntegrator
+  {
+    theta_method,
+    bdf2,
+    sdirk2
+  };
+
+  enum ReducedModelMode
+  {
+    reduced_model_off,
+    reduced_model_train,
+    reduced_model_online,
+    reduced_model_validate
+  };
+
+  enum CalibrationMode
+  {
+    calibration_off,
+    calibration_gradient,
+    calibration_optimize
+  };
+
+  /*
+   * Parameters that can be calibrated: the porosity and the degree of
+   * saturation of a layer, and the heat loss factor.
+   */
+  enum CalibrationParameterType
+  {
+    porosity_parameter,
+    saturation_parameter,
+    heat_loss_parameter
+  };
+
+  template <int dim>
+  class Heat_Pipe
+  {
+  public:
+    Heat_Pipe(int argc, char *argv[]);
+    Heat_Pipe(const Parameters::AllParameters<dim> &parameters,
+	      const std::vector< std::vector<double> > &probe_coordinates);
+    ~Heat_Pipe();
+    void run();
+
+    /*
+     * Step by step interface, used to couple the model with other codes.
+     * No files are read or written after construction and nothing is
+     * printed but the setup information:
+     *
+     *   ParameterHandler prm;
+     *   Parameters::AllParameters<1>::declare_parameters (prm);
+     *   prm.parse_input_from_string (...);  // or set the struct directly
+     *   Parameters::AllParameters<1> parameters;
+     *   parameters.parse_parameters (prm);
+     *
+     *   Heat_Pipe<1> heat_pipe (parameters, probe_coordinates);
+     *   heat_pipe.initialize (temperature_profile);
+     *   for (...)
+     *     {
+     *       heat_pipe.set_surface_temperature (...);
+     *       heat_pipe.advance (dt);
+     *       ... heat_pipe.probe_temperatures(), heat_pipe.top_heat_flux()
+     *     }
+     *
+     * Probe coordinates are given as in the depths file (X, Y, depth) and
+     * the temperature profile as (depth, temperature) pairs, as in the
+     * initial condition file. Forcing values set before advance() are the
+     * values at the end of that step, the values at its start are the ones
+     * of the previous step (or the same ones for the first step).
+     *
+     * With the sdirk2 integrator time_error_estimate() is the embedded
+     * estimate of the local error (max norm, C) of the last step, so that
+     * a driver can adapt dt. Varying dt is also allowed with bdf2. The
+     * bdf2 history (the solution and time step before the last step) is
+     * part of the state, so that a restored state continues the same
+     * trajectory; without history (first step) the step is an sdirk2 step.
+     */
+    struct State
+    {
+      Vector<double>      solution;
+      Vector<double>      older_solution;
+      double              older_time_step;
+      double              time;
+      unsigned int        timestep_number;
+      double              surface_temperature;
+      double              room_temperature;
+      std::vector<double> point_source_magnitudes;
+      std::vector<double> probe_values;
+      double              column_thermal_energy;
+      double              heat_flux_top;
+      double              heat_flux_bottom;
+      double              heat_flux_lateral;
+      double              heat_loss_rate;
+      double              point_source_rate;
+      double              energy_balance_error;
+    };
+
+    void initialize (const std::vector< std::pair<double,double> > &temperature_profile);
+    void set_surface_temperature (const double temperature);
+    void set_room_temperature (const double temperature);
+    void set_point_source_magnitude (const unsigned int source,
+				     const double magnitude);
+    unsigned int advance (const double dt);
+    void snapshot (State &state) const;
+    void restore (const State &state);
+
+    double current_time () const;
+    const std::vector<double> &probe_temperatures () const;
+    double top_heat_flux () const;
+    double bottom_heat_flux () const;
+    double lateral_heat_flux () const;
+    double thermal_energy () const;
+    double balance_error () const;
+    double time_error_estimate () const;
+
+  private:
+    static Parameters::AllParameters<dim> read_parameters(int argc, char *argv[]);
+    void setup_parameters();
+    void setup_problem();
+    void read_grid_temperature();
+    void setup_system_temperature();
+    void setup_point_sources();
+    void setup_probes();
+    void setup_boundary_faces();
+    void setup_batched_assembly();
+    void setup_sum_factorization();
+    void assemble_system_temperature();
+    template <ThetaScheme scheme>
+    void assemble_domain();
+    template <ThetaScheme scheme>
+    void assemble_cells();
+    template <ThetaScheme scheme>
+    void assemble_cells_batched();
+    template <ThetaScheme scheme>
+    void assemble_cells_sum_factorized();
+    template <ThetaScheme scheme>
+    void check_batched_assembly();
+    template <ThetaScheme scheme>
+    void assemble_boundary_faces();
+    template <ThetaScheme scheme, TopBoundaryCondition top_condition>
+    void assemble_face_terms();
+    void apply_boundary_conditions();
+    void eliminate_dirichlet_rows_and_columns(SparseMatrix<double> &matrix,
+					      Vector<double>       *rhs,
+					      const double          bottom_value=0.,
+					      const double          top_value=0.);
+    unsigned int solve_temperature();
+    unsigned int solve_temperature_mixed_precision();
+    unsigned int solve_time_step(unsigned int &linear_iterations);
+    unsigned int solve_picard(unsigned int &linear_iterations);
+    bool linear_regime(const Vector<double> &temperature) const;
+    void setup_linear_operators();
+    bool solve_linear_step(unsigned int &linear_iterations);
+    unsigned int solve_stage(const double stage_time_step,
+			     const double stage_fraction,
+			     const double stage_weight,
+			     unsigned int &linear_iterations);
+    unsigned int solve_bdf2_step(unsigned int &linear_iterations);
+    unsigned int solve_sdirk2_step(unsigned int &linear_iterations);
+    void run_parareal();
+    void propagate(const State &start,
+		   const unsigned int n_steps,
+		   const double dt,
+		   State &end,
+		   std::ostream *output);
+    void check_reduced_model_support() const;
+    void collect_snapshot();
+    void build_reduced_model();
+    void build_reduced_field(const std::vector<Vector<double> > &snapshots,
+			     const bool                          mass,
+			     const Vector<double>               &lift_top,
+			     const Vector<double>               &lift_bottom,
+			     ReducedModel::Field                &field);
+    void setup_reduced_model();
+    unsigned int advance_reduced_model();
+    void run_reduced_model();
+    void setup_calibration();
+    double calibration_parameter(const unsigned int k) const;
+    void set_calibration_parameter(const unsigned int k,
+				   const double value);
+    double forward_misfit(std::vector<State> &checkpoints,
+			  const bool          write_output);
+    void adjoint_gradient(const std::vector<State> &checkpoints,
+			  std::vector<double>      &gradient);
+    void adjoint_step(const unsigned int    step,
+		      const Vector<double> &new_temperature,
+		      const Vector<double> &old_temperature,
+		      Vector<double>       &adjoint,
+		      Vector<double>       &mass_adjoint,
+		      std::vector<double>  &gradient);
+    double misfit_and_gradient(const std::vector<double> &values,
+			       std::vector<double>       &gradient);
+    void run_calibration();
+    void initial_condition_temperature();
+    void project_initial_condition(const std::vector< std::pair<double,double> > &initial_condition_table);
+    void steady_state_initial_condition();
+
+    void output_results ();
+    void fill_output_vectors();
+    void setup_output_aggregators();
+    void record_output();
+    void finish_output_aggregators();
+    void setup_monitor();
+    void publish_monitor_record(const unsigned int picard_iterations,
+				const unsigned int linear_iterations);
+    void write_output_line(std::ostream &out) const;
+    void evaluate_probes();
+    void compute_diagnostics();
+    void reset_heat_rates();
+    void add_heat_rates(const Vector<double> &old_temperature,
+			const Vector<double> &new_temperature,
+			const double          theta,
+			const double          weight);
+    double total_thermal_energy(const Vector<double> &temperature);
+    void update_met_data ();
+
+    Point<dim> probe_point(const std::vector<double> &coordinates) const;
+    //double snow_surface_heat_flux(double surface_temperature); //(W/m2)
+
+    Triangulation<dim>   triangulation;
+    DoFHandler<dim>      dof_handler;
+    FE_Q<dim>            fe;
+    /*
+     * Gauss quadrature with fe.degree+2 points per direction for all cell
+     * and face integrals: one point more than needed for the mass matrix
+     * with a constant coefficient, since the heat capacity varies with the
+     * temperature inside each cell.
+     */
+    const QGauss<dim>    quadrature_formula;
+    const QGauss<dim-1>  face_quadrature_formula;
+
+    ConstraintMatrix     hanging_node_constraints;
+    SparsityPattern      sparsity_pattern;
+    SparseMatrix<double> system_matrix;
+    Vector<double>       system_rhs;
+    Vector<double>       solution;
+    Vector<double>       old_solution;
+    /*
+     * History and work vectors of the bdf2 and sdirk2 integrators.
+     * older_solution is the solution before old_solution, taken
+     * older_time_step before it, and is empty until the first step is
+     * done (then bdf2 starts with an sdirk2 step). stage_history is the
+     * old solution seen by the backward Euler solve of a stage.
+     */
+    Vector<double>       older_solution;
+    Vector<double>       stage_history;
+    Vector<double>       stage_solution;
+    double               older_time_step;
+    double               time_error;
+    double               max_time_error;
+    /*
+     * Degrees of freedom on the bottom and top boundaries. They do not
+     * change during the run, so they are found once in
+     * setup_system_temperature() and only the boundary values are updated
+     * every time step.
+     */
+    std::vector<types::global_dof_index> bottom_boundary_dofs;
+    std::vector<types::global_dof_index> top_boundary_dofs;
+    /*
+     * Boundary faces that contribute to the system (top faces for second
+     * and third type conditions, lateral faces with heat exchange), found
+     * once in setup_boundary_faces().
+     */
+    struct BoundaryFace
+    {
+      typename DoFHandler<dim>::active_cell_iterator cell;
+      unsigned int       face;
+      types::boundary_id boundary_id;
+    };
+    std::vector<BoundaryFace> boundary_faces;
+    /*
+     * Data for assemble_cells_batched(), set up in setup_batched_assembly()
+     * when the mesh is a uniform 1D mesh: for each cell the two dof
+     * indices, the four positions of its entries in the system matrix
+     * and the depth of its center.
+     */
+    bool                                 batched_assembly;
+    double                               batch_cell_size;
+    std::vector<types::global_dof_index> batch_dof_indices;
+    std::vector<std::size_t>             batch_matrix_entries;
+    std::vector<double>                  batch_cell_centers;
+    std::vector<double>                  batch_shape_values[2];
+    double                               batch_shape_grads[2];
+    std::vector<double>                  batch_JxW;
+    /*
+     * Tensor product kernels for assemble_cells_sum_factorized(), used in
+     * 2D and 3D. See setup_sum_factorization().
+     */
+    bool                                 sum_factorized_assembly;
+    SumFactorization<dim>                sum_factorization;
+    /*
+     * FEValues objects and cell buffers of the assembly and diagnostics
+     * loops, created once in setup_system_temperature() with the sizes of
+     * the finite element, so that a time step does not allocate memory.
+     * The loops that use them run one after the other, never nested, so
+     * they share the buffers: each loop only relies on what it wrote
+     * itself.
+     */
+    struct Scratch
+    {
+      Scratch (const FiniteElement<dim> &fe,
+	       const Quadrature<dim>    &quadrature,
+	       const Quadrature<dim-1>  &face_quadrature);
+
+      FEValues<dim>      fe_values;
+      FEValues<dim>      value_fe_values;
+      FEFaceValues<dim>  fe_face_values;
+
+      FullMatrix<double> cell_mass_matrix;
+      FullMatrix<double> cell_laplace_matrix;
+      FullMatrix<double> cell_system_matrix;
+      Vector<double>     cell_rhs;
+      Vector<double>     old_temperature_values;
+      std::vector<types::global_dof_index> local_dof_indices;
+      std::vector<double> old_dof_values;
+      std::vector<double> new_dof_values;
+      std::vector<double> heat_loss_rhs;
+
+      std::vector<double> old_function_values;
+      std::vector<double> new_function_values;
+      std::vector<double> average_cell_temperatures;
+      std::vector<double> thermal_conductivities;
+      std::vector<double> heat_capacities;
+      std::vector<double> heat_loss_values;
+      std::vector<double> JxW;
+      std::vector<double> temperature_values;
+
+      std::vector<double>         old_face_values;
+      std::vector<double>         new_face_values;
+      std::vector<Tensor<1,dim> > old_face_gradients;
+      std::vector<Tensor<1,dim> > new_face_gradients;
+    };
+    std::unique_ptr<Scratch> scratch;
+    TopBoundaryCondition top_boundary_condition;
+    ThetaScheme          theta_scheme;
+    TimeIntegrator       time_integrator;
+
+#ifdef DEAL_II_WITH_TRILINOS
+    TrilinosWrappers::PreconditionAMG amg_preconditioner;
+#else
+    LinearSolvers::PreconditionSmoothedAggregation<double> amg_preconditioner;
+#endif
+    /*
+     * Single precision copy of the system matrix, preconditioner and work
+     * vectors of the inner solver of the iterative refinement (see
+     * solve_temperature_mixed_precision()). Only allocated if 'precision'
+     * is 'float'.
+     */
+    bool                 single_precision_solver;
+    SparseMatrix<float>  solver_matrix;
+    LinearSolvers::PreconditionSmoothedAggregation<float> solver_amg_preconditioner;
+    Vector<float>        solver_rhs;
+    Vector<float>        solver_correction;
+    Vector<double>       refinement_residual;
+    /*
+     * Linear solvers and SSOR preconditioners, kept from one solve to the
+     * next (constructing a solver allocates its signals, and the SSOR
+     * preconditioner its work arrays). The solvers are created in
+     * setup_system_temperature(), the tolerance is set for each solve.
+     */
+    SolverControl                               linear_solver_control;
+    std::unique_ptr<SolverCG<> >                linear_solver;
+    PreconditionSSOR<>                          ssor_preconditioner;
+    SolverControl                               inner_solver_control;
+    std::unique_ptr<SolverCG<Vector<float> > >  inner_linear_solver;
+    PreconditionSSOR<SparseMatrix<float> >      solver_ssor_preconditioner;
+    /*
+     * Linear regime (see solve_linear_step()). The heat capacity is
+     * constant away from the freezing point, so for a given time step the
+     * theta scheme is
+     *   linear_system_matrix T_new =
+     *     linear_explicit_matrix T_old + forcing loads
+     * linear_solver_matrix is the system matrix after the elimination of
+     * the Dirichlet dofs, factorized in linear_factorization, or solved
+     * with CG and linear_preconditioner if the factor would be too large.
+     * The loads are per unit surface temperature or heat flux (top) and
+     * per unit room temperature (lateral exchange and heat losses).
+     * linear_operators_valid is reset whenever the materials, the mesh or
+     * the time step change.
+     */
+    bool                 linear_operators_valid;
+    bool                 linear_direct_solve;
+    double               linear_time_step;
+    SparseMatrix<double> linear_system_matrix;
+    SparseMatrix<double> linear_explicit_matrix;
+    SparseMatrix<double> linear_solver_matrix;
+    Vector<double>       linear_top_load;
+    Vector<double>       linear_room_load;
+    Vector<double>       linear_boundary_values;
+    ProfileCholesky      linear_factorization;
+    PreconditionSSOR<>   linear_preconditioner;
+
+    unsigned int timestep_number_max;
+    unsigned int timestep_number;
+    double       time;
+    double       time_step;
+    double       time_max;
+    double       theta_temperature;
+
+    Threads::Mutex assembler_lock;
+    Parameters::AllParameters<dim>  parameters;
+
+    //std::vector< std::vector<int> >    date_and_time;
+    std::vector< std::vector<double> > depths_coordinates;
+    /*
+     * Probe temperatures of the current solution and, for each probe, the
+     * (dof, shape function value) pairs of the cell that contains it,
+     * computed once in setup_probes().
+     */
+    std::vector<double> probe_values;
+    std::vector< std::vector< std::pair<types::global_dof_index,double> > > probe_weights;
+    /*
+     * Unit point source vectors, stored as the (dof, shape function value)
+     * pairs of the cell that contains each source. They only depend on the
+     * mesh and are computed once in setup_point_sources().
+     */
+    std::vector< std::vector< std::pair<types::global_dof_index,double> > > point_source_weights;
+    double old_room_temperature, new_room_temperature;
+    double old_surface_temperature, new_surface_temperature;
+    std::vector<double> old_point_source_magnitudes, new_point_source_magnitudes;
+    std::vector<double> stage_point_source_magnitudes;
+    /*
+     * Energy balance diagnostics, updated once per accepted time step in
+     * compute_diagnostics(). Heat rates are positive into the domain (W in
+     * 3D, per unit length in 2D and per unit area in 1D).
+     */
+    double column_thermal_energy;
+    double old_column_thermal_energy;
+    double heat_flux_top;
+    double heat_flux_bottom;
+    double heat_flux_lateral;
+    double heat_loss_rate;
+    double point_source_rate;
+    double energy_balance_error;
+    double thermal_conductivity_liquids;
+    double thermal_conductivity_air;
+
+    std::ofstream output_file;
+    /*
+     * Aggregation channels of the probe temperatures (see
+     * OutputAggregator), only used by runs that write output files.
+     */
+    std::vector<std::unique_ptr<OutputAggregator> > output_aggregators;
+    /*
+     * Shared memory publisher of one record per time step for live
+     * monitoring (see SharedMonitor.h), and the record, sized once.
+     */
+    std::unique_ptr<Monitoring::Publisher> monitor;
+    std::vector<double>                    monitor_record;
+
+    /*
+     * Wall clock time spent in each phase of the computation and iteration
+     * counters. Section and counter identifiers are registered in the
+     * constructor in the order given here, the profiler checks it.
+     */
+    enum ProfilingSection
+    {
+      mesh_setup_section,
+      initial_condition_section,
+      forcing_section,
+      assembly_section,
+      boundary_conditions_section,
+      linear_solve_section,
+      probe_extraction_section,
+      diagnostics_section,
+      vtu_output_section
+    };
+    enum ProfilingCounter
+    {
+      time_steps_counter,
+      picard_iterations_counter,
+      linear_iterations_counter,
+      coefficient_evaluations_counter,
+      coefficient_reuses_counter,
+      linear_steps_counter
+    };
+    Profiling::Profiler profiler;
+    Logging::Logger     logger;
+    CoefficientCache    coefficient_cache;
+    /*
+     * Reduced model data. In 'train' mode the snapshots are the solutions
+     * (zero on Dirichlet boundaries) and the heat capacity and thermal
+     * conductivity at all quadrature points, cell by cell in the order of
+     * the active cells.
+     */
+    ReducedModelMode             reduced_model_mode;
+    ReducedModel                 reduced_model;
+    Vector<double>               reduced_coordinates;
+    std::vector<Vector<double> > solution_snapshots;
+    std::vector<Vector<double> > heat_capacity_snapshots;
+    std::vector<Vector<double> > conductivity_snapshots;
+    double                       reduced_model_max_error;
+    double                       reduced_model_square_error;
+    double                       reduced_model_wall_time;
+    /*
+     * Calibration data. measurement_rows has one entry per time step (0
+     * to timestep_number_max): the line of measured_temperatures at the
+     * end of that step, or -1. The initial state is stored after the
+     * initial condition is computed and is the first checkpoint of every
+     * forward run.
+     */
+    struct CalibrationParameter
+    {
+      CalibrationParameterType type;
+      unsigned int             layer;
+      std::string              name;
+    };
+    CalibrationMode                    calibration_mode;
+    std::vector<CalibrationParameter>  calibration_parameters;
+    std::vector< std::vector<double> > measured_temperatures;
+    std::vector<int>                   measurement_rows;
+    State                              calibration_initial_state;
+    SparseMatrix<double>               adjoint_matrix;
+    Vector<double>                     adjoint_rhs;
+    /*
+     * For each layer parameter, the material of its layer with the
+     * parameter perturbed by parameter_perturbations[k] (the derivatives
+     * in adjoint_step() are finite differences), built once per gradient
+     * by adjoint_gradient(). Empty for the heat loss factor.
+     */
+    std::vector<std::unique_ptr<PorousMaterial> > perturbed_materials;
+    std::vector<double>                parameter_perturbations;
+    /*
+     * Materials, forcing and cell and face kernels, shared with the
+     * distributed version (see ColumnPhysics.h). Set up for 'parameters'
+     * in setup_parameters().
+     */
+    ColumnPhysics<dim>                 physics;
+  };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SharedMonitor.h"
+
+/*
+ * Follows the records that a running simulation publishes in shared
+ * memory ('monitor shared memory' in the parameter file) and prints them
+ * to the standard output, one tab separated line per time step, until the
+ * run is over. Attaching or detaching does not affect the simulation.
+ *
+ *   monitor_reader /composite_region [--from-start] [poll interval (ms)]
+ *
+ * Without --from-start only the records published after attaching are
+ * printed, otherwise also the ones still in the buffer.
+ */
+int main (int argc, char *argv[])
+{
+  if (argc<2)
+    {
+      std::cout << "Usage: " << argv[0]
+		<< " <shared memory name> [--from-start] [poll interval (ms)]\n";
+      return 1;
+    }
+  const std::string name=argv[1];
+  bool from_start=false;
+  unsigned int poll_interval=100;
+  for (int i=2; i<argc; i++)
+    {
+      if (std::string(argv[i]).compare("--from-start")==0)
+	from_start=true;
+      else
+	{
+	  /*
+	   * A zero interval would make the reader spin on the segment.
+	   */
+	  char *end=0;
+	  errno=0;
+	  const long value=std::strtol(argv[i],&end,10);
+	  if (end==argv[i] || *end!='\0' || errno!=0 ||
+	      value<=0 || value>3600000)
+	    {
+	      std::cout << "Error, the poll interval must be a number of milliseconds "
+			<< "from 1 to 3600000, got '" << argv[i] << "'\n";
+	      return 1;
+	    }
+	  poll_interval=value;
+	}
+    }
+
+  try
+    {
+      Monitoring::Reader reader(name,from_start);
+
+      std::cout << "#";
+      for (unsigned int i=0; i<Monitoring::n_fields; i++)
+	std::cout << "\t" << Monitoring::field_name(i);
+      for (unsigned int i=0; i<reader.n_probes(); i++)
+	std::cout << "\tprobe_" << i;
+      std::cout << std::endl;
+
+      std::vector<double> record;
+      while (true)
+	{
+	  unsigned long skipped=0;
+	  const Monitoring::Reader::Status status=reader.next(record,skipped);
+	  if (skipped!=0)
+	    std::cout << "# skipped " << skipped << " records\n";
+	  if (status==Monitoring::Reader::end_of_run)
+	    break;
+	  if (status==Monitoring::Reader::no_new_record)
+	    {
+	      std::cout.flush();
+	      std::this_thread::sleep_for(std::chrono::milliseconds(poll_interval));
+	      continue;
+	    }
+
+	  std::cout << (unsigned long)record[Monitoring::step_field];
+	  for (unsigned int i=1; i<record.size(); i++)
+	    std::cout << "\t" << std::setprecision(i<Monitoring::n_fields ? 10 : 5)
+		      << record[i];
+	  std::cout << "\n";
+	}
+      std::cout << "# end of run" << std::endl;
+    }
+  catch (...)
+    {
+      return 1;
+    }
+  return 0;
+}
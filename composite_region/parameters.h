@@ -10,10 +10,14 @@ namespace Parameters
       unsigned int timestep_number_max;
       double time_step;
       double theta;
+      std::string time_integrator;
+      unsigned int dimension;
       double domain_size;
-      double point_source_depth;
+      double domain_width;
+      std::vector<double> point_source_depths;
       unsigned int number_of_layers;
       unsigned int refinement_level;
+      unsigned int fe_degree;
       unsigned int output_frequency;
 
       double material_0_thermal_conductivity_solids;
@@ -71,10 +75,14 @@ namespace Parameters
       std::string material_4_name;
       
       double freezing_point;
+      double coefficient_update_tolerance;
+      double coefficient_freezing_band;
+      bool linear_fast_path;
       double alpha;
       double latent_heat;
       double reference_temperature;
       double heat_loss_factor;
+      double lateral_heat_transfer_coefficient;
 
       double density_ice;
       double density_air;
@@ -92,15 +100,64 @@ namespace Parameters
       bool fixed_at_top;
       bool point_source;
       bool output_data_in_terminal;
+      bool full_rate_output;
+      unsigned int output_precision;
+      std::vector<std::string> aggregated_output;
+      std::string monitor_shared_memory;
+      unsigned int monitor_buffer_size;
+      bool profiling;
+      bool batched_assembly;
+      bool check_batched_assembly;
+      bool sum_factorization;
+      std::string verbosity;
+      unsigned int log_every_n_steps;
+      double log_every_seconds;
+      std::string log_file;
 
       std::string boundary_condition_top;
+      std::string top_forcing;
+      double forcing_average;
+      double forcing_amplitude;
+      double forcing_period;
 
       std::string top_fixed_value_file;
       std::string initial_condition_file;
+      std::string initial_condition;
       std::string depths_file;
-      std::string point_source_file;
+      std::vector<std::string> point_source_files;
       std::string output_directory;
       std::string output_file;
+      std::string profiling_output_file;
+
+      std::string  preconditioner;
+      double       amg_aggregation_threshold;
+      unsigned int amg_smoother_sweeps;
+      std::string  linear_solver_precision;
+      double       mixed_precision_inner_tolerance;
+
+      unsigned int parareal_time_slices;
+      unsigned int parareal_coarse_factor;
+      double       parareal_coarse_coefficient_tolerance;
+      unsigned int parareal_max_iterations;
+      double       parareal_tolerance;
+      unsigned int parareal_threads;
+
+      std::string  reduced_model_mode;
+      std::string  reduced_model_file;
+      unsigned int reduced_model_snapshot_interval;
+      double       reduced_model_tolerance;
+      unsigned int reduced_model_max_basis_size;
+      unsigned int reduced_model_max_points;
+
+      std::string  calibration_mode;
+      std::string  calibration_measurements_file;
+      std::vector<std::string> calibration_parameters;
+      std::string  calibration_output_file;
+      unsigned int calibration_checkpoint_interval;
+      unsigned int calibration_max_iterations;
+      double       calibration_gradient_tolerance;
+      unsigned int calibration_history_size;
+      bool         calibration_check_gradient;
 
       static void declare_parameters (ParameterHandler &prm);
       void parse_parameters (ParameterHandler &prm);
@@ -112,10 +169,12 @@ namespace Parameters
       timestep_number_max=0;
       time_step=0.;
       theta=0.;
+      dimension=1;
       domain_size=0.;
-      point_source_depth=0.;
+      domain_width=0.;
       number_of_layers=0;
       refinement_level=0;
+      fe_degree=1;
       output_frequency=0;
 
       material_0_thermal_conductivity_solids=0.;
@@ -161,10 +220,14 @@ namespace Parameters
       material_4_porosity=0.;
 
       freezing_point=0.;
+      coefficient_update_tolerance=0.;
+      coefficient_freezing_band=0.;
+      linear_fast_path=false;
       alpha=0.;
       latent_heat=0.;
       reference_temperature=0.;
       heat_loss_factor=0.;
+      lateral_heat_transfer_coefficient=0.;
 
       density_ice=0.;
       density_air=0.;
@@ -182,6 +245,40 @@ namespace Parameters
       fixed_at_top=false;
       point_source=false;
       output_data_in_terminal=false;
+      full_rate_output=true;
+      output_precision=5;
+      monitor_buffer_size=4096;
+      forcing_average=0.;
+      forcing_amplitude=0.;
+      forcing_period=0.;
+      profiling=false;
+      batched_assembly=false;
+      check_batched_assembly=false;
+      sum_factorization=false;
+      log_every_n_steps=0;
+      log_every_seconds=0.;
+
+      amg_aggregation_threshold=0.;
+      amg_smoother_sweeps=0;
+      mixed_precision_inner_tolerance=0.;
+
+      parareal_time_slices=0;
+      parareal_coarse_factor=0;
+      parareal_coarse_coefficient_tolerance=0.;
+      parareal_max_iterations=0;
+      parareal_tolerance=0.;
+      parareal_threads=0;
+
+      reduced_model_snapshot_interval=0;
+      reduced_model_tolerance=0.;
+      reduced_model_max_basis_size=0;
+      reduced_model_max_points=0;
+
+      calibration_checkpoint_interval=0;
+      calibration_max_iterations=0;
+      calibration_gradient_tolerance=0.;
+      calibration_history_size=0;
+      calibration_check_gradient=false;
     }
 
   template <int dim>
@@ -201,14 +298,34 @@ namespace Parameters
 			  "value for theta that interpolated between explicit "
 			  "Euler (theta=0), Crank-Nicolson (theta=0.5), and "
 			  "implicit Euler (theta=1).");
+	prm.declare_entry("time integrator", "theta",
+			  Patterns::Selection("theta|bdf2|sdirk2"),
+			  "'theta' uses the theta scheme above. 'bdf2' "
+			  "(two step backward differentiation) and 'sdirk2' "
+			  "(two stage L-stable singly diagonally implicit "
+			  "Runge-Kutta, with an embedded error estimate) are "
+			  "second order and damp the oscillations of "
+			  "Crank-Nicolson at the freezing front; with either "
+			  "of them the theta value is ignored. The first step "
+			  "of bdf2 is done with sdirk2.");
       }
       prm.leave_subsection();
 
       prm.enter_subsection("geometric data");
       {
+	prm.declare_entry("dimension", "1",
+			  Patterns::Integer(1,3),
+			  "space dimension of the problem. In 1D the domain "
+			  "is a column, in 2D a vertical cross-section and in "
+			  "3D a block. The last coordinate is always the "
+			  "vertical one (negative downwards).");
 	prm.declare_entry("domain size", "20",
 			  Patterns::Double(0),
 			  "size of domain in m");
+	prm.declare_entry("domain width", "1.0",
+			  Patterns::Double(0),
+			  "lateral extent of the domain in m (2D and 3D only). "
+			  "The domain is centred at x=0 (and y=0).");
 	prm.declare_entry("number of layers", "1",
 			  Patterns::Integer(1,5),
 			  "number of layers composing the"
@@ -246,6 +363,11 @@ namespace Parameters
 	prm.declare_entry("refinement level", "5",
 			  Patterns::Integer(),
 			  "number of cells as in 2^n");
+	prm.declare_entry("finite element degree", "1",
+			  Patterns::Integer(1),
+			  "polynomial degree of the (Q) finite elements. Cell "
+			  "and face integrals use degree+2 Gauss points per "
+			  "direction.");
       }
       prm.leave_subsection();
 
@@ -279,6 +401,24 @@ namespace Parameters
 	prm.declare_entry("freezing point",
 			  "0.",Patterns::Double(-20.),
 			  "freezing point of pore water");
+	prm.declare_entry("coefficient update tolerance",
+			  "0.",Patterns::Double(0),
+			  "material properties at a quadrature point are "
+			  "reused until its temperature changes by more than "
+			  "this value (C) since they were evaluated. Set to 0 "
+			  "to evaluate them always.");
+	prm.declare_entry("coefficient freezing band",
+			  "1.",Patterns::Double(0),
+			  "material properties are always evaluated at points "
+			  "closer than this (C) to the freezing point.");
+	prm.declare_entry("linear fast path",
+			  "false",Patterns::Bool(),
+			  "if true, time steps where all temperatures are more "
+			  "than 'coefficient freezing band' above the freezing "
+			  "point are solved as a linear problem: the system "
+			  "matrix is factorized once and each step is one rhs "
+			  "update and one solve, without Picard iterations. "
+			  "Only used with the theta method.");
 	prm.declare_entry("alpha",
 			  "0.",Patterns::Double(-10.,0),
 			  "alpha of pore water");
@@ -477,26 +617,62 @@ namespace Parameters
 			  Patterns::Anything(),
 			  "file containing values of temperature to be "
 			  "used as initial condition.");
+	prm.declare_entry("initial condition","file",
+			  Patterns::Selection("file|steady state"),
+			  "'file' to project the profile in 'initial condition "
+			  "file', 'steady state' to start from the steady "
+			  "state of the column for the mean forcing (mean "
+			  "surface and room temperatures, fixed bottom "
+			  "value), solution of the stationary heat equation.");
 	prm.declare_entry("depths file","depths.txt",
 			  Patterns::Anything(),
 			  "file containing coordinates where data will "
 			  "be extracted.");
 	prm.declare_entry("point source file","point_source_file.txt",
-			  Patterns::Anything(),
-			  "file containing values for the magnitude "
-			  "of a point source in the domain.");
+			  Patterns::List(Patterns::Anything()),
+			  "comma separated list of files containing values "
+			  "for the magnitude of each point source in the "
+			  "domain. One file per entry in point source depth.");
 	prm.declare_entry("point source depth", "7.00",
-			  Patterns::Double(0),
-			  "depth of point souce in m");
+			  Patterns::List(Patterns::Double(0)),
+			  "comma separated list of depths of the point "
+			  "sources in m");
 	prm.declare_entry("heat loss factor","0.0",
 			  Patterns::Double(0.),
 			  "Heat loss factor in W/m3K. This is estimated integrating a"
 			  " surface heat transfer coefficient (W/m2K) over the boundary"
 			  " and dividing it by the volume of the domain");
+	prm.declare_entry("lateral heat transfer coefficient","0.0",
+			  Patterns::Double(0.),
+			  "Heat transfer coefficient in W/m2K between the lateral "
+			  "boundaries and the room (2D and 3D only). Set to 0 for "
+			  "adiabatic lateral boundaries.");
 	prm.declare_entry("boundary condition top","first",
 			  Patterns::Anything(),
 			  "set to first, second or third to set the "
 			  "corresponding boundary condition at the top");
+	prm.declare_entry("top forcing","synthetic",
+			  Patterns::Selection("synthetic|file"),
+			  "surface and room temperatures used with first and "
+			  "third type top boundary conditions: 'synthetic' for "
+			  "the sinusoid given below, 'file' to interpolate them "
+			  "from 'top fixed value file' (columns: time (s) from "
+			  "the start of the run, surface and room temperature; "
+			  "or a single column with the surface temperature at "
+			  "every time step, also used as room temperature).");
+	prm.declare_entry("forcing average","5.",
+			  Patterns::Double(),
+			  "mean value (C) of the sinusoidal surface and room "
+			  "temperatures used with first and third type top "
+			  "boundary conditions.");
+	prm.declare_entry("forcing amplitude","2.",
+			  Patterns::Double(0.),
+			  "amplitude (C) of the sinusoidal surface and room "
+			  "temperatures. Set to 0 for constant forcing.");
+	prm.declare_entry("forcing period","86400.",
+			  Patterns::Double(0.),
+			  "period (s) of the sinusoidal surface and room "
+			  "temperatures.");
       }
       prm.leave_subsection();
 
@@ -513,10 +689,239 @@ namespace Parameters
 			  Patterns::Anything(), "Defines the name of the filename "
 			  "to store the temperatures at the points defined "
 			  "in the file 'depths_file'");
+	prm.declare_entry("full rate output", "true",
+			  Patterns::Bool(),"if true, the probe temperatures and the "
+			  "energy balance are written to 'output file' after every "
+			  "time step.");
+	prm.declare_entry("output precision", "5",
+			  Patterns::Integer(1,17),"significant digits of the "
+			  "probe temperatures and the energy balance in 'output "
+			  "file'. 17 writes doubles exactly, e.g. to compare runs "
+			  "whose differences are below 1e-3 C.");
+	prm.declare_entry("aggregated output", "",
+			  Patterns::Anything(),"comma separated list of "
+			  "aggregation channels 'name period', e.g. 'hourly 3600, "
+			  "daily 86400'. Each channel writes the time averaged, "
+			  "minimum and maximum probe temperatures over windows of "
+			  "'period' seconds to 'name_' followed by 'output file', "
+			  "and the number of freeze-thaw and frozen windows of each "
+			  "probe at the end. Not available with parareal time "
+			  "slices.");
+	prm.declare_entry("monitor shared memory", "",
+			  Patterns::Anything(),"name of a POSIX shared memory "
+			  "segment, e.g. '/composite_region', where a record of "
+			  "every time step (time, iterations, energy balance and "
+			  "probe temperatures) is published for monitor_reader. "
+			  "Empty to disable. When enabled, the lines of 'output "
+			  "file' are no longer flushed one by one. The run stops "
+			  "if the segment already exists. Not available with "
+			  "parareal time slices or calibration.");
+	prm.declare_entry("monitor buffer size", "4096",
+			  Patterns::Integer(1),"number of time step records kept "
+			  "in the shared memory ring buffer. Readers that fall "
+			  "further behind lose the oldest records.");
 	prm.declare_entry("output data in terminal", "true",
 			  Patterns::Bool(),"if true, the program will generate output "
 			  "in the terminal. Set to false to avoid cluttering "
 			  "and speed up a bit the program.");
+	prm.declare_entry("profiling", "true",
+			  Patterns::Bool(),"if true, the wall clock time spent in "
+			  "each phase of the computation is measured and a summary "
+			  "table is printed at the end of the run.");
+	prm.declare_entry("profiling output file", "",
+			  Patterns::Anything(),"if not empty, the profiling data "
+			  "(wall times, iteration counters, problem size) is also "
+			  "written to this file in JSON format.");
+	prm.declare_entry("batched assembly", "true",
+			  Patterns::Bool(),"if true, and the mesh is a uniform 1D "
+			  "mesh, the cell terms are assembled in SIMD batches "
+			  "of cells instead of cell by cell with FEValues.");
+	prm.declare_entry("sum factorization", "true",
+			  Patterns::Bool(),"if true, in 2D and 3D the cell terms "
+			  "are computed with tensor product (sum factorization) "
+			  "kernels instead of FEValues. Pays off for degree 2 "
+			  "and higher.");
+	prm.declare_entry("check batched assembly", "false",
+			  Patterns::Bool(),"if true, every assembly is also done "
+			  "with the cell by cell kernel and the results are "
+			  "compared with those of the batched or sum factorized "
+			  "kernel. For testing only, it is slow.");
+	prm.declare_entry("verbosity", "steps",
+			  Patterns::Selection("quiet|normal|steps|debug"),
+			  "amount of output. 'quiet' prints nothing but errors, "
+			  "'normal' prints setup information and summaries, "
+			  "'steps' also prints one line per time step (see "
+			  "'log every n steps' and 'log every seconds') and "
+			  "'debug' adds extra checks. With 'output data in "
+			  "terminal' set to false the verbosity is at most "
+			  "'normal'.");
+	prm.declare_entry("log every n steps", "1",
+			  Patterns::Integer(0),"a time step line is printed "
+			  "every n time steps. 0 disables this limit.");
+	prm.declare_entry("log every seconds", "0",
+			  Patterns::Double(0.),"a time step line is printed "
+			  "if at least this many seconds of wall time have "
+			  "passed since the last one. 0 disables this limit.");
+	prm.declare_entry("log file", "",
+			  Patterns::Anything(),"if not empty, the output is "
+			  "written to this file instead of the terminal. In "
+			  "both cases it is buffered and written in blocks.");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("linear solver");
+      {
+	prm.declare_entry("preconditioner", "ssor",
+			  Patterns::Selection("ssor|amg"),
+			  "preconditioner used by the CG solver. 'amg' uses "
+			  "Trilinos' smoothed aggregation AMG if deal.II was "
+			  "configured with Trilinos and a built-in smoothed "
+			  "aggregation AMG otherwise. Recommended for 2D and 3D "
+			  "problems and fine meshes.");
+	prm.declare_entry("amg aggregation threshold", "0.08",
+			  Patterns::Double(0.,1.),
+			  "threshold on the relative size of the off-diagonal "
+			  "entries that defines strong connections for the "
+			  "aggregation.");
+	prm.declare_entry("amg smoother sweeps", "2",
+			  Patterns::Integer(1),
+			  "number of pre- and post-smoothing steps on each "
+			  "multigrid level.");
+	prm.declare_entry("precision", "double",
+			  Patterns::Selection("double|float"),
+			  "precision of the linear solver. 'float' solves "
+			  "each system by mixed precision iterative "
+			  "refinement: the residuals are computed in double "
+			  "precision and the corrections by CG on a single "
+			  "precision copy of the matrix, so the result is the "
+			  "same as with 'double' up to the solver tolerance. "
+			  "The double precision matrix is still assembled and "
+			  "copied on every solve, so 'float' uses more memory "
+			  "than 'double'. It can only be faster when the CG "
+			  "iterations dominate the solve.");
+	prm.declare_entry("mixed precision inner tolerance", "1e-4",
+			  Patterns::Double(1e-7,1.),
+			  "relative tolerance of each single precision solve "
+			  "of the iterative refinement.");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("parareal");
+      {
+	prm.declare_entry("time slices", "0",
+			  Patterns::Integer(0),
+			  "if larger than 1, the time steps are split into this "
+			  "many slices that are computed concurrently and "
+			  "corrected with a coarse propagator (parareal) until "
+			  "the temperatures at the slice boundaries converge. "
+			  "No vtu files are written in this mode. Not available "
+			  "with the bdf2 integrator. 0 or 1 runs the usual "
+			  "serial time loop.");
+	prm.declare_entry("coarse time step factor", "10",
+			  Patterns::Integer(1),
+			  "time step of the coarse propagator (backward Euler) "
+			  "over the time step of the fine one.");
+	prm.declare_entry("coarse coefficient update tolerance", "0.5",
+			  Patterns::Double(0.),
+			  "'coefficient update tolerance' used by the coarse "
+			  "propagator.");
+	prm.declare_entry("max iterations", "20",
+			  Patterns::Integer(1),
+			  "maximum number of parareal iterations. After as many "
+			  "iterations as slices the result is the serial one.");
+	prm.declare_entry("tolerance", "1e-3",
+			  Patterns::Double(0.),
+			  "iterations stop when the temperatures at all slice "
+			  "boundaries change by less than this (C).");
+	prm.declare_entry("threads", "0",
+			  Patterns::Integer(0),
+			  "number of slices computed at the same time. 0 uses "
+			  "one thread per core.");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("reduced model");
+      {
+	prm.declare_entry("mode", "off",
+			  Patterns::Selection("off|train|online|validate"),
+			  "'train' runs the full model, collects snapshots and "
+			  "writes a reduced (POD/DEIM) model to 'file'. 'online' "
+			  "reads it and runs the reduced model instead of the "
+			  "full one (only probe temperatures are written). "
+			  "'validate' runs both and reports the probe error of "
+			  "the reduced model. The reduced model uses backward "
+			  "Euler and supports a first type top condition "
+			  "without point sources, heat losses or lateral heat "
+			  "exchange.");
+	prm.declare_entry("file", "reduced_model.txt",
+			  Patterns::Anything(),
+			  "file the reduced model is written to or read from.");
+	prm.declare_entry("snapshot interval", "1",
+			  Patterns::Integer(1),
+			  "number of time steps between snapshots in 'train' "
+			  "mode.");
+	prm.declare_entry("tolerance", "1e-6",
+			  Patterns::Double(0.),
+			  "POD modes of the solution and of the coefficient "
+			  "fields are kept while their singular value is larger "
+			  "than this times the largest one.");
+	prm.declare_entry("max basis size", "30",
+			  Patterns::Integer(1),
+			  "maximum number of POD modes of the solution.");
+	prm.declare_entry("max interpolation points", "30",
+			  Patterns::Integer(1),
+			  "maximum number of DEIM points for each of the heat "
+			  "capacity and the thermal conductivity.");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("calibration");
+      {
+	prm.declare_entry("mode", "off",
+			  Patterns::Selection("off|gradient|optimize"),
+			  "'gradient' computes the misfit between the probe "
+			  "temperatures and the measured ones, and its gradient "
+			  "with respect to the calibration parameters with a "
+			  "discrete adjoint of the time loop. 'optimize' "
+			  "minimises the misfit with L-BFGS and writes the "
+			  "calibrated parameters to 'output file'. Both need "
+			  "backward Euler (theta method with theta=1) and no "
+			  "parareal time slices or reduced model.");
+	prm.declare_entry("measurements file", "measured_temperatures.txt",
+			  Patterns::Anything(),
+			  "measured temperatures, one line per measurement time: "
+			  "time (s) and one temperature (C) for each probe of "
+			  "the depths file, in the same order. Lines are matched "
+			  "to the nearest time step.");
+	prm.declare_entry("parameters", "porosity 0, degree of saturation 0",
+			  Patterns::Anything(),
+			  "comma separated list of calibrated parameters: "
+			  "'porosity n', 'degree of saturation n' (n is the layer, "
+			  "0 to 4) and 'heat loss factor'.");
+	prm.declare_entry("output file", "calibrated_parameters.txt",
+			  Patterns::Anything(),
+			  "file the calibrated parameters are written to.");
+	prm.declare_entry("checkpoint interval", "50",
+			  Patterns::Integer(1),
+			  "number of time steps between stored forward states. "
+			  "The adjoint recomputes the states in between, one "
+			  "interval at a time, so the memory used is about "
+			  "(steps/interval+interval) solution vectors.");
+	prm.declare_entry("max iterations", "20",
+			  Patterns::Integer(0),
+			  "maximum number of L-BFGS iterations.");
+	prm.declare_entry("gradient tolerance", "1e-4",
+			  Patterns::Double(0.),
+			  "L-BFGS stops when the gradient is smaller than this "
+			  "times the initial one.");
+	prm.declare_entry("history size", "5",
+			  Patterns::Integer(1),
+			  "number of L-BFGS correction pairs.");
+	prm.declare_entry("check gradient", "false",
+			  Patterns::Bool(),
+			  "in 'gradient' mode, also compute the gradient with "
+			  "central finite differences (two runs per parameter) "
+			  "and print both.");
       }
       prm.leave_subsection();
     }
@@ -531,15 +936,19 @@ namespace Parameters
 	time_step           = prm.get_double ("time step");
 	timestep_number_max = prm.get_integer("timestep number max");
 	theta               = prm.get_double ("theta scheme value");
+	time_integrator     = prm.get        ("time integrator");
       }
       prm.leave_subsection();
 
 
       prm.enter_subsection("geometric data");
       {
+	dimension             = prm.get_integer("dimension");
 	domain_size           = prm.get_double ("domain size");
+	domain_width          = prm.get_double ("domain width");
 	number_of_layers      = prm.get_integer("number of layers");
 	refinement_level      = prm.get_integer("refinement level");
+	fe_degree             = prm.get_integer("finite element degree");
 	material_0_depth      = prm.get_double ("material 0 depth");
 	material_0_thickness  = prm.get_double ("material 0 thickness");
 	material_1_depth      = prm.get_double ("material 1 depth");
@@ -564,6 +973,9 @@ namespace Parameters
 	density_ice                       = prm.get_double ("ice density");
 	reference_temperature             = prm.get_double ("reference temperature");
 	freezing_point                    = prm.get_double ("freezing point");
+	coefficient_update_tolerance      = prm.get_double ("coefficient update tolerance");
+	coefficient_freezing_band         = prm.get_double ("coefficient freezing band");
+	linear_fast_path                  = prm.get_bool   ("linear fast path");
 	alpha                             = prm.get_double ("alpha");
 	latent_heat                       = prm.get_double ("latent heat");
 	thermal_conductivity_liquids      = prm.get_double ("liquids thermal conductivity");
@@ -627,13 +1039,30 @@ namespace Parameters
 	bottom_fixed_value        = prm.get_double ("bottom fixed value");
 	fixed_at_top              = prm.get_bool   ("fixed at top");
 	point_source              = prm.get_bool   ("point source");
-	point_source_depth        = prm.get_double ("point source depth");
+	point_source_depths       = Utilities::string_to_double
+	  (Utilities::split_string_list(prm.get("point source depth")));
 	top_fixed_value_file      = prm.get        ("top fixed value file"); 
 	initial_condition_file    = prm.get        ("initial condition file");
+	initial_condition         = prm.get        ("initial condition");
 	depths_file               = prm.get        ("depths file");
-	point_source_file         = prm.get        ("point source file");
+	point_source_files        = Utilities::split_string_list
+	  (prm.get("point source file"));
 	heat_loss_factor          = prm.get_double ("heat loss factor");
+	lateral_heat_transfer_coefficient
+	  = prm.get_double ("lateral heat transfer coefficient");
 	boundary_condition_top    = prm.get        ("boundary condition top");
+	top_forcing               = prm.get        ("top forcing");
+	forcing_average           = prm.get_double ("forcing average");
+	forcing_amplitude         = prm.get_double ("forcing amplitude");
+	forcing_period            = prm.get_double ("forcing period");
+
+	if (point_source_files.size()!=point_source_depths.size())
+	  {
+	    std::cout << "Error, " << point_source_files.size()
+		      << " point source files given for "
+		      << point_source_depths.size() << " point source depths\n";
+	    throw 1;
+	  }
       }
       prm.leave_subsection();
 
@@ -643,6 +1072,69 @@ namespace Parameters
 	output_directory	= prm.get	 ("output directory");
 	output_file         = prm.get    ("output file");
 	output_data_in_terminal=prm.get_bool("output data in terminal");
+	full_rate_output    = prm.get_bool("full rate output");
+	output_precision    = prm.get_integer("output precision");
+	aggregated_output   = Utilities::split_string_list
+	  (prm.get("aggregated output"));
+	monitor_shared_memory=prm.get     ("monitor shared memory");
+	monitor_buffer_size = prm.get_integer("monitor buffer size");
+	profiling           = prm.get_bool("profiling");
+	profiling_output_file=prm.get     ("profiling output file");
+	batched_assembly    = prm.get_bool("batched assembly");
+	check_batched_assembly=prm.get_bool("check batched assembly");
+	sum_factorization   = prm.get_bool("sum factorization");
+	verbosity           = prm.get     ("verbosity");
+	log_every_n_steps   = prm.get_integer("log every n steps");
+	log_every_seconds   = prm.get_double("log every seconds");
+	log_file            = prm.get     ("log file");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("linear solver");
+      {
+	preconditioner            = prm.get        ("preconditioner");
+	amg_aggregation_threshold = prm.get_double ("amg aggregation threshold");
+	amg_smoother_sweeps       = prm.get_integer("amg smoother sweeps");
+	linear_solver_precision   = prm.get        ("precision");
+	mixed_precision_inner_tolerance=prm.get_double("mixed precision inner tolerance");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("parareal");
+      {
+	parareal_time_slices      = prm.get_integer("time slices");
+	parareal_coarse_factor    = prm.get_integer("coarse time step factor");
+	parareal_coarse_coefficient_tolerance=
+	  prm.get_double("coarse coefficient update tolerance");
+	parareal_max_iterations   = prm.get_integer("max iterations");
+	parareal_tolerance        = prm.get_double ("tolerance");
+	parareal_threads          = prm.get_integer("threads");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("reduced model");
+      {
+	reduced_model_mode             = prm.get        ("mode");
+	reduced_model_file             = prm.get        ("file");
+	reduced_model_snapshot_interval= prm.get_integer("snapshot interval");
+	reduced_model_tolerance        = prm.get_double ("tolerance");
+	reduced_model_max_basis_size   = prm.get_integer("max basis size");
+	reduced_model_max_points       = prm.get_integer("max interpolation points");
+      }
+      prm.leave_subsection();
+
+      prm.enter_subsection("calibration");
+      {
+	calibration_mode               = prm.get        ("mode");
+	calibration_measurements_file  = prm.get        ("measurements file");
+	calibration_parameters         = Utilities::split_string_list
+	  (prm.get("parameters"));
+	calibration_output_file        = prm.get        ("output file");
+	calibration_checkpoint_interval= prm.get_integer("checkpoint interval");
+	calibration_max_iterations     = prm.get_integer("max iterations");
+	calibration_gradient_tolerance = prm.get_double ("gradient tolerance");
+	calibration_history_size       = prm.get_integer("history size");
+	calibration_check_gradient     = prm.get_bool   ("check gradient");
       }
       prm.leave_subsection();
     }